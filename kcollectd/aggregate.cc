@@ -0,0 +1,317 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "aggregate.h"
+
+static const char *const names[] = {"", "sum", "mean", "min", "max",
+                                    "percentile"};
+
+const char *aggregate_name(aggregate_op op) { return names[op]; }
+
+aggregate_op aggregate_from_name(const std::string &name) {
+  for (int i = agg_sum; i <= agg_percentile; ++i)
+    if (name == names[i])
+      return aggregate_op(i);
+  return agg_none;
+}
+
+static const char *const rank_names[] = {"max", "mean", "p95"};
+
+const char *rank_name(rank_op op) { return rank_names[op]; }
+
+rank_op rank_from_name(const std::string &name) {
+  for (int i = rank_max; i <= rank_p95; ++i)
+    if (name == rank_names[i])
+      return rank_op(i);
+  return rank_max;
+}
+
+/**
+ * a score of a series to rank it by, -inf if it has no values
+ */
+double series_score(const std::vector<double> &data, rank_op op,
+                    std::vector<double> &scratch) {
+  const double none = -std::numeric_limits<double>::infinity();
+  const double *d = data.data();
+  const size_t n = data.size();
+
+  switch (op) {
+  case rank_max: {
+    double m = none;
+    for (size_t i = 0; i < n; ++i)
+      m = d[i] > m ? d[i] : m;
+    return m;
+  }
+  case rank_mean: {
+    double s = 0.0, c = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+      s += d[i] == d[i] ? d[i] : 0.0;
+      c += d[i] == d[i] ? 1.0 : 0.0;
+    }
+    return c > 0.0 ? s / c : none;
+  }
+  case rank_p95: {
+    scratch.clear();
+    for (size_t i = 0; i < n; ++i)
+      if (d[i] == d[i])
+        scratch.push_back(d[i]);
+    if (scratch.empty())
+      return none;
+    const size_t k = std::lround(0.95 * (scratch.size() - 1));
+    std::nth_element(scratch.begin(), scratch.begin() + k, scratch.end());
+    return scratch[k];
+  }
+  }
+  return none;
+}
+
+/**
+ * indices of the @a n highest @a scores, in ascending order
+ *
+ * if the set in @a top still scores at least as high as all others it
+ * is kept, so while the window moves the series are usually just
+ * checked instead of selected again.
+ */
+void select_top(const std::vector<double> &scores, size_t n,
+                std::vector<int> &top) {
+  const size_t size = scores.size();
+  n = std::min(n, size);
+
+  if (top.size() == n && n > 0 && n < size && top.back() < int(size)) {
+    std::vector<char> in_top(size, 0);
+    double lowest = std::numeric_limits<double>::infinity();
+    for (int i : top) {
+      in_top[i] = 1;
+      lowest = std::min(lowest, scores[i]);
+    }
+    bool dominates = true;
+    for (size_t i = 0; i < size && dominates; ++i)
+      dominates = in_top[i] || scores[i] <= lowest;
+    if (dominates)
+      return;
+  }
+
+  std::vector<int> order(size);
+  for (size_t i = 0; i < size; ++i)
+    order[i] = i;
+  std::nth_element(order.begin(), order.begin() + n, order.end(),
+                   [&scores](int a, int b) {
+                     return scores[a] > scores[b] ||
+                            (scores[a] == scores[b] && a < b);
+                   });
+  top.assign(order.begin(), order.begin() + n);
+  std::sort(top.begin(), top.end());
+}
+
+series_aggregator::series_aggregator(aggregate_op o)
+    : op(o), length(0), series(0), start(0), step(0) {}
+
+/**
+ * map @a data, from @a data_start on at @a data_step, onto @a length
+ * buckets from @a to_start on at @a to_step
+ *
+ * the value at index k is the one of the time from start + k * step
+ * on.  A coarser series is repeated, the rows of a finer one falling
+ * into a bucket are consolidated by @a cf, agg_mean, agg_min or
+ * agg_max, NaNs are ignored.  Buckets the series does not reach are
+ * NaN.
+ */
+void align_series(const std::vector<double> &data, time_t data_start,
+                  unsigned long data_step, aggregate_op cf, time_t to_start,
+                  unsigned long to_step, size_t length,
+                  std::vector<double> &out) {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  out.assign(length, nan);
+  const size_t n = data.size();
+  if (!n || !data_step || !to_step)
+    return;
+  const time_t s = data_step, e = data_start + time_t(n * data_step);
+  for (size_t k = 0; k < length; ++k) {
+    const time_t lo = to_start + time_t(k * to_step), hi = lo + time_t(to_step);
+    if (hi <= data_start || lo >= e)
+      continue;
+    const size_t first = lo > data_start ? (lo - data_start) / s : 0;
+    const size_t last = std::min(n, size_t((hi - data_start + s - 1) / s));
+    double r = cf == agg_min   ? std::numeric_limits<double>::infinity()
+               : cf == agg_max ? -std::numeric_limits<double>::infinity()
+                               : 0.0;
+    size_t c = 0;
+    for (size_t j = first; j < last; ++j) {
+      const double v = data[j];
+      if (v != v)
+        continue;
+      ++c;
+      if (cf == agg_min)
+        r = std::min(r, v);
+      else if (cf == agg_max)
+        r = std::max(r, v);
+      else
+        r += v;
+    }
+    if (c)
+      out[k] = cf == agg_min || cf == agg_max ? r : r / c;
+  }
+}
+
+void series_aggregator::init(size_t n) {
+  length = n;
+  switch (op) {
+  case agg_min:
+    acc.assign(length, std::numeric_limits<double>::infinity());
+    break;
+  case agg_max:
+    acc.assign(length, -std::numeric_limits<double>::infinity());
+    break;
+  default:
+    acc.assign(length, 0.0);
+  }
+  cnt.assign(length, 0.0);
+}
+
+/**
+ * fold in one more series of the columns of the first one, a longer
+ * one is cut, a shorter one is NaN at the end
+ */
+void series_aggregator::add(const std::vector<double> &data) {
+  if (!series)
+    init(data.size());
+  if (data.size() == length) {
+    fold(data);
+    return;
+  }
+  scratch.assign(data.begin(),
+                 data.begin() + std::min(data.size(), length));
+  scratch.resize(length, std::numeric_limits<double>::quiet_NaN());
+  fold(scratch);
+}
+
+/**
+ * fold in one more series, from @a data_start on at @a data_step
+ *
+ * it is mapped by time onto the buckets of the first series added,
+ * consolidated by @a cf where it is finer.
+ */
+void series_aggregator::add(const std::vector<double> &data,
+                            time_t data_start, unsigned long data_step,
+                            aggregate_op cf) {
+  if (!series) {
+    init(data.size());
+    start = data_start;
+    step = data_step;
+  }
+  if (data.size() == length && data_start == start && data_step == step) {
+    fold(data);
+    return;
+  }
+  align_series(data, data_start, data_step, cf, start, step, length,
+               scratch);
+  fold(scratch);
+}
+
+/**
+ * fold in a series of length buckets
+ */
+void series_aggregator::fold(const std::vector<double> &d) {
+  ++series;
+  const double *in = d.data();
+  double *a = acc.data(), *c = cnt.data();
+  const size_t n = length;
+
+  // x == x is false only for NaN and comparisons with NaN are false, so
+  // all selects compile to masked moves
+  switch (op) {
+  case agg_sum:
+  case agg_mean:
+    for (size_t i = 0; i < n; ++i) {
+      a[i] += in[i] == in[i] ? in[i] : 0.0;
+      c[i] += in[i] == in[i] ? 1.0 : 0.0;
+    }
+    break;
+  case agg_min:
+    for (size_t i = 0; i < n; ++i) {
+      a[i] = in[i] < a[i] ? in[i] : a[i];
+      c[i] += in[i] == in[i] ? 1.0 : 0.0;
+    }
+    break;
+  case agg_max:
+    for (size_t i = 0; i < n; ++i) {
+      a[i] = in[i] > a[i] ? in[i] : a[i];
+      c[i] += in[i] == in[i] ? 1.0 : 0.0;
+    }
+    break;
+  case agg_percentile:
+    all.insert(all.end(), d.begin(), d.end());
+    break;
+  case agg_none:
+    break;
+  }
+}
+
+/**
+ * the aggregate of all series added, NaN where no series had a value
+ */
+void series_aggregator::result(std::vector<double> &out) {
+  if (op == agg_percentile) {
+    percentile(50.0, out);
+    return;
+  }
+
+  out.resize(length);
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const double *a = acc.data(), *c = cnt.data();
+  double *o = out.data();
+  if (op == agg_mean) {
+    for (size_t i = 0; i < length; ++i)
+      o[i] = c[i] > 0.0 ? a[i] / c[i] : nan;
+  } else {
+    for (size_t i = 0; i < length; ++i)
+      o[i] = c[i] > 0.0 ? a[i] : nan;
+  }
+}
+
+/**
+ * the @a p-th percentile (nearest rank) of every column
+ */
+void series_aggregator::percentile(double p, std::vector<double> &out) {
+  out.assign(length, std::numeric_limits<double>::quiet_NaN());
+  if (op != agg_percentile)
+    return;
+
+  p = std::min(100.0, std::max(0.0, p));
+  std::vector<double> column;
+  column.reserve(series);
+  for (size_t i = 0; i < length; ++i) {
+    column.clear();
+    for (size_t s = 0; s < series; ++s) {
+      const double v = all[s * length + i];
+      if (v == v)
+        column.push_back(v);
+    }
+    if (column.empty())
+      continue;
+    const size_t k = std::lround(p / 100.0 * (column.size() - 1));
+    std::nth_element(column.begin(), column.begin() + k, column.end());
+    out[i] = column[k];
+  }
+}
@@ -0,0 +1,92 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <time.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+enum aggregate_op {
+  agg_none,
+  agg_sum,
+  agg_mean,
+  agg_min,
+  agg_max,
+  agg_percentile
+};
+
+const char *aggregate_name(aggregate_op op);
+aggregate_op aggregate_from_name(const std::string &name);
+
+void align_series(const std::vector<double> &data, time_t data_start,
+                  unsigned long data_step, aggregate_op cf, time_t to_start,
+                  unsigned long to_step, size_t length,
+                  std::vector<double> &out);
+
+enum rank_op { rank_max, rank_mean, rank_p95 };
+
+const char *rank_name(rank_op op);
+rank_op rank_from_name(const std::string &name);
+
+double series_score(const std::vector<double> &data, rank_op op,
+                    std::vector<double> &scratch);
+void select_top(const std::vector<double> &scores, size_t n,
+                std::vector<int> &top);
+
+/**
+ * folds many series column by column into one
+ *
+ * series added with their start and step are mapped by time onto the
+ * buckets of the first one added, the others are taken column by
+ * column.  NaNs are ignored.  For sum, mean, min and max every series is folded
+ * in when added, so memory does not grow with the number of series;
+ * the inner loops are branch-free so that the compiler vectorizes
+ * them.  Percentiles keep all series, so that several percentiles can
+ * be taken from one pass of fetching.
+ */
+class series_aggregator {
+public:
+  explicit series_aggregator(aggregate_op op);
+
+  void add(const std::vector<double> &data);
+  void add(const std::vector<double> &data, time_t data_start,
+           unsigned long data_step, aggregate_op cf);
+  void result(std::vector<double> &out);
+  void percentile(double p, std::vector<double> &out);
+  size_t count() const { return series; }
+
+private:
+  void init(size_t n);
+  void fold(const std::vector<double> &data);
+
+  aggregate_op op;
+  size_t length, series;
+  time_t start;       // of the first series
+  unsigned long step; // of the first series
+  std::vector<double> acc, cnt, scratch;
+  std::vector<double> all; // series after series, for percentiles
+};
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <unordered_set>
+
+#include <QCoreApplication>
+
+#include <KLocalizedString>
+
+#include "current_values.h"
+#include "misc.h"
+#include "rrd_interface.h"
+#include "rrdtree.h"
+#include "trace.h"
+
+// GETVAL commands sent before reading their answers
+static const size_t pipeline_depth = 256;
+
+/**
+ * the values of all value-lists collectd holds, counters as rates
+ *
+ * returns false if collectd can't be asked.
+ */
+bool unixsock_client::read(std::vector<current_value> &values) {
+  if (!enabled())
+    return false;
+  trace_span trace("unixsock_client::read");
+
+  // collectd may have closed a connection kept open, try once more
+  const bool reused = socket.is_open();
+  values.clear();
+  if (request(values))
+    return true;
+  socket.close();
+  values.clear();
+  if (reused && request(values))
+    return true;
+  socket.close();
+  return false;
+}
+
+bool unixsock_client::request(std::vector<current_value> &values) {
+  if (!socket.is_open() && !socket.connect(addr))
+    return false;
+
+  long status;
+  std::vector<std::string> ids, lines;
+  if (!socket.send("LISTVAL\n") || !socket.read_answer(status, &ids) ||
+      status < 0)
+    return false;
+  // lines are "<time> <identifier>"
+  for (std::string &id : ids)
+    id.erase(0, id.find(' ') + 1);
+
+  std::string commands;
+  for (size_t first = 0; first < ids.size(); first += pipeline_depth) {
+    const size_t last = std::min(ids.size(), first + pipeline_depth);
+    commands.clear();
+    for (size_t k = first; k < last; ++k) {
+      commands += "GETVAL ";
+      line_socket::quote(commands, ids[k]);
+      commands += '\n';
+    }
+    if (!socket.send(commands))
+      return false;
+
+    // lines are "<ds>=<value>", a value-list gone meanwhile has none
+    for (size_t k = first; k < last; ++k) {
+      if (!socket.read_answer(status, &lines))
+        return false;
+      for (const std::string &line : lines) {
+        const size_t eq = line.find('=');
+        if (eq == std::string::npos)
+          continue;
+        double v = std::numeric_limits<double>::quiet_NaN();
+        std::from_chars(line.data() + eq + 1, line.data() + line.size(), v);
+        values.push_back({ids[k], line.substr(0, eq), v});
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * all rrd-files of @a tree, each once
+ */
+void list_value_files(const rrd_tree &tree, std::vector<value_file> &files) {
+  trace_span trace("list_value_files");
+
+  files.clear();
+  std::unordered_set<std::string> listed;
+  for (uint32_t id = 0; id < tree.size(); ++id) {
+    if (!tree.leaf(id))
+      continue;
+    std::string rrd = tree.rrd(id);
+    if (!listed.insert(rrd).second)
+      continue;
+    const rrd_tree::node &n = tree[id];
+    files.push_back({std::move(rrd), tree.host(id) + '/' +
+                                         tree.interned(n.dir) + '/' +
+                                         tree.interned(tree.type(id))});
+  }
+}
+
+/**
+ * the latest values of all datasources of @a files, from the last rows
+ * of their finest archives
+ */
+void read_last_values(const std::vector<value_file> &files,
+                      std::vector<current_value> &values) {
+  trace_span trace("read_last_values");
+
+  values.clear();
+  std::vector<std::string> names;
+  std::vector<double> last;
+  for (const value_file &f : files) {
+    if (!get_last_values(f.rrd, names, last))
+      continue;
+    for (size_t k = 0; k < names.size(); ++k)
+      values.push_back({f.id, names[k], last[k]});
+  }
+}
+
+/**
+ * start reading, if not reading already
+ *
+ * the files of @a tree are listed here, the tree may change while
+ * reading.
+ */
+void current_values_reader::start(const rrd_tree &tree, QObject *receiver,
+                                  QEvent::Type type) {
+  if (busy())
+    return;
+  list_value_files(tree, files);
+  thread = std::thread([this, receiver, type] {
+    asked = unixsock_.read(values_);
+    if (!asked)
+      read_last_values(files, values_);
+    QCoreApplication::postEvent(receiver, new QEvent(type));
+  });
+}
+
+/**
+ * the values read, returns false if collectd wasn't asked
+ */
+bool current_values_reader::take(std::vector<current_value> &values) {
+  if (thread.joinable())
+    thread.join();
+  values.swap(values_);
+  values_.clear();
+  return asked;
+}
+
+static bool same(double a, double b) {
+  return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+/**
+ * take the latest @a values
+ *
+ * only rows whose value changed are signalled, datasources not known
+ * yet are appended sorted.  Rows missing in @a values keep their value.
+ */
+void CurrentValuesModel::update(const std::vector<current_value> &values) {
+  trace_span trace("CurrentValuesModel::update");
+
+  std::vector<int> changed;
+  std::vector<const current_value *> added;
+  std::string key;
+  for (const current_value &v : values) {
+    key = v.id;
+    key += '\0';
+    key += v.ds;
+    auto i = row_of.find(key);
+    if (i == row_of.end()) {
+      added.push_back(&v);
+    } else if (!same(rows[i->second].value, v.value)) {
+      rows[i->second].value = v.value;
+      changed.push_back(i->second);
+    }
+  }
+
+  // dataChanged for each run of adjacent rows
+  std::sort(changed.begin(), changed.end());
+  for (size_t k = 0; k < changed.size();) {
+    size_t e = k + 1;
+    while (e < changed.size() && changed[e] == changed[e - 1] + 1)
+      ++e;
+    emit dataChanged(index(changed[k], value_column),
+                     index(changed[e - 1], value_column));
+    k = e;
+  }
+
+  if (added.empty())
+    return;
+  std::sort(added.begin(), added.end(),
+            [](const current_value *a, const current_value *b) {
+              return a->id != b->id ? a->id < b->id : a->ds < b->ds;
+            });
+  added.erase(std::unique(added.begin(), added.end(),
+                          [](const current_value *a, const current_value *b) {
+                            return a->id == b->id && a->ds == b->ds;
+                          }),
+              added.end());
+  beginInsertRows(QModelIndex(), rows.size(), rows.size() + added.size() - 1);
+  for (const current_value *v : added) {
+    key = v->id;
+    key += '\0';
+    key += v->ds;
+    row_of.emplace(key, rows.size());
+    rows.push_back({QString::fromStdString(v->id),
+                    QString::fromStdString(v->ds), v->value});
+  }
+  endInsertRows();
+}
+
+int CurrentValuesModel::rowCount(const QModelIndex &parent) const {
+  return parent.isValid() ? 0 : rows.size();
+}
+
+int CurrentValuesModel::columnCount(const QModelIndex &parent) const {
+  return parent.isValid() ? 0 : columns;
+}
+
+/**
+ * values are formatted when shown, only for the visible rows
+ */
+QVariant CurrentValuesModel::data(const QModelIndex &index, int role) const {
+  if (!index.isValid())
+    return QVariant();
+  const row &r = rows[index.row()];
+  if (role == Qt::TextAlignmentRole && index.column() == value_column)
+    return int(Qt::AlignRight | Qt::AlignVCenter);
+  if (role != Qt::DisplayRole)
+    return QVariant();
+
+  switch (index.column()) {
+  case id_column:
+    return r.id;
+  case ds_column:
+    return r.ds;
+  default:
+    if (std::isnan(r.value))
+      return QString();
+    double m;
+    const char *prefix = si_prefix(r.value, m);
+    return QString::fromStdString(si_number(r.value, 4, prefix, m));
+  }
+}
+
+QVariant CurrentValuesModel::headerData(int section,
+                                        Qt::Orientation orientation,
+                                        int role) const {
+  if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+    return QVariant();
+  switch (section) {
+  case id_column:
+    return i18n("Value List");
+  case ds_column:
+    return i18n("Datasource");
+  default:
+    return i18n("Value");
+  }
+}
@@ -0,0 +1,137 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CURRENT_VALUES_H
+#define CURRENT_VALUES_H
+
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <QAbstractTableModel>
+#include <QEvent>
+
+#include "linesocket.h"
+
+class rrd_tree;
+
+/**
+ * the latest value of one datasource
+ */
+struct current_value {
+  std::string id; // host/plugin[-instance]/type[-instance]
+  std::string ds;
+  double value;
+};
+
+/**
+ * reads the latest values from collectds unixsock-plugin
+ *
+ * one connection is kept open, LISTVAL gives the identifiers and the
+ * GETVAL commands for them are sent at once before reading the answers.
+ */
+class unixsock_client {
+public:
+  // unix:/path or /path of the socket, empty disables it
+  void address(const std::string &a) {
+    socket.close();
+    addr = a;
+  }
+  bool enabled() const { return !addr.empty(); }
+
+  bool read(std::vector<current_value> &values);
+
+private:
+  bool request(std::vector<current_value> &values);
+
+  std::string addr;
+  line_socket socket;
+};
+
+/**
+ * a rrd-file and the identifier of its value-list
+ */
+struct value_file {
+  std::string rrd;
+  std::string id; // host/plugin[-instance]/type[-instance]
+};
+
+void list_value_files(const rrd_tree &tree, std::vector<value_file> &files);
+void read_last_values(const std::vector<value_file> &files,
+                      std::vector<current_value> &values);
+
+/**
+ * reads the current values in another thread, from collectd or, if it
+ * can't be asked, from the last rows of the rrd-files
+ *
+ * an event of @a type is posted to @a receiver when done, then the
+ * values are taken.
+ */
+class current_values_reader {
+public:
+  ~current_values_reader() {
+    if (thread.joinable())
+      thread.join();
+  }
+  unixsock_client &unixsock() { return unixsock_; }
+  bool busy() const { return thread.joinable(); }
+  void start(const rrd_tree &tree, QObject *receiver, QEvent::Type type);
+  bool take(std::vector<current_value> &values);
+
+private:
+  unixsock_client unixsock_;
+  std::vector<value_file> files;
+  std::vector<current_value> values_;
+  bool asked = false; // collectd answered
+  std::thread thread;
+};
+
+/**
+ * table of the latest value of every datasource
+ */
+class CurrentValuesModel : public QAbstractTableModel {
+  Q_OBJECT
+
+public:
+  enum column { id_column, ds_column, value_column, columns };
+
+  explicit CurrentValuesModel(QObject *parent = 0)
+      : QAbstractTableModel(parent) {}
+
+  void update(const std::vector<current_value> &values);
+
+  virtual int rowCount(const QModelIndex &parent) const override;
+  virtual int columnCount(const QModelIndex &parent) const override;
+  virtual QVariant data(const QModelIndex &index, int role) const override;
+  virtual QVariant headerData(int section, Qt::Orientation orientation,
+                              int role) const override;
+
+private:
+  struct row {
+    QString id, ds;
+    double value;
+  };
+  std::vector<row> rows;
+  std::unordered_map<std::string, int> row_of; // id \0 ds
+};
+
+#endif
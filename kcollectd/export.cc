@@ -0,0 +1,163 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "export.h"
+#include "rrd_interface.h"
+#include "trace.h"
+
+// rows fetched at once of each column, bounds the memory used
+static const size_t chunk_rows = 4096;
+
+template <typename T> static void put(std::string &out, T v) {
+  out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static void put_csv_field(std::string &out, const std::string &s) {
+  if (s.find_first_of(",\"\n") == std::string::npos) {
+    out += s;
+    return;
+  }
+  out += '"';
+  for (char c : s) {
+    if (c == '"')
+      out += '"';
+    out += c;
+  }
+  out += '"';
+}
+
+static void put_number(std::string &out, double v) {
+  char buffer[32];
+  const std::to_chars_result r =
+      std::to_chars(buffer, buffer + sizeof(buffer), v);
+  out.append(buffer, r.ptr);
+}
+
+/**
+ * write @a columns from @a start to @a end of consolidation-function
+ * @a cf to @a out
+ *
+ * the window is fetched and written in parts of chunk_rows, so the
+ * memory used does not depend on its length.  All columns get the step
+ * of the first, others are mapped onto it.  Returns false if the first
+ * column can't be read or writing failed.
+ */
+bool export_data(std::ostream &out, const std::vector<export_column> &columns,
+                 const char *cf, time_t start, time_t end,
+                 export_format format) {
+  if (columns.empty() || end <= start)
+    return false;
+  trace_span trace("export_data", TRACE_DETAIL(std::to_string(columns.size())));
+
+  const unsigned long step = get_resolution(columns.front().rrd, cf, start);
+  if (!step)
+    return false;
+  start -= start % step;
+  end += (step - end % step) % step;
+
+  std::string buffer;
+  if (format == export_csv) {
+    buffer = "time";
+    for (const export_column &c : columns) {
+      buffer += ',';
+      put_csv_field(buffer, c.name);
+    }
+    buffer += '\n';
+  } else {
+    buffer.append("kcexport", 8);
+    put<uint32_t>(buffer, 1);
+    put<uint32_t>(buffer, columns.size());
+    put<int64_t>(buffer, start);
+    put<uint64_t>(buffer, step);
+    for (const export_column &c : columns) {
+      put<uint32_t>(buffer, c.name.size());
+      buffer += c.name;
+    }
+  }
+  out.write(buffer.data(), buffer.size());
+
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const time_t chunk = chunk_rows * step;
+  std::vector<std::vector<double>> fetched(columns.size());
+  std::vector<std::vector<double>> rows(columns.size());
+  std::vector<rrd_request> batch;
+  for (time_t t = start; t < end && out; t += chunk) {
+    trace_span trace("export chunk");
+    const size_t n = (std::min(t + chunk, end) - t) / step;
+
+    // columns of one file are read at once
+    batch.clear();
+    for (size_t c = 0; c < columns.size(); ++c)
+      batch.push_back({columns[c].rrd, columns[c].ds, cf, t,
+                       t + time_t(n * step), step, &fetched[c]});
+    get_rrd_data(batch);
+
+    // the rows of each column, mapped to the times of the chunk
+    for (size_t c = 0; c < columns.size(); ++c) {
+      const time_t s = batch[c].start;
+      const unsigned long st = batch[c].step;
+      const std::vector<double> &f = fetched[c];
+      std::vector<double> &col = rows[c];
+      if (s == t && st == step && f.size() >= n) {
+        col.assign(f.begin(), f.begin() + n);
+        continue;
+      }
+      col.assign(n, nan);
+      for (size_t r = 0; r < n && st; ++r) {
+        const time_t when = t + time_t(r + 1) * step;
+        if (when <= s)
+          continue;
+        const size_t k = (when - s - 1) / st;
+        if (k < f.size())
+          col[r] = f[k];
+      }
+    }
+
+    buffer.clear();
+    if (format == export_csv) {
+      for (size_t r = 0; r < n; ++r) {
+        buffer += std::to_string(t + time_t(r + 1) * step);
+        for (const std::vector<double> &col : rows) {
+          buffer += ',';
+          if (!std::isnan(col[r]))
+            put_number(buffer, col[r]);
+        }
+        buffer += '\n';
+      }
+    } else {
+      put<uint32_t>(buffer, n);
+      for (const std::vector<double> &col : rows)
+        buffer.append(reinterpret_cast<const char *>(col.data()),
+                      n * sizeof(double));
+    }
+    out.write(buffer.data(), buffer.size());
+  }
+
+  if (format == export_binary)
+    out.write("\0\0\0\0", 4);
+  out.flush();
+  return bool(out);
+}
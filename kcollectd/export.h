@@ -0,0 +1,56 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <time.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * one datasource written, as a column
+ */
+struct export_column {
+  std::string rrd;
+  std::string ds;
+  std::string name;
+};
+
+/**
+ * csv: a header-line "time,<name>..." and a line per row, the time in
+ * seconds since the epoch and empty fields for unknown values.
+ *
+ * binary: "kcexport", uint32 version (1), uint32 columns, int64 start,
+ * uint64 step and per column uint32 length and name.  Then blocks of
+ * uint32 rows and the rows of each column as doubles, one column
+ * after the other; a block of 0 rows ends the file.  Row n of all
+ * blocks is at start + (n + 1) * step.  Numbers are in host byte order.
+ */
+enum export_format { export_csv, export_binary };
+
+bool export_data(std::ostream &out, const std::vector<export_column> &columns,
+                 const char *cf, time_t start, time_t end,
+                 export_format format);
+
+#endif
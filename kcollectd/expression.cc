@@ -0,0 +1,491 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "expression.h"
+
+static const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+/**
+ * recursive-descent parser emitting the program of an expression
+ *
+ *   comparison := sum [ ("<" | ">" | "<=" | ">=" | "==" | "!=") sum ]
+ *   sum        := product { ("+" | "-") product }
+ *   product    := unary { ("*" | "/") unary }
+ *   unary      := "-" unary | primary
+ *   primary    := number | name | name "(" arguments ")" | "(" comparison ")"
+ */
+class expression_parser {
+public:
+  expression_parser(expression &e, const std::string &text,
+                    const std::vector<std::string> &vars)
+      : e(e), text(text), vars(vars), pos(0), sp(0), rates(0) {}
+
+  void parse();
+
+private:
+  typedef expression::opcode opcode;
+
+  void comparison();
+  void sum();
+  void product();
+  void unary();
+  void primary();
+  void function(const std::string &name, size_t at);
+
+  void skip();
+  bool accept(const char *token);
+  void expect(char c);
+  void emit(opcode op, int arg, int pops, int pushes = 1);
+  [[noreturn]] void error(const std::string &what, size_t at) const {
+    throw expression_error(what, at);
+  }
+
+  expression &e;
+  const std::string &text;
+  const std::vector<std::string> &vars;
+  size_t pos;
+  size_t sp;    // current size of the stack
+  size_t rates; // current nesting of rate()
+};
+
+void expression_parser::skip() {
+  while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos])))
+    ++pos;
+}
+
+bool expression_parser::accept(const char *token) {
+  skip();
+  const size_t len = strlen(token);
+  if (text.compare(pos, len, token) != 0)
+    return false;
+  pos += len;
+  return true;
+}
+
+void expression_parser::expect(char c) {
+  skip();
+  if (pos >= text.size() || text[pos] != c)
+    error(std::string("‘") + c + "’ expected", pos);
+  ++pos;
+}
+
+void expression_parser::emit(opcode op, int arg, int pops, int pushes) {
+  e.code.push_back({op, arg});
+  sp = sp - pops + pushes;
+  if (sp > e.depth)
+    e.depth = sp;
+}
+
+void expression_parser::parse() {
+  e.code.clear();
+  e.constants.clear();
+  e.depth = 0;
+  e.lookback = 0;
+
+  comparison();
+  skip();
+  if (pos != text.size())
+    error("unexpected ‘" + text.substr(pos, 1) + "’", pos);
+}
+
+void expression_parser::comparison() {
+  sum();
+  static const struct {
+    const char *token;
+    expression::opcode op;
+  } ops[] = {{"<=", expression::op_le}, {">=", expression::op_ge},
+             {"==", expression::op_eq}, {"!=", expression::op_ne},
+             {"<", expression::op_lt},  {">", expression::op_gt}};
+  for (const auto &o : ops) {
+    if (accept(o.token)) {
+      sum();
+      emit(o.op, 0, 2);
+      return;
+    }
+  }
+}
+
+void expression_parser::sum() {
+  product();
+  for (;;) {
+    if (accept("+")) {
+      product();
+      emit(expression::op_add, 0, 2);
+    } else if (accept("-")) {
+      product();
+      emit(expression::op_sub, 0, 2);
+    } else {
+      return;
+    }
+  }
+}
+
+void expression_parser::product() {
+  unary();
+  for (;;) {
+    if (accept("*")) {
+      unary();
+      emit(expression::op_mul, 0, 2);
+    } else if (accept("/")) {
+      unary();
+      emit(expression::op_div, 0, 2);
+    } else {
+      return;
+    }
+  }
+}
+
+void expression_parser::unary() {
+  if (accept("-")) {
+    unary();
+    emit(expression::op_neg, 0, 1);
+  } else {
+    primary();
+  }
+}
+
+void expression_parser::primary() {
+  skip();
+  if (pos >= text.size())
+    error("unexpected end of expression", pos);
+
+  const size_t at = pos;
+  const unsigned char c = text[pos];
+  if (accept("(")) {
+    comparison();
+    expect(')');
+  } else if (isdigit(c) || c == '.') {
+    // from_chars ignores the locale, strtod would want a ',' in some
+    double value;
+    const char *const first = text.data() + pos;
+    const std::from_chars_result r =
+        std::from_chars(first, text.data() + text.size(), value);
+    if (r.ec != std::errc() || r.ptr == first)
+      error("malformed number", at);
+    pos = r.ptr - text.data();
+    e.constants.push_back(value);
+    emit(expression::op_const, e.constants.size() - 1, 0);
+  } else if (isalpha(c) || c == '_') {
+    while (pos < text.size() &&
+           (isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_'))
+      ++pos;
+    const std::string name = text.substr(at, pos - at);
+    if (accept("(")) {
+      function(name, at);
+      return;
+    }
+    for (size_t i = 0; i < vars.size(); ++i) {
+      if (vars[i] == name) {
+        emit(expression::op_var, i, 0);
+        return;
+      }
+    }
+    if (name == "nan" || name == "inf") {
+      e.constants.push_back(name == "nan"
+                                ? NaN
+                                : std::numeric_limits<double>::infinity());
+      emit(expression::op_const, e.constants.size() - 1, 0);
+      return;
+    }
+    error("unknown variable ‘" + name + "’", at);
+  } else {
+    error("unexpected ‘" + text.substr(pos, 1) + "’", at);
+  }
+}
+
+/**
+ * arguments and call of a function, the "(" is already consumed
+ */
+void expression_parser::function(const std::string &name, size_t at) {
+  static const struct {
+    const char *name;
+    expression::opcode op;
+    int args;
+  } functions[] = {
+      {"abs", expression::op_abs, 1},     {"sqrt", expression::op_sqrt, 1},
+      {"min", expression::op_min, 2},     {"max", expression::op_max, 2},
+      {"ifnan", expression::op_ifnan, 2}, {"if", expression::op_if, 3},
+      {"rate", expression::op_rate, 1},
+  };
+  for (const auto &f : functions) {
+    if (name != f.name)
+      continue;
+
+    if (f.op == expression::op_rate && ++rates > e.lookback)
+      e.lookback = rates;
+    for (int i = 0; i < f.args; ++i) {
+      if (i)
+        expect(',');
+      comparison();
+    }
+    expect(')');
+    if (f.op == expression::op_rate)
+      --rates;
+    emit(f.op, 0, f.args);
+    return;
+  }
+  error("unknown function ‘" + name + "’", at);
+}
+
+/**
+ * compile @a text, @a vars are the names of the inputs in the order
+ * they are passed to evaluate
+ *
+ * throws expression_error
+ */
+void expression::compile(const std::string &text,
+                         const std::vector<std::string> &vars) {
+  expression_parser parser(*this, text, vars);
+  try {
+    parser.parse();
+  } catch (...) {
+    code.clear();
+    throw;
+  }
+}
+
+/**
+ * evaluate the columns [@a from, @a to) of the inputs @a in into @a out
+ *
+ * @a out has to hold at least @a to values, columns before @a from are
+ * left untouched.  @a step is the time between two columns for rate().
+ */
+void expression::evaluate(const std::vector<const double *> &in, size_t from,
+                          size_t to, double step, double *out) const {
+  if (from >= to || code.empty())
+    return;
+
+  // rate() needs the columns before the first one
+  const size_t pre = std::min(lookback, from);
+  const size_t begin = from - pre;
+  const size_t n = to - begin;
+  std::vector<double> stack(depth * n);
+  double *const base = stack.data();
+  size_t sp = 0;
+
+  for (const instruction &i : code) {
+    double *const x = base + (sp - 1) * n; // top of stack
+    double *const y = base + (sp - 2) * n; // below the top
+    switch (i.op) {
+    case op_const: {
+      double *const r = base + sp++ * n;
+      std::fill(r, r + n, constants[i.arg]);
+      break;
+    }
+    case op_var: {
+      double *const r = base + sp++ * n;
+      std::copy(in[i.arg] + begin, in[i.arg] + to, r);
+      break;
+    }
+    case op_neg:
+      for (size_t k = 0; k < n; ++k)
+        x[k] = -x[k];
+      break;
+    case op_abs:
+      for (size_t k = 0; k < n; ++k)
+        x[k] = std::fabs(x[k]);
+      break;
+    case op_sqrt:
+      for (size_t k = 0; k < n; ++k)
+        x[k] = std::sqrt(x[k]);
+      break;
+    case op_rate:
+      // backwards, so every column still sees its unchanged predecessor
+      for (size_t k = n - 1; k > 0; --k)
+        x[k] = (x[k] - x[k - 1]) / step;
+      x[0] = NaN;
+      break;
+    case op_add:
+      for (size_t k = 0; k < n; ++k)
+        y[k] = y[k] + x[k];
+      --sp;
+      break;
+    case op_sub:
+      for (size_t k = 0; k < n; ++k)
+        y[k] = y[k] - x[k];
+      --sp;
+      break;
+    case op_mul:
+      for (size_t k = 0; k < n; ++k)
+        y[k] = y[k] * x[k];
+      --sp;
+      break;
+    // the selects are computed branch-free so the loops vectorize
+    case op_div:
+      for (size_t k = 0; k < n; ++k) {
+        const double q = y[k] / x[k];
+        y[k] = x[k] != 0.0 ? q : NaN;
+      }
+      --sp;
+      break;
+    // comparisons are 1 or 0, NaN if a side is unknown
+    case op_lt:
+      for (size_t k = 0; k < n; ++k) {
+        const double r = y[k] < x[k] ? 1.0 : 0.0;
+        y[k] = (y[k] == y[k]) & (x[k] == x[k]) ? r : NaN;
+      }
+      --sp;
+      break;
+    case op_gt:
+      for (size_t k = 0; k < n; ++k) {
+        const double r = y[k] > x[k] ? 1.0 : 0.0;
+        y[k] = (y[k] == y[k]) & (x[k] == x[k]) ? r : NaN;
+      }
+      --sp;
+      break;
+    case op_le:
+      for (size_t k = 0; k < n; ++k) {
+        const double r = y[k] <= x[k] ? 1.0 : 0.0;
+        y[k] = (y[k] == y[k]) & (x[k] == x[k]) ? r : NaN;
+      }
+      --sp;
+      break;
+    case op_ge:
+      for (size_t k = 0; k < n; ++k) {
+        const double r = y[k] >= x[k] ? 1.0 : 0.0;
+        y[k] = (y[k] == y[k]) & (x[k] == x[k]) ? r : NaN;
+      }
+      --sp;
+      break;
+    case op_eq:
+      for (size_t k = 0; k < n; ++k) {
+        const double r = y[k] == x[k] ? 1.0 : 0.0;
+        y[k] = (y[k] == y[k]) & (x[k] == x[k]) ? r : NaN;
+      }
+      --sp;
+      break;
+    case op_ne:
+      for (size_t k = 0; k < n; ++k) {
+        const double r = y[k] != x[k] ? 1.0 : 0.0;
+        y[k] = (y[k] == y[k]) & (x[k] == x[k]) ? r : NaN;
+      }
+      --sp;
+      break;
+    case op_min:
+      for (size_t k = 0; k < n; ++k)
+        y[k] = (y[k] != y[k]) | (x[k] < y[k]) ? x[k] : y[k];
+      --sp;
+      break;
+    case op_max:
+      for (size_t k = 0; k < n; ++k)
+        y[k] = (y[k] != y[k]) | (x[k] > y[k]) ? x[k] : y[k];
+      --sp;
+      break;
+    case op_ifnan:
+      for (size_t k = 0; k < n; ++k)
+        y[k] = y[k] == y[k] ? y[k] : x[k];
+      --sp;
+      break;
+    case op_if: {
+      double *const c = base + (sp - 3) * n;
+      for (size_t k = 0; k < n; ++k) {
+        const double r = c[k] != 0.0 ? y[k] : x[k];
+        c[k] = c[k] == c[k] ? r : NaN;
+      }
+      sp -= 2;
+      break;
+    }
+    }
+  }
+
+  std::copy(base + pre, base + n, out + from);
+}
+
+/**
+ * index of the first value that differs bitwise (NaNs are equal)
+ */
+static size_t first_difference(const double *a, const double *b, size_t n) {
+  if (memcmp(a, b, n * sizeof(double)) == 0)
+    return n;
+  size_t i = 0;
+  while (i < n && memcmp(a + i, b + i, sizeof(double)) == 0)
+    ++i;
+  return i;
+}
+
+/**
+ * evaluate @a e over the inputs @a in, which all have the same length
+ * and start at @a start with @a step seconds between values
+ */
+void expression_cache::evaluate(const expression &e,
+                                const std::vector<std::vector<double>> &in,
+                                time_t start, unsigned long step,
+                                std::vector<double> &out) {
+  const size_t n = in.empty() ? 0 : in.front().size();
+  std::vector<const double *> inputs;
+  for (const std::vector<double> &v : in)
+    inputs.push_back(v.data());
+
+  // columns [keep_lo, keep_hi) are taken from the last result
+  size_t keep_lo = 0, keep_hi = 0;
+  long shift = 0;
+  if (step && step == last_step && last.size() == in.size() &&
+      !result.empty() && (start - last_start) % long(step) == 0) {
+    shift = (start - last_start) / long(step);
+    const long lo = std::max(0L, -shift);
+    const long end = std::min(long(n), long(result.size()) - shift);
+    if (lo < end) {
+      size_t hi = end;
+      for (size_t v = 0; v < in.size(); ++v)
+        hi = lo + first_difference(in[v].data() + lo,
+                                   last[v].data() + lo + shift, hi - lo);
+      // columns at the border depend on columns not compared
+      keep_lo = shift == 0 ? lo : std::min(lo + e.history(), hi);
+      keep_hi = hi;
+    }
+  }
+
+  std::vector<double> next(n, NaN);
+  if (keep_lo < keep_hi)
+    std::copy(result.begin() + keep_lo + shift,
+              result.begin() + keep_hi + shift, next.begin() + keep_lo);
+  e.evaluate(inputs, 0, keep_lo, step, next.data());
+  e.evaluate(inputs, keep_hi, n, step, next.data());
+  computed = n - (keep_hi - keep_lo);
+
+  result.swap(next);
+  last = in;
+  last_start = start;
+  last_step = step;
+  out = result;
+}
+
+void expression_cache::clear() {
+  last.clear();
+  result.clear();
+  last_step = 0;
+}
+
+/**
+ * bytes of the inputs and the result kept
+ */
+size_t expression_cache::memory() const {
+  size_t bytes = result.capacity() * sizeof(double);
+  for (const std::vector<double> &v : last)
+    bytes += v.capacity() * sizeof(double);
+  return bytes;
+}
@@ -0,0 +1,113 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <time.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * error while compiling an expression, position is the offset in the text
+ */
+class expression_error : public std::runtime_error {
+public:
+  expression_error(const std::string &what, size_t position)
+      : std::runtime_error(what), position(position) {}
+  size_t position;
+};
+
+/**
+ * an arithmetic expression over datasources, like a CDEF of rrdtool
+ *
+ * The infix text is compiled once into a flat program for a stack
+ * machine.  Every instruction works on whole columns of values, so
+ * evaluation is a short sequence of simple loops.  NaN (unknown)
+ * propagates through arithmetic; x/0 is NaN.
+ *
+ *   operators:  + - * / < > <= >= == != and unary -
+ *   functions:  abs(x) sqrt(x) min(x, y) max(x, y) (ignore NaN)
+ *               ifnan(x, y) if(c, x, y) rate(x) (change per second)
+ *   constants:  numbers, nan, inf
+ */
+class expression {
+public:
+  expression() : depth(0), lookback(0) {}
+
+  void compile(const std::string &text, const std::vector<std::string> &vars);
+  bool empty() const { return code.empty(); }
+
+  void evaluate(const std::vector<const double *> &in, size_t from,
+                size_t to, double step, double *out) const;
+
+  // number of columns before a column its value depends on
+  size_t history() const { return lookback; }
+
+private:
+  friend class expression_parser;
+
+  enum opcode {
+    op_const, op_var, op_neg, op_add, op_sub, op_mul, op_div,
+    op_lt, op_gt, op_le, op_ge, op_eq, op_ne,
+    op_abs, op_sqrt, op_min, op_max, op_ifnan, op_if, op_rate
+  };
+  struct instruction {
+    opcode op;
+    int arg; // index of constant or variable
+  };
+
+  std::vector<instruction> code;
+  std::vector<double> constants;
+  size_t depth;    // maximum size of the stack
+  size_t lookback; // nesting of rate()
+};
+
+/**
+ * evaluates an expression for successive windows of data
+ *
+ * the inputs of the last evaluation are kept, so when the window only
+ * moved or only the newest values changed, just the columns whose
+ * inputs changed are computed again.
+ */
+class expression_cache {
+public:
+  expression_cache() : last_start(0), last_step(0), computed(0) {}
+
+  void evaluate(const expression &e, const std::vector<std::vector<double>> &in,
+                time_t start, unsigned long step, std::vector<double> &out);
+  void clear();
+  size_t memory() const;
+
+  // columns computed by the last evaluation
+  size_t recomputed() const { return computed; }
+
+private:
+  std::vector<std::vector<double>> last;
+  std::vector<double> result;
+  time_t last_start;
+  unsigned long last_step;
+  size_t computed;
+};
+
+#endif
@@ -21,23 +21,41 @@
 
 #include <time.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <utility>
 #include <vector>
 
+#include <QCoreApplication>
+#include <QEvent>
 #include <QFontDatabase>
 #include <QFrame>
 #include <QIcon>
+#include <QImage>
+#include <QInputDialog>
+#include <QLineEdit>
 #include <QMenu>
 #include <QPainter>
 #include <QPolygon>
 #include <QRect>
+#include <QStringList>
 
 #include <KLocalizedString>
 
 #include "graph.h"
+#include "labelcache.h"
+#include "live.h"
 #include "misc.h"
 #include "rrd_interface.h"
+#include "rrdcached.h"
+#include "series_cache.h"
 #include "timeaxis.h"
+#include "trace.h"
 
 #define I18N_NOOP(text) text
 
@@ -54,6 +72,13 @@ static const double header_font_mag = 1.2;
 // distance between elements
 const int marg = 2;
 
+// events of fetches in other threads
+static const QEvent::Type fetched_event = QEvent::User;
+static const QEvent::Type chunk_event = QEvent::Type(QEvent::User + 1);
+
+// rows of a part of a long window, longer than two of them are parted
+static const size_t chunk_rows = 1 << 16;
+
 inline double norm(const QPointF &a) {
   return sqrt(a.x() * a.x() + a.y() * a.y());
 }
@@ -62,22 +87,30 @@ inline double norm(const QPointF &a) {
  *
  */
 Graph::Graph(QWidget *parent)
-    : QFrame(parent), data_is_valid(false), start(time(0) - 3600 * 24),
-      span(3600 * 24), step(1), dragging(false),
+    : QFrame(parent), data_is_valid(false), data_packed(false), downsampled(0),
+      data_cached(false), cache_tried(false), fetched_at(0),
+      start(time(0) - 3600 * 24),
+      span(3600 * 24), step(1), format_x(0), center_x(false), axis_start(0),
+      axis_end(0), axis_width(-1), dragging(false),
+      crosshair_shown(false),
       font(QFontDatabase::systemFont(QFontDatabase::GeneralFont)),
       small_font(
           QFontDatabase::systemFont(QFontDatabase::SmallestReadableFont)),
+      xlabels(small_font), ylabels(font), drawn(false), snapshot_start(0),
+      snapshot_span(0), snapshot_time(0),
       color_major(140, 115, 60), color_minor(80, 65, 34),
       color_graph_bg(0, 0, 0),
       // color_major(255, 180, 180), color_minor(220, 220, 220),
       // color_graph_bg(255, 255, 255),
       // color_minmax(180, 255, 180, 200), color_line(0, 170, 0),
-      autoUpdateTimer(-1) {
+      autoUpdateTimer(-1), update_interval(10000), liveTimer(-1),
+      show_timing(false) {
   setFrameStyle(QFrame::StyledPanel | QFrame::Plain);
   setMinimumWidth(300);
   setMinimumHeight(150);
   setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
   setAcceptDrops(true);
+  setMouseTracking(true);
 
   // setup color-tables
   for (int i = 0; i < 8; ++i) {
@@ -99,6 +132,18 @@ Graph::Graph(QWidget *parent)
   tz_off = tz.tz_minuteswest * 60;
 }
 
+Graph::~Graph() {
+  cancelChunks();
+  for (const std::shared_ptr<chunked_fetch> &job : stopped_chunks)
+    for (std::thread &t : job->threads)
+      t.join();
+  if (pending)
+    pending->cancelled = true;
+  if (fetcher.joinable())
+    fetcher.join();
+  remember();
+}
+
 /**
  * get average, min and max data
  *
@@ -112,35 +157,890 @@ bool Graph::fetchAllData() {
   if (empty())
     return (false);
 
-  for (graph_list::iterator i = begin(); i != end(); ++i) {
-    for (GraphInfo::iterator j = i->begin(); j != i->end(); ++j) {
-      const std::string file(j->rrd.toUtf8().data());
-      const std::string ds(j->ds.toUtf8().data());
+  if (!cache_tried) {
+    cache_tried = true;
+    if (fetchCached())
+      return (true);
+  }
 
-      data_start = start;
-      data_end = start + span;
-      step = 1;
-      get_rrd_data(file, ds, &data_start, &data_end, &step, "MIN",
-                   &j->min_data);
+  trace_span trace("fetchAllData");
+  stage_timer fetch_timer(timing_, frame_timing::fetch);
+  stage_timer rrd_timer(timing_, frame_timing::rrd_fetch, false);
+  size_t bytes = 0;
 
-      data_start = start;
-      data_end = start + span;
-      step = 1;
-      get_rrd_data(file, ds, &data_start, &data_end, &step, "MAX",
-                   &j->max_data);
+  fetched_at = time(0);
+  std::vector<series_ptr> batch;
+  rrd_timer.start();
+  flushCached();
+  fetchChunked();
+  fetchBatch(batch);
+  rrd_timer.stop();
 
-      data_start = start;
-      data_end = start + span;
-      step = 1;
-      get_rrd_data(file, ds, &data_start, &data_end, &step, "AVERAGE",
-                   &j->avg_data);
+  for (graph_list::iterator i = begin(); i != end(); ++i) {
+    for (GraphInfo::iterator j = i->begin(); j != i->end(); ++j) {
+      if (j->aggregate != agg_none) {
+        fetchAggregate(*j, rrd_timer);
+      } else if (!j->expr.isEmpty()) {
+        fetchDerived(*j, rrd_timer);
+      } else {
+        rrd_timer.start();
+        j->min_data = fetchSeries(j->rrd, j->ds, "MIN");
+        j->max_data = fetchSeries(j->rrd, j->ds, "MAX");
+        j->avg_data = fetchSeries(j->rrd, j->ds, "AVERAGE");
+        rrd_timer.stop();
+        overlayLive(*j);
+      }
+
+      bytes += (j->min_data.size() + j->max_data.size() + j->avg_data.size()) *
+               sizeof(double);
     }
   }
+  timing_.bytes_fetched(bytes);
   data_is_valid = true;
+  data_packed = false;
+  downsampled = 0;
+  data_cached = false;
+  snapshot = QPixmap();
+  rank();
 
   return (true);
 }
 
+/**
+ * top-N: rank the datasources of all subgraphs
+ */
+void Graph::rank() {
+  if (data_packed)
+    unpack();
+  bool reranked = false;
+  for (graph_list::iterator i = begin(); i != end(); ++i)
+    reranked |= i->rank();
+  if (reranked)
+    layout();
+}
+
+/**
+ * series of all consolidation-functions of the datasources fetched in
+ * another thread, they are taken into the series_store when done
+ */
+struct background_fetch {
+  struct item {
+    std::string rrd, ds;
+    const char *cf;
+    std::shared_ptr<series> s;
+    time_t last; // update of the file when fetched
+  };
+  time_t start, end;
+  std::vector<item> items;
+  std::atomic<bool> cancelled{false};
+};
+
+/**
+ * show the data last fetched, kept on disk since the last start
+ *
+ * data the rrd-files hold newer than that is fetched in the background.
+ * Only graphs of plain datasources are kept, aggregates and expressions
+ * are fetched as always.  Returns false if not all data was found.
+ */
+bool Graph::fetchCached() {
+  series_cache &cache = series_cache::instance();
+  if (!cache.enabled())
+    return false;
+  for (const GraphInfo &gi : glist)
+    for (const GraphInfo::datasource &d : gi)
+      if (d.aggregate != agg_none || !d.expr.isEmpty())
+        return false;
+
+  trace_span trace("fetchCached");
+  static const char *const cfs[] = {"MIN", "MAX", "AVERAGE"};
+  std::vector<series> found;
+  bool fresh = true;
+  for (const GraphInfo &gi : glist)
+    for (const GraphInfo::datasource &d : gi)
+      for (const char *cf : cfs) {
+        found.emplace_back();
+        bool f = false;
+        if (!cache.load(d.rrd.toStdString(), d.ds.toStdString(), cf, span,
+                        found.back(), f))
+          return false;
+        // and not moved off the window since
+        fresh &= f && found.back().start <= start &&
+                 start + span <= found.back().end;
+      }
+
+  std::vector<series>::iterator s = found.begin();
+  data_start = s->start;
+  data_end = s->end;
+  step = s->step;
+  for (GraphInfo &gi : glist)
+    for (GraphInfo::datasource &d : gi) {
+      d.min_data.assign(std::move((s++)->data));
+      d.max_data.assign(std::move((s++)->data));
+      d.avg_data.assign(std::move((s++)->data));
+      overlayLive(d);
+    }
+  data_is_valid = true;
+  data_packed = false;
+  downsampled = 0;
+  data_cached = !fresh;
+  rank();
+  if (data_cached)
+    fetchInBackground();
+  return true;
+}
+
+/**
+ * fetch the series of all datasources and members in another thread,
+ * the graph is drawn with them when done
+ */
+void Graph::fetchInBackground() {
+  if (fetcher.joinable())
+    return;
+
+  // in this thread, the client is not shared
+  flushCached();
+
+  std::shared_ptr<background_fetch> job = std::make_shared<background_fetch>();
+  job->start = start;
+  job->end = start + span;
+  static const char *const cfs[] = {"MIN", "MAX", "AVERAGE"};
+  std::vector<GraphInfo::source> sources;
+  for (const GraphInfo &gi : glist)
+    for (const GraphInfo::datasource &d : gi) {
+      if (d.aggregate == agg_none && d.expr.isEmpty())
+        sources.push_back({d.rrd, d.ds, QString()});
+      sources.insert(sources.end(), d.members.begin(), d.members.end());
+    }
+  for (const GraphInfo::source &src : sources)
+    for (const char *cf : cfs)
+      job->items.push_back({src.rrd.toStdString(), src.ds.toStdString(), cf,
+                            std::make_shared<series>(), 0});
+  pending = job;
+  fetcher = std::thread([job, this] {
+    for (background_fetch::item &i : job->items) {
+      if (job->cancelled)
+        return;
+      i.s->start = job->start;
+      i.s->end = job->end;
+      i.s->step = 1;
+      i.last = get_last_update(i.rrd);
+      get_rrd_data(i.rrd, i.ds, &i.s->start, &i.s->end, &i.s->step, i.cf,
+                   &i.s->data);
+    }
+    QCoreApplication::postEvent(this, new QEvent(fetched_event));
+  });
+}
+
+/**
+ * the background fetch is done
+ *
+ * its series are shared through the series_store, so fetching all
+ * data finds them without reading the rrd-files again.  Aggregates and
+ * expressions are computed from them here.
+ */
+void Graph::customEvent(QEvent *event) {
+  if (event->type() == chunk_event) {
+    takeChunks();
+    return;
+  }
+  if (event->type() != fetched_event || !pending) {
+    QFrame::customEvent(event);
+    return;
+  }
+  fetcher.join();
+  std::shared_ptr<background_fetch> job = std::move(pending);
+  pending.reset();
+
+  // fetched as always meanwhile, e.g. because the window was changed
+  if ((data_is_valid && !data_cached) || job->start != start ||
+      job->end != start + span)
+    return;
+
+  series_store &store = series_store::instance();
+  for (const background_fetch::item &i : job->items)
+    store.put(i.rrd, i.ds, i.cf, job->start, job->end, 1, i.s, i.last);
+  // newer than what the disk-cache holds
+  cache_tried = true;
+  data_is_valid = false;
+  fetchAllData();
+  redraw();
+}
+
+/**
+ * series of long windows, fetched in parts by several threads
+ *
+ * the series are in the series_store from the start, filled with NaN.
+ * The parts are fetched newest first and copied into the series in
+ * the gui-thread as they arrive.  Parts begin at multiples of
+ * chunk_rows steps, so the rows a window shares with the window
+ * before are whole parts, taken over instead of fetched again.
+ */
+struct chunked_fetch {
+  typedef std::pair<time_t, time_t> interval;
+
+  struct item {
+    std::string rrd, ds;
+    const char *cf;
+    std::shared_ptr<series> s;
+    std::vector<interval> valid; // rows filled, by their time
+  };
+  struct part {
+    size_t item;
+    size_t first, rows; // of the series
+    time_t end;
+  };
+  struct result {
+    size_t item;
+    size_t first, rows;
+    time_t start;
+    unsigned long step;
+    time_t last; // update of the file when fetched
+    std::vector<double> data;
+  };
+
+  time_t start, end; // window asked for
+  time_t made;       // the rows after it are fetched again
+  std::vector<item> items;
+  std::vector<part> parts;
+  std::atomic<size_t> next{0};
+
+  std::mutex mutex;
+  Graph *graph = 0; // 0 once not wanted any more
+  std::vector<result> done;
+
+  std::vector<std::thread> threads; // joined by the graph
+  std::atomic<size_t> running{0};
+
+  void run();
+  const item *find(const item &i) const;
+  static void reuse(const item &from, item &to, size_t &first, size_t &rows);
+};
+
+/**
+ * fetch parts until none is left, in one of the threads
+ */
+void chunked_fetch::run() {
+  for (size_t k; (k = next++) < parts.size();) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!graph)
+        return;
+    }
+    const part &p = parts[k];
+    const item &i = items[p.item];
+    result r{p.item, p.first, p.rows, i.s->start + time_t(p.first * i.s->step),
+             i.s->step, get_last_update(i.rrd), {}};
+    time_t e = r.start + time_t(p.rows * i.s->step);
+    get_rrd_data(i.rrd, i.ds, &r.start, &e, &r.step, i.cf, &r.data);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!graph)
+      return;
+    done.push_back(std::move(r));
+    QCoreApplication::postEvent(graph, new QEvent(chunk_event));
+  }
+}
+
+/**
+ * the item of the same datasource and step as @a i, 0 if there is none
+ */
+const chunked_fetch::item *chunked_fetch::find(const item &i) const {
+  for (const item &j : items)
+    if (j.rrd == i.rrd && j.ds == i.ds && strcmp(j.cf, i.cf) == 0 &&
+        j.s->step == i.s->step)
+      return &j;
+  return 0;
+}
+
+/**
+ * copy the rows of the part from @a first on, @a rows long, that
+ * @a from holds already into @a to, and shrink the part to the rows
+ * left to fetch
+ *
+ * a part is a whole one or the end of one, so the rows left are in
+ * one piece.  Both series start at a multiple of their step.
+ */
+void chunked_fetch::reuse(const item &from, item &to, size_t &first,
+                          size_t &rows) {
+  const series &a = *from.s;
+  series &b = *to.s;
+  const time_t step = b.step;
+  time_t lo = b.start + time_t(first * step), hi = lo + time_t(rows * step);
+  for (const interval &v : from.valid) {
+    const time_t s = std::max(lo, v.first), e = std::min(hi, v.second);
+    if (s >= e)
+      continue;
+    std::copy(a.data.begin() + (s - a.start) / step,
+              a.data.begin() + (e - a.start) / step,
+              b.data.begin() + (s - b.start) / step);
+    to.valid.push_back({s, e});
+    if (s == lo)
+      lo = e;
+    else if (e == hi)
+      hi = s;
+  }
+  first = (lo - b.start) / step;
+  rows = lo < hi ? (hi - lo) / step : 0;
+}
+
+/**
+ * start fetching the series of the window in parts, if it is long
+ *
+ * a series is long at more than two parts of chunk_rows at the step
+ * rrd_fetch will pick.  The others are fetched as always.  The job is
+ * kept until the window changes or, for a window reaching past the
+ * time it was made, until it is fetched again.  It holds the series.
+ * Rows the job before has fetched already are copied from it.
+ */
+void Graph::fetchChunked() {
+  if (chunks && chunks->start == start && chunks->end == start + span &&
+      chunks->end <= chunks->made)
+    return;
+  const std::shared_ptr<chunked_fetch> before = chunks;
+  cancelChunks();
+
+  static const char *const cfs[] = {"MIN", "MAX", "AVERAGE"};
+  std::vector<GraphInfo::source> sources;
+  for (const GraphInfo &gi : glist)
+    for (const GraphInfo::datasource &d : gi) {
+      if (d.aggregate == agg_none && d.expr.isEmpty())
+        sources.push_back({d.rrd, d.ds, QString()});
+      sources.insert(sources.end(), d.members.begin(), d.members.end());
+    }
+
+  std::shared_ptr<chunked_fetch> job = std::make_shared<chunked_fetch>();
+  job->start = start;
+  job->end = start + span;
+  job->made = time(0);
+  size_t reused = 0;
+  for (const GraphInfo::source &src : sources)
+    for (const char *cf : cfs) {
+      const std::string rrd = src.rrd.toStdString();
+      const unsigned long res = get_resolution(rrd, cf, start);
+      if (!res || time_t(2 * chunk_rows * res) >= span)
+        continue;
+      chunked_fetch::item i{rrd, src.ds.toStdString(), cf,
+                            std::make_shared<series>(), {}};
+      series &s = *i.s;
+      s.start = start - start % res;
+      s.end = start + span + (res - (start + span) % res) % res;
+      s.step = res;
+      const size_t rows = (s.end - s.start) / res;
+      s.data.assign(rows, std::numeric_limits<double>::quiet_NaN());
+      const chunked_fetch::item *from = before ? before->find(i) : 0;
+      for (size_t first = 0, n; first < rows; first += n) {
+        n = std::min(chunk_rows - (s.start / res + first) % chunk_rows,
+                     rows - first);
+        size_t f = first, m = n;
+        if (from)
+          chunked_fetch::reuse(*from, i, f, m);
+        reused += n - m;
+        if (m)
+          job->parts.push_back(
+              {job->items.size(), f, m, s.start + time_t((f + m) * res)});
+      }
+      job->items.push_back(std::move(i));
+    }
+  if (job->items.empty())
+    return;
+  trace_span trace("fetchChunked",
+                   TRACE_DETAIL(std::to_string(job->parts.size()) + " " +
+                                std::to_string(reused)));
+
+  // found by fetchSeries, the newest rows are fetched again by the
+  // next job
+  series_store &store = series_store::instance();
+  for (const chunked_fetch::item &i : job->items)
+    store.put(i.rrd, i.ds, i.cf, start, start + span, 1, i.s, 0);
+
+  // newest first, parts of the same file and window next to each
+  // other, so the threads read them at once
+  const std::vector<chunked_fetch::item> &items = job->items;
+  std::stable_sort(job->parts.begin(), job->parts.end(),
+                   [&items](const chunked_fetch::part &a,
+                            const chunked_fetch::part &b) {
+                     if (a.end != b.end)
+                       return a.end > b.end;
+                     const chunked_fetch::item &i = items[a.item],
+                                               &j = items[b.item];
+                     if (i.rrd != j.rrd)
+                       return i.rrd < j.rrd;
+                     return strcmp(i.cf, j.cf) < 0;
+                   });
+  job->graph = this;
+  chunks = job;
+  if (job->parts.empty())
+    return;
+  const unsigned cores = std::thread::hardware_concurrency();
+  const size_t threads =
+      std::min<size_t>(job->parts.size(), std::max(2u, std::min(4u, cores)));
+  chunked_fetch *j = job.get();
+  j->running = threads;
+  for (size_t k = 0; k < threads; ++k)
+    j->threads.emplace_back([j] {
+      j->run();
+      --j->running;
+    });
+}
+
+/**
+ * copy the parts fetched into their series and draw them
+ *
+ * rows after the last update of the file when fetched are not filled
+ * yet, they are fetched again by the next window.
+ */
+void Graph::takeChunks() {
+  if (!chunks)
+    return;
+  std::vector<chunked_fetch::result> done;
+  {
+    std::lock_guard<std::mutex> lock(chunks->mutex);
+    done.swap(chunks->done);
+  }
+  if (done.empty())
+    return;
+  trace_span trace("takeChunks");
+
+  for (const chunked_fetch::result &r : done) {
+    chunked_fetch::item &i = chunks->items[r.item];
+    series &s = *i.s;
+    const time_t lo = s.start + time_t(r.first * s.step);
+    const time_t hi = std::min(lo + time_t(r.rows * s.step),
+                               r.last - r.last % time_t(s.step));
+    if (lo < hi)
+      i.valid.push_back({lo, hi});
+    if (r.start == lo && r.step == s.step) {
+      std::copy_n(r.data.begin(), std::min(r.rows, r.data.size()),
+                  s.data.begin() + r.first);
+      continue;
+    }
+    // another archive, mapped onto the rows of the series
+    for (size_t k = 0; k < r.rows && r.step; ++k) {
+      const time_t when = s.start + time_t((r.first + k + 1) * s.step);
+      if (when <= r.start)
+        continue;
+      const size_t n = (when - r.start - 1) / r.step;
+      if (n < r.data.size())
+        s.data[r.first + k] = r.data[n];
+    }
+  }
+
+  if (data_is_valid && !downsampled)
+    rebuildChunked();
+  else
+    data_is_valid = false;
+  redraw();
+}
+
+/**
+ * take the parts arrived into the data drawn
+ *
+ * the series of plain datasources are the ones of the job, the live
+ * samples are laid over them again.  Aggregates and expressions are
+ * made from their members again, found in the series_store, and the
+ * datasources are ranked again.  The rrd-files are not flushed or
+ * read again.
+ */
+void Graph::rebuildChunked() {
+  trace_span trace("rebuildChunked");
+  stage_timer rrd_timer(timing_, frame_timing::rrd_fetch, false);
+  if (data_packed)
+    unpack();
+
+  static const char *const cfs[] = {"MIN", "MAX", "AVERAGE"};
+  for (GraphInfo &gi : glist)
+    for (GraphInfo::datasource &d : gi) {
+      if (d.aggregate != agg_none) {
+        fetchAggregate(d, rrd_timer);
+        continue;
+      }
+      if (!d.expr.isEmpty()) {
+        fetchDerived(d, rrd_timer);
+        continue;
+      }
+      const std::string rrd = d.rrd.toStdString(), ds = d.ds.toStdString();
+      series_handle *const data[] = {&d.min_data, &d.max_data, &d.avg_data};
+      for (int k = 0; k < 3; ++k)
+        for (const chunked_fetch::item &i : chunks->items)
+          if (i.rrd == rrd && i.ds == ds && strcmp(i.cf, cfs[k]) == 0) {
+            *data[k] = i.s;
+            data_start = i.s->start;
+            data_end = i.s->end;
+            step = i.s->step;
+            overlayLive(d, k);
+          }
+    }
+  rank();
+}
+
+/**
+ * stop fetching parts, the threads end after the part they fetch
+ *
+ * the jobs stopped are kept until their threads have ended, those
+ * are joined here and on destruction.
+ */
+void Graph::cancelChunks() {
+  if (chunks) {
+    {
+      std::lock_guard<std::mutex> lock(chunks->mutex);
+      chunks->graph = 0;
+    }
+    stopped_chunks.push_back(std::move(chunks));
+    chunks.reset();
+  }
+  for (size_t k = 0; k < stopped_chunks.size();) {
+    if (stopped_chunks[k]->running) {
+      ++k;
+      continue;
+    }
+    for (std::thread &t : stopped_chunks[k]->threads)
+      t.join();
+    stopped_chunks.erase(stopped_chunks.begin() + k);
+  }
+}
+
+/**
+ * keep the data of all plain datasources in the disk-cache
+ */
+void Graph::remember() {
+  series_cache &cache = series_cache::instance();
+  // downsampled data does not have the step of the rrd-files any more
+  if (!cache.enabled() || !data_is_valid || data_cached || downsampled)
+    return;
+  trace_span trace("remember");
+  if (data_packed)
+    unpack();
+  for (const GraphInfo &gi : glist)
+    for (const GraphInfo::datasource &d : gi) {
+      if (d.aggregate != agg_none || !d.expr.isEmpty())
+        continue;
+      const std::string rrd = d.rrd.toStdString(), ds = d.ds.toStdString();
+      cache.store(rrd, ds, "MIN", span, data_start, data_end, step, d.min_data,
+                  fetched_at);
+      cache.store(rrd, ds, "MAX", span, data_start, data_end, step, d.max_data,
+                  fetched_at);
+      cache.store(rrd, ds, "AVERAGE", span, data_start, data_end, step,
+                  d.avg_data, fetched_at);
+    }
+}
+
+/**
+ * have rrdcached write the updates of all rrd-files shown it still
+ * holds
+ */
+void Graph::flushCached() {
+  rrdcached_client &rrdcached = rrdcached_client::instance();
+  if (!rrdcached.enabled())
+    return;
+
+  std::vector<std::string> files;
+  for (const GraphInfo &gi : glist)
+    for (const GraphInfo::datasource &d : gi) {
+      if (!d.rrd.isEmpty())
+        files.push_back(d.rrd.toStdString());
+      for (const GraphInfo::source &m : d.members)
+        files.push_back(m.rrd.toStdString());
+    }
+  std::sort(files.begin(), files.end());
+  files.erase(std::unique(files.begin(), files.end()), files.end());
+  rrdcached.flush(files, start + span);
+}
+
+/**
+ * complete the data of @a d by the samples received from collectd
+ * the rrd-file has not got yet
+ *
+ * the columns without rrd-data are remembered, so updateLive can lay
+ * newer samples over them without fetching again.
+ */
+void Graph::overlayLive(GraphInfo::datasource &d) {
+  for (int k = 0; k < 3; ++k)
+    overlayLive(d, k);
+}
+
+/**
+ * the same for one consolidation-function, 0 MIN, 1 MAX, 2 AVERAGE
+ */
+void Graph::overlayLive(GraphInfo::datasource &d, int k) {
+  static const char *const cfs[] = {"MIN", "MAX", "AVERAGE"};
+  series_handle *const data[] = {&d.min_data, &d.max_data, &d.avg_data};
+  const std::vector<double> &in = *data[k];
+  size_t n = 0;
+  while (n < in.size() && std::isnan(in[in.size() - 1 - n]))
+    ++n;
+  d.live_columns[k] = n;
+
+  live_store &live = live_store::instance();
+  if (live.empty())
+    return;
+  const live_series *s = live.find(d.rrd.toStdString(), d.ds.toStdString());
+  std::vector<double> out;
+  if (s && s->overlay(data_start, step, in, cfs[k], out))
+    data[k]->assign(std::move(out));
+}
+
+/**
+ * lay the samples received since the last fetch over the columns the
+ * rrd-files had no data for
+ *
+ * live samples arrive every second, the rrd-files are only read again
+ * at the normal interval.  Returns false if nothing changed.
+ */
+bool Graph::updateLive() {
+  live_store &live = live_store::instance();
+  if (!data_is_valid || downsampled || live.empty())
+    return false;
+  if (data_packed)
+    unpack();
+
+  static const char *const cfs[] = {"MIN", "MAX", "AVERAGE"};
+  bool changed = false;
+  std::vector<double> in, out;
+  for (GraphInfo &gi : glist)
+    for (GraphInfo::datasource &d : gi) {
+      if (d.aggregate != agg_none || !d.expr.isEmpty())
+        continue;
+      const live_series *s =
+          live.find(d.rrd.toStdString(), d.ds.toStdString());
+      if (!s)
+        continue;
+      series_handle *const data[] = {&d.min_data, &d.max_data, &d.avg_data};
+      for (int k = 0; k < 3; ++k) {
+        const size_t n = d.live_columns[k];
+        if (!n || n > data[k]->size())
+          continue;
+        in = *data[k];
+        std::fill(in.end() - n, in.end(),
+                  std::numeric_limits<double>::quiet_NaN());
+        if (s->overlay(data_start, step, in, cfs[k], out)) {
+          data[k]->assign(std::move(out));
+          changed = true;
+        }
+      }
+    }
+  return changed;
+}
+
+/**
+ * fetch the series of all datasources at once, held by @a held until
+ * fetchSeries takes them
+ *
+ * the series of one file are read together and the files in order.
+ */
+void Graph::fetchBatch(std::vector<series_ptr> &held) {
+  static const char *const cfs[] = {"MIN", "MAX", "AVERAGE"};
+  std::vector<series_request> requests;
+  for (const GraphInfo &gi : glist)
+    for (const GraphInfo::datasource &d : gi) {
+      if (d.aggregate == agg_none && d.expr.isEmpty()) {
+        for (const char *cf : cfs)
+          requests.push_back({d.rrd.toStdString(), d.ds.toStdString(), cf});
+        continue;
+      }
+      if (!d.expr.isEmpty() && d.program.empty())
+        continue;
+      for (const GraphInfo::source &m : d.members) {
+        if (d.aggregate == agg_percentile) {
+          requests.push_back(
+              {m.rrd.toStdString(), m.ds.toStdString(), "AVERAGE"});
+          continue;
+        }
+        for (const char *cf : cfs)
+          requests.push_back({m.rrd.toStdString(), m.ds.toStdString(), cf});
+      }
+    }
+  trace_span trace("fetchBatch", TRACE_DETAIL(std::to_string(requests.size())));
+  series_store::instance().fetch(requests, start, start + span, 1, held);
+}
+
+/**
+ * fetch one consolidation-function of a datasource
+ *
+ * data_start, data_end and step are set to the values get_rrd_data returns.
+ * The series is shared with all other graphs showing it.
+ */
+series_ptr Graph::fetchSeries(const QString &rrd, const QString &ds,
+                              const char *cf) {
+  series_ptr s = series_store::instance().fetch(
+      rrd.toStdString(), ds.toStdString(), cf, start, start + span, 1);
+  data_start = s->start;
+  data_end = s->end;
+  step = s->step;
+  return s;
+}
+
+/**
+ * fetch all members of an aggregate and fold them into one series
+ *
+ * the members are mapped by time onto the buckets of the first member
+ * and consolidated by their consolidation-function where they are
+ * finer, so data_start, data_end and step are the ones of the first
+ * member.
+ */
+void Graph::fetchAggregate(GraphInfo::datasource &d, stage_timer &rrd_timer) {
+  trace_span trace("aggregate",
+                   TRACE_DETAIL(d.node.toStdString() + " " +
+                                aggregate_name(d.aggregate) + " " +
+                                std::to_string(d.members.size())));
+  series_ptr buffer;
+  std::vector<double> result;
+  time_t first_start = start, first_end = start + span;
+  unsigned long first_step = 1;
+
+  if (d.aggregate == agg_percentile) {
+    // a band over the averages of all members
+    series_aggregator band(agg_percentile);
+    for (const GraphInfo::source &m : d.members) {
+      rrd_timer.start();
+      buffer = fetchSeries(m.rrd, m.ds, "AVERAGE");
+      rrd_timer.stop();
+      if (!band.count()) {
+        first_start = data_start;
+        first_end = data_end;
+        first_step = step;
+      }
+      band.add(buffer->data, buffer->start, buffer->step, agg_mean);
+    }
+    band.percentile(50.0, result);
+    d.avg_data.assign(std::move(result));
+    band.percentile(d.percentile, result);
+    d.min_data.assign(std::move(result));
+    band.percentile(100.0 - d.percentile, result);
+    d.max_data.assign(std::move(result));
+  } else {
+    series_aggregator avg(d.aggregate), min(d.aggregate), max(d.aggregate);
+    for (const GraphInfo::source &m : d.members) {
+      rrd_timer.start();
+      buffer = fetchSeries(m.rrd, m.ds, "MIN");
+      rrd_timer.stop();
+      if (!min.count()) {
+        first_start = data_start;
+        first_end = data_end;
+        first_step = step;
+      }
+      min.add(buffer->data, buffer->start, buffer->step, agg_min);
+
+      rrd_timer.start();
+      buffer = fetchSeries(m.rrd, m.ds, "MAX");
+      rrd_timer.stop();
+      max.add(buffer->data, buffer->start, buffer->step, agg_max);
+
+      rrd_timer.start();
+      buffer = fetchSeries(m.rrd, m.ds, "AVERAGE");
+      rrd_timer.stop();
+      avg.add(buffer->data, buffer->start, buffer->step, agg_mean);
+    }
+    min.result(result);
+    d.min_data.assign(std::move(result));
+    max.result(result);
+    d.max_data.assign(std::move(result));
+    avg.result(result);
+    d.avg_data.assign(std::move(result));
+  }
+
+  data_start = first_start;
+  data_end = first_end;
+  step = first_step;
+}
+
+/**
+ * fetch all members of an expression and evaluate it, separately for
+ * MIN, MAX and AVERAGE
+ *
+ * the members are mapped by time onto the buckets of the first member.
+ * Only the columns whose inputs changed since the last fetch are
+ * evaluated again.
+ */
+void Graph::fetchDerived(GraphInfo::datasource &d, stage_timer &rrd_timer) {
+  trace_span trace("expression", TRACE_DETAIL(d.expr.toStdString()));
+  static const char *const cfs[] = {"MIN", "MAX", "AVERAGE"};
+  static const aggregate_op consolidate[] = {agg_min, agg_max, agg_mean};
+  expression_cache *const caches[] = {&d.min_cache, &d.max_cache,
+                                      &d.avg_cache};
+  series_handle *const results[] = {&d.min_data, &d.max_data, &d.avg_data};
+
+  std::vector<std::vector<double>> in(d.members.size());
+  std::vector<double> result;
+  time_t first_start = start, first_end = start + span;
+  unsigned long first_step = 1;
+
+  for (int cf = 0; cf < 3; ++cf) {
+    results[cf]->reset();
+    if (d.program.empty() || d.members.empty())
+      continue;
+
+    for (size_t k = 0; k < d.members.size(); ++k) {
+      rrd_timer.start();
+      const series_ptr buffer =
+          fetchSeries(d.members[k].rrd, d.members[k].ds, cfs[cf]);
+      rrd_timer.stop();
+      if (k == 0) {
+        first_start = data_start;
+        first_end = data_end;
+        first_step = step;
+        in[k] = buffer->data;
+      } else if (buffer->data.size() != in.front().size() ||
+                 buffer->start != first_start || buffer->step != first_step) {
+        align_series(buffer->data, buffer->start, buffer->step,
+                     consolidate[cf], first_start, first_step,
+                     in.front().size(), in[k]);
+      } else {
+        in[k] = buffer->data;
+      }
+    }
+    caches[cf]->evaluate(d.program, in, first_start, first_step, result);
+    results[cf]->assign(std::move(result));
+  }
+
+  data_start = first_start;
+  data_end = first_end;
+  step = first_step;
+}
+
+/**
+ * ask for an expression over the datasources of @a gi and add it
+ */
+void Graph::addExpression(GraphInfo &gi) {
+  GraphInfo::datasource d;
+  QString help = i18n("Expression over the datasources:") + "\n";
+  for (GraphInfo::const_iterator i = gi.begin(); i != gi.end(); ++i) {
+    if (i->aggregate != agg_none || !i->expr.isEmpty())
+      continue;
+    const size_t n = d.members.size();
+    const QString name = n < 26 ? QString(QChar('a' + int(n)))
+                                : QString("v%1").arg(n + 1);
+    d.members.push_back({i->rrd, i->ds, name});
+    help += QString("\n%1 = %2").arg(name, i->label);
+  }
+  help += "\n\n" + i18n("e.g. a*8, a+b, a/(a+b), rate(a), ifnan(a, 0)");
+
+  QString text;
+  QString message = help;
+  for (;;) {
+    bool ok;
+    text = QInputDialog::getText(this, i18n("Add Expression"), message,
+                                 QLineEdit::Normal, text, &ok);
+    if (!ok || text.trimmed().isEmpty())
+      return;
+    d.expr = text.trimmed();
+    try {
+      GraphInfo::compile(d);
+      break;
+    } catch (const expression_error &e) {
+      message = help + "\n\n" +
+                i18n("Error at position %1: %2", int(e.position) + 1,
+                     QString::fromUtf8(e.what()));
+    }
+  }
+
+  d.label = d.expr;
+  gi.add(d);
+  changed(true);
+  data_is_valid = false;
+  layout();
+  redraw();
+}
+
 /**
  *
  */
@@ -148,42 +1048,138 @@ void Graph::clear() {
   glist.clear();
   data_is_valid = false;
   layout();
-  update();
+  redraw();
+}
+
+/**
+ * fetch the data in another thread without drawing, so showing the
+ * graph later is fast
+ */
+void Graph::warm() {
+  if (data_is_valid || empty())
+    return;
+  trace_span trace("warm");
+  fetchInBackground();
+}
+
+/**
+ * bytes of fetched data held by all subgraphs
+ */
+size_t Graph::memory() const {
+  size_t bytes = 0;
+  for (const GraphInfo &gi : glist)
+    bytes += gi.memory();
+  return bytes;
+}
+
+/**
+ * keep the data at the resolution it is drawn with
+ *
+ * for graphs not shown, they look the same until zoomed.  It is fetched
+ * again when the graph is shown or gets wider.
+ */
+void Graph::downsample() {
+  // not laid out yet
+  if (!data_is_valid || graph_rect.width() <= 0)
+    return;
+  for (GraphInfo &gi : glist)
+    gi.downsample(graph_rect.width());
+  downsampled = graph_rect.width();
+}
+
+/**
+ * fetch downsampled data again at the step of the rrd-files
+ *
+ * called when the graph is shown, data_start, step and the columns of
+ * live samples are those of the rrd-files, not of the reduced series.
+ */
+void Graph::fullResolution() {
+  if (!downsampled)
+    return;
+  data_is_valid = false;
+  downsampled = 0;
+  redraw();
+}
+
+/**
+ * keep the data compressed, it is decoded blockwise while drawing
+ */
+void Graph::pack() {
+  if (!data_is_valid || data_packed)
+    return;
+  trace_span trace("pack");
+  for (GraphInfo &gi : glist)
+    gi.pack();
+  data_packed = true;
+}
+
+void Graph::unpack() {
+  trace_span trace("unpack");
+  for (GraphInfo &gi : glist)
+    gi.unpack();
+  data_packed = false;
+}
+
+/**
+ * free the fetched data, it is fetched again when needed
+ */
+void Graph::release() {
+  cancelChunks();
+  for (GraphInfo &gi : glist)
+    gi.release();
+  data_is_valid = false;
+  downsampled = 0;
+}
+
+/**
+ * fetch the data again after datasources were changed from outside
+ */
+void Graph::reload() {
+  data_is_valid = false;
+  layout();
+  redraw();
 }
 
-int Graph::calcLegendHeights(int box_size, int width) {
+/**
+ * determine the lines of all legends
+ *
+ * a legend that would need more than @a max_lines is cut to
+ * @a max_lines, unless the user expanded it.
+ */
+int Graph::calcLegendHeights(int box_size, int width, int max_lines) {
   const QFontMetrics &fontmetric = fontMetrics();
+  const int gap = 4 * marg;
 
   int total_legend_height = 0;
+  std::vector<int> label_width;
   for (graph_list::iterator i = begin(); i != end(); ++i) {
 
     if (i->empty()) {
       i->legend_lines(0);
+      i->legend_shown(0);
       continue;
     }
 
-    std::vector<int> label_width;
-    for (GraphInfo::const_iterator gi = i->begin(); gi != i->end(); ++gi)
-      label_width.push_back(fontmetric.horizontalAdvance(gi->label) + box_size + marg);
+    label_width.clear();
+    for (size_t k = 0; k < i->visible_size(); ++k) {
+      GraphInfo::datasource &d = i->visible(k);
+      if (d.label_width < 0)
+        d.label_width = fontmetric.horizontalAdvance(d.label);
+      label_width.push_back(d.label_width + box_size + marg);
+    }
 
     const int n = label_width.size();
-    int r;
-    for (r = 1; r < n; ++r) {
-      const int col = (n + r - 1) / r;
-      int total_width = 0, i = 0;
-      for (int j = 0; j < col; ++j) {
-        int max = 0;
-        for (int k = 0; k < r && i < n; ++i, ++k) {
-          if (max < label_width[i])
-            max = label_width[i];
-        }
-        total_width += max;
-      }
-      total_width += 4 * marg * (col - 1);
-      if (total_width <= width)
-        break;
+    int r = legend_rows(label_width, gap, width);
+    int shown = n;
+    if (r > max_lines && !i->legend_expanded()) {
+      // leave room for the "more"-hint
+      const QString more = i18n("(%1 more)", n);
+      r = max_lines;
+      shown = legend_shown(label_width, r, gap,
+                           width - gap - fontmetric.horizontalAdvance(more));
     }
     i->legend_lines(r);
+    i->legend_shown(shown);
     total_legend_height += r * fontmetric.lineSpacing();
   }
   return total_legend_height;
@@ -192,17 +1188,20 @@ int Graph::calcLegendHeights(int box_size, int width) {
 void Graph::drawLegend(QPainter &paint, int left, int y, int box_size,
                        const GraphInfo &ginfo) {
   const QFontMetrics &fontmetric = fontMetrics();
+  trace_span trace("drawLegend");
 
   int n = 0, cy = y, cx = left, max_width = 0;
   int lines = ginfo.legend_lines();
+  const int shown = ginfo.legend_shown();
   if (lines) {
-    for (GraphInfo::const_iterator i = ginfo.begin(); i != ginfo.end(); ++i) {
+    while (n < shown) {
+      const GraphInfo::datasource &d = ginfo.visible(n);
       paint.drawRect(cx, cy - box_size, box_size - 1, box_size - 1);
       paint.fillRect(cx + 1, cy - box_size + 1, box_size - 2, box_size - 2,
                      color_line[n % 8]);
-      paint.drawText(cx + box_size + marg, cy, i->label);
+      paint.drawText(cx + box_size + marg, cy, d.label);
 
-      int w = box_size + marg + fontmetric.horizontalAdvance(i->label);
+      int w = box_size + marg + d.label_width;
       if (w > max_width)
         max_width = w;
       cy += fontmetric.lineSpacing();
@@ -213,7 +1212,34 @@ void Graph::drawLegend(QPainter &paint, int left, int y, int box_size,
         cy = y;
       }
     }
+    if (shown < int(ginfo.visible_size())) {
+      if (cy != y)
+        cx += max_width + 4 * marg;
+      paint.save();
+      paint.setPen(color_major);
+      paint.drawText(cx, y,
+                     i18n("(%1 more)", int(ginfo.visible_size()) - shown));
+      paint.restore();
+    }
+  }
+}
+
+/**
+ * toggle between the whole and the cut legend of the subgraph at @a pos
+ */
+bool Graph::toggleLegend(const QPoint &pos) {
+  for (graph_list::iterator i = begin(); i != end(); ++i) {
+    if (i->legend_top() <= pos.y() && pos.y() < i->legend_bottom()) {
+      if (!i->legend_expanded() &&
+          i->legend_shown() == int(i->visible_size()))
+        return false;
+      i->legend_expanded(!i->legend_expanded());
+      layout();
+      redraw();
+      return true;
+    }
   }
+  return false;
 }
 
 void Graph::drawHeader(QPainter &paint) {
@@ -272,62 +1298,87 @@ void Graph::drawFooter(QPainter &paint, int left, int right) {
   paint.restore();
 }
 
-void Graph::drawXLines(QPainter &paint, const QRect &rect, time_iterator i,
-                       QColor color) {
-  if (!i.valid())
+void Graph::drawXLines(QPainter &paint, const QRect &rect,
+                       const time_ticks &ticks, QColor color) {
+  if (!ticks.valid())
     return;
+  trace_span trace("drawXLines");
 
   // setting up linear mappings
   const linMap xmap(data_start, rect.left(), data_end, rect.right());
 
   // if lines are to close draw nothing
-  if (i.interval() * xmap.m() < 3)
+  if (ticks.interval() * xmap.m() < 3)
     return;
 
   // draw lines
   paint.save();
   paint.setPen(color);
-  for (; *i <= data_end; ++i) {
-    int x = xmap(*i);
+  for (time_ticks::const_iterator i = ticks.begin(); i != ticks.end(); ++i) {
+    if (i->time < data_start)
+      continue;
+    int x = xmap(i->time);
     paint.drawLine(x, rect.top(), x, rect.bottom());
   }
   paint.restore();
 }
 
 void Graph::drawXLabel(QPainter &paint, int y, int left, int right,
-                       time_iterator i, QString format, bool center) {
-  if (!i.valid())
+                       const time_ticks &ticks, const char *format,
+                       bool center) {
+  if (!ticks.valid())
     return;
+  trace_span trace("drawXLabel");
+  stage_timer timer(timing_, frame_timing::labels);
   paint.save();
   paint.setFont(small_font);
 
   // setting up linear mappings
   const linMap xmap(data_start, left, data_end, right);
 
-  // draw labels
-  if (center)
-    --i;
-  for (; *i <= data_end; ++i) {
-    // special handling for localtime/mktime on DST
-    time_t t = center ? *i + i.interval() / 2 : *i;
-    tm tm;
-    localtime_r(&t, &tm);
-    QString label = Qstrftime(i18n(format.toLatin1()).toLatin1(), &tm);
-    if (!label.isNull()) {
-      const int width = paint.fontMetrics().horizontalAdvance(label);
-      int x = center ? xmap(*i + i.interval() / 2) - width / 2
-                     : xmap(*i) - width / 2;
-
-      if (x > left && x + width < right)
-        paint.drawText(x, y, label);
+  // draw labels, centered ones between two ticks
+  for (time_ticks::const_iterator i = ticks.begin(); i != ticks.end(); ++i) {
+    const label_cache::entry &label = xlabels.time(i->time, i->tm, format);
+    if (!label.text.isNull()) {
+      int x = xmap(center ? ticks.center(i) : i->time) - label.width / 2;
+
+      if (x > left && x + label.width < right)
+        paint.drawText(x, y, label.text);
     }
   }
   paint.restore();
 }
 
-void Graph::findXGrid(int width, QString &format, bool &center,
-                      time_iterator &minor_x, time_iterator &major_x,
-                      time_iterator &label_x) {
+/**
+ * choose the time-axis and generate its ticks, if the window or the
+ * width changed. The ticks are shared by all subgraphs.
+ */
+void Graph::updateXAxis() {
+  if (axis_start == data_start && axis_end == data_end &&
+      axis_width == graph_rect.width())
+    return;
+
+  trace_span trace("findXGrid");
+  stage_timer timer(timing_, frame_timing::xgrid);
+
+  findXGrid(graph_rect.width(), format_x, center_x, minor_x, major_x,
+            label_x);
+
+  // centered labels start one interval early for the partial one
+  const time_t from = center_x ? data_start - label_x.interval() : data_start;
+  tz.set(from, data_end);
+  minor_x.generate(tz, data_start, data_end);
+  major_x.generate(tz, data_start, data_end);
+  label_x.generate(tz, from, data_end);
+
+  axis_start = data_start;
+  axis_end = data_end;
+  axis_width = graph_rect.width();
+}
+
+void Graph::findXGrid(int width, const char *&format, bool &center,
+                      time_ticks &minor_x, time_ticks &major_x,
+                      time_ticks &label_x) {
   const time_t min = 60;
   const time_t hour = 3600;
   const time_t day = 24 * hour;
@@ -364,36 +1415,34 @@ void Graph::findXGrid(int width, QString &format, bool &center,
       {0, 0, 0, 0, true, align_tzalign},
   };
 
-  const QFontMetrics fontmetric(font);
   const time_t time_span = data_end - data_start;
-  const time_t now = time(0);
 
   for (int i = 0; axis_params[i].maxspan; ++i) {
     if (time_span < axis_params[i].maxspan) {
-      QString label = Qstrftime(axis_params[i].format, localtime(&now));
-      if (!label.isNull()) {
+      const label_cache::entry &label = ylabels.sample(axis_params[i].format);
+      if (!label.text.isNull()) {
         const int textwidth =
-            fontmetric.horizontalAdvance(label) * time_span / axis_params[i].major * 3 / 2;
+            label.width * time_span / axis_params[i].major * 3 / 2;
         if (textwidth < width) {
           switch (axis_params[i].align) {
           case align_tzalign:
-            minor_x.set(data_start, axis_params[i].minor);
-            major_x.set(data_start, axis_params[i].major);
-            label_x.set(data_start, axis_params[i].major);
+            minor_x.set(axis_params[i].minor);
+            major_x.set(axis_params[i].major);
+            label_x.set(axis_params[i].major);
             format = axis_params[i].format;
             center = axis_params[i].center;
             break;
           case align_week:
-            minor_x.set(data_start, day);
-            major_x.set(data_start, 1, time_iterator::weeks);
-            label_x.set(data_start, 1, time_iterator::weeks);
+            minor_x.set(day);
+            major_x.set(1, time_ticks::weeks);
+            label_x.set(1, time_ticks::weeks);
             format = axis_params[i].format;
             center = axis_params[i].center;
             break;
           case align_month:
-            minor_x.set(data_start, axis_params[i].minor);
-            major_x.set(data_start, 1, time_iterator::month);
-            label_x.set(data_start, 1, time_iterator::month);
+            minor_x.set(axis_params[i].minor);
+            major_x.set(1, time_ticks::month);
+            label_x.set(1, time_ticks::month);
             format = axis_params[i].format;
             center = axis_params[i].center;
             break;
@@ -403,22 +1452,23 @@ void Graph::findXGrid(int width, QString &format, bool &center,
       }
     }
   }
-  QString label = Qstrftime("%Y", localtime(&now));
-  if (!label.isNull()) {
-    const int textwidth = fontmetric.horizontalAdvance(label) * 3 / 2;
+  const char *const year_format = "%Y";
+  const label_cache::entry &label = ylabels.sample(year_format);
+  if (!label.text.isNull()) {
+    const int textwidth = label.width * 3 / 2;
     // fixed-point calculation with 16 bit fraction.
     int num = (time_span * textwidth * 16) / (year * width);
     if (num < 16) {
-      minor_x.set(data_start, 1, time_iterator::month);
-      major_x.set(data_start, 1, time_iterator::years);
-      label_x.set(data_start, 1, time_iterator::years);
-      format = "%Y";
+      minor_x.set(1, time_ticks::month);
+      major_x.set(1, time_ticks::years);
+      label_x.set(1, time_ticks::years);
+      format = year_format;
       center = true;
     } else {
-      minor_x.set(data_start, 1, time_iterator::years);
-      major_x.set(data_start, (num + 15) / 16, time_iterator::years);
-      label_x.set(data_start, (num + 15) / 16, time_iterator::years);
-      format = "%Y";
+      minor_x.set(1, time_ticks::years);
+      major_x.set((num + 15) / 16, time_ticks::years);
+      label_x.set((num + 15) / 16, time_ticks::years);
+      format = year_format;
       center = false;
     }
   }
@@ -426,15 +1476,17 @@ void Graph::findXGrid(int width, QString &format, bool &center,
 
 void Graph::drawYLabel(QPainter &paint, const QRect &rect, const Range &y_range,
                        double base) {
+  trace_span trace("drawYLabel");
+  stage_timer timer(timing_, frame_timing::labels);
+
   // setting up linear mappings
   const linMap ymap(y_range.min(), rect.bottom(), y_range.max(), rect.top());
 
   const QFontMetrics fontmetric(font);
 
   // SI Unit for nice display
-  std::string SI;
   double mag;
-  si_char(y_range.max(), SI, mag);
+  const char *SI = si_prefix(y_range.max(), mag);
 
   // make sure labels don not overlap
   const int fontheight = fontmetric.height();
@@ -456,14 +1508,16 @@ void Graph::drawYLabel(QPainter &paint, const QRect &rect, const Range &y_range,
   double min = ceil(y_range.min() / base) * base;
   double max = floor(y_range.max() / base) * base;
   for (double i = min; i <= max; i += base) {
-    const std::string label = si_number(i, 6, SI, mag);
-    const int x = rect.left() - fontmetric.horizontalAdvance(label.c_str()) - 4;
-    paint.drawText(x, ymap(i) + fontmetric.ascent() / 2, label.c_str());
+    const label_cache::entry &label = ylabels.number(i, 6, SI, mag);
+    const int x = rect.left() - label.width - 4;
+    paint.drawText(x, ymap(i) + fontmetric.ascent() / 2, label.text);
   }
 }
 
 void Graph::drawYLines(QPainter &paint, const QRect &rect, const Range &y_range,
                        double base, QColor color) {
+  trace_span trace("drawYLines");
+
   // setting up linear mappings
   const linMap ymap(y_range.min(), rect.bottom(), y_range.max(), rect.top());
 
@@ -500,19 +1554,24 @@ void Graph::drawGraph(QPainter &paint, const QRect &rect,
   const linMap ymap(min, rect.bottom(), max, rect.top());
   // define once use many
   QPolygon points;
+  size_t points_drawn = 0;
+
+  trace_span trace("drawGraph");
+  stage_timer polygon_timer(timing_, frame_timing::polygons, false);
+  stage_timer painter_timer(timing_, frame_timing::painter, false);
 
   paint.save();
   // paint.setRenderHint(QPainter::Antialiasing);
 
   // draw all min/max backshadows
   int color_nr = 0;
-  for (GraphInfo::const_iterator gi = ginfo.begin(); gi != ginfo.end(); ++gi) {
-    const std::vector<double> &min_data = gi->min_data;
-    const std::vector<double> &max_data = gi->max_data;
+  for (size_t k = 0; k < ginfo.visible_size(); ++k) {
+    series_reader min_data(ginfo.visible(k).min_data);
+    series_reader max_data(ginfo.visible(k).max_data);
 
     if (min_data.empty() || max_data.empty())
       continue;
-    const int size = gi->min_data.size();
+    const int size = min_data.size();
 
     // setting up linear mappings
     const linMap xmap(0, rect.left(), size - 1, rect.right());
@@ -527,6 +1586,7 @@ void Graph::drawGraph(QPainter &paint, const QRect &rect,
         while (i < size && !std::isnan(min_data[i]) && !std::isnan(max_data[i]))
           ++i;
         const int asize = i - l;
+        polygon_timer.start();
         points.resize(asize * 2);
         int k;
         for (k = 0; k < asize; ++k, ++l) {
@@ -536,15 +1596,19 @@ void Graph::drawGraph(QPainter &paint, const QRect &rect,
         for (; k < 2 * asize; ++k, --l) {
           points.setPoint(k, xmap(l), ymap(max_data[l]));
         }
+        polygon_timer.stop();
+        painter_timer.start();
         paint.drawPolygon(points);
+        painter_timer.stop();
+        points_drawn += points.size();
       }
     }
   }
 
   // draw all averages
   color_nr = 0;
-  for (GraphInfo::const_iterator gi = ginfo.begin(); gi != ginfo.end(); ++gi) {
-    const std::vector<double> &avg_data = gi->avg_data;
+  for (size_t k = 0; k < ginfo.visible_size(); ++k) {
+    series_reader avg_data(ginfo.visible(k).avg_data);
 
     if (avg_data.empty())
       continue;
@@ -563,15 +1627,66 @@ void Graph::drawGraph(QPainter &paint, const QRect &rect,
         while (i < size && !std::isnan(avg_data[i]))
           ++i;
         const int asize = i - l;
+        polygon_timer.start();
         points.resize(asize);
         for (int k = 0; k < asize; ++k, ++l) {
           points.setPoint(k, xmap(l), ymap(avg_data[l]));
         }
+        polygon_timer.stop();
+        painter_timer.start();
         paint.drawPolyline(points);
+        painter_timer.stop();
+        points_drawn += points.size();
       }
     }
   }
   paint.restore();
+  timing_.points_drawn(timing_.points_drawn() + points_drawn);
+}
+
+/**
+ * draw the timing-overlay in the upper right corner
+ */
+void Graph::drawTiming(QPainter &paint) {
+  paint.save();
+
+  QStringList lines;
+  lines << QStringLiteral("stage        last     avg     p99  [ms]");
+  for (int s = 0; s < frame_timing::num_stages; ++s) {
+    const stage_stats &st = timing_[frame_timing::stage(s)];
+    lines << QString::asprintf("%-9s %7.2f %7.2f %7.2f",
+                               frame_timing::name(frame_timing::stage(s)),
+                               st.last(), st.average(), st.p99());
+  }
+  lines << QString::asprintf("fetched %.1f KiB, %lu points",
+                             timing_.bytes_fetched() / 1024.0,
+                             (unsigned long)timing_.points_drawn());
+
+  paint.setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  const QFontMetrics fixedmetric = paint.fontMetrics();
+  int width = 0;
+  for (const QString &line : lines)
+    width = std::max(width, fixedmetric.horizontalAdvance(line));
+  const int height = lines.size() * fixedmetric.lineSpacing();
+
+  QRect box(offscreen.width() - width - 4 * marg, graph_rect.top(),
+            width + 2 * marg, height + 2 * marg);
+  paint.fillRect(box, QColor(0, 0, 0, 180));
+  paint.setPen(Qt::white);
+  int y = box.top() + marg + fixedmetric.ascent();
+  for (const QString &line : lines) {
+    paint.drawText(box.left() + marg, y, line);
+    y += fixedmetric.lineSpacing();
+  }
+  paint.restore();
+}
+
+/**
+ * switch the timing-overlay on or off
+ */
+void Graph::showTiming(bool show) {
+  show_timing = show;
+  redraw();
 }
 
 /**
@@ -583,8 +1698,11 @@ void Graph::drawAll() {
   const int numgraphs = glist.size();
 
   if (numgraphs) {
+    trace_span trace("drawAll");
+    stage_timer frame_timer(timing_, frame_timing::frame);
     if (!data_is_valid)
       fetchAllData();
+    timing_.points_drawn(0);
 
     // clear
     QPainter paint(&offscreen);
@@ -599,11 +1717,7 @@ void Graph::drawAll() {
     const QFontMetrics smallmetric = QFontMetrics(small_font);
     const QFontMetrics headermetric = QFontMetrics(header_font);
 
-    time_iterator minor_x, major_x, label_x;
-    QString format_x;
-    bool center_x;
-    findXGrid(graph_rect.width(), format_x, center_x, minor_x, major_x,
-              label_x);
+    updateXAxis();
     drawHeader(paint);
 
     int n = 0;
@@ -613,7 +1727,12 @@ void Graph::drawAll() {
 
       // y-scaling
       double base;
-      Range y_range = i->minmax_adj(&base);
+      Range y_range;
+      {
+        trace_span trace("minmax");
+        stage_timer timer(timing_, frame_timing::minmax);
+        y_range = i->minmax_adj(&base);
+      }
       if (!y_range.isValid())
         continue;
 
@@ -638,7 +1757,10 @@ void Graph::drawAll() {
       drawGraph(paint, panelrect, *i, y_range.min(), y_range.max());
       drawLegend(paint, marg, legend_base, box_size, *i);
     }
+    if (show_timing)
+      drawTiming(paint);
     paint.end();
+    drawn = true;
     // copy to screen
     QPainter(this).drawPixmap(contentsRect(), offscreen);
   } else {
@@ -649,6 +1771,7 @@ void Graph::drawAll() {
     paint.drawText((width() - labelwidth) / 2, height() / 2, label);
     paint.end();
   }
+  timing_.commit();
 }
 
 void Graph::layout() {
@@ -656,8 +1779,12 @@ void Graph::layout() {
   if (!numgraphs)
     return;
 
+  trace_span trace("layout");
+  stage_timer timer(timing_, frame_timing::layout);
+
   // resize offscreen-map to widget-size
   offscreen = QPixmap(contentsRect().width(), contentsRect().height());
+  drawn = false;
 
   QPainter paint(&offscreen);
   paint.setFont(font);
@@ -676,8 +1803,11 @@ void Graph::layout() {
                      offscreen.width() - labelwidth - marg,
                      offscreen.height() - headermetric.height() - 2 * marg);
 
-  const int total_legend_height =
-      calcLegendHeights(box_size, offscreen.width() - 2 * marg);
+  // a legend may take a third of its panel, unless expanded
+  const int max_legend_lines =
+      std::max(1, graph_rect.height() / numgraphs / 3 / fontmetric.lineSpacing());
+  const int total_legend_height = calcLegendHeights(
+      box_size, offscreen.width() - 2 * marg, max_legend_lines);
   graph_height =
       (graph_rect.height() - total_legend_height - marg * (2 * numgraphs - 1)) /
       numgraphs;
@@ -685,10 +1815,12 @@ void Graph::layout() {
   int top = graph_rect.top();
   for (graph_list::iterator i = begin(); i != end(); ++i) {
     int bottom = top + graph_height - marg - smallmetric.lineSpacing();
+    const int legend_height = i->legend_lines() * fontmetric.lineSpacing();
     i->top(top + contentsRect().top());
     i->bottom(bottom + contentsRect().top());
-    top +=
-        graph_height + i->legend_lines() * fontmetric.lineSpacing() + 2 * marg;
+    i->legend_top(top + graph_height + contentsRect().top());
+    i->legend_bottom(top + graph_height + legend_height + contentsRect().top());
+    top += graph_height + legend_height + 2 * marg;
   }
 }
 
@@ -696,11 +1828,87 @@ void Graph::layout() {
  * Qt (re)paint event
  */
 void Graph::paintEvent(QPaintEvent *e) {
+  trace_span trace("paintEvent");
   QFrame::paintEvent(e);
-  drawAll();
+  if (!snapshot.isNull()) {
+    if (!data_is_valid && start == snapshot_start && span == snapshot_span) {
+      drawSnapshot();
+      return;
+    }
+    snapshot = QPixmap();
+  }
+  // only the crosshair moved
+  if (drawn && data_is_valid && offscreen.size() == contentsRect().size())
+    QPainter(this).drawPixmap(contentsRect(), offscreen);
+  else
+    drawAll();
+  drawCrosshair();
+}
+
+/**
+ * write the last drawing with the end of its data to @a file
+ */
+bool Graph::saveSnapshot(const QString &file) const {
+  if (!data_is_valid || offscreen.isNull() || empty())
+    return false;
+  QImage image = offscreen.toImage();
+  image.setText("end", QString::number(qint64(data_end)));
+  return image.save(file, "PNG");
+}
+
+/**
+ * show the drawing saved in @a file for the current window, until the
+ * data is fetched in the background
+ */
+void Graph::showSnapshot(const QString &file) {
+  QImage image;
+  if (empty() || !image.load(file, "PNG"))
+    return;
+  snapshot = QPixmap::fromImage(image);
+  snapshot_start = start;
+  snapshot_span = span;
+  snapshot_time = image.text("end").toLongLong();
+  // the fetch started here replaces the data of the disk-cache
+  cache_tried = true;
+  redraw();
 }
 
-void Graph::resizeEvent(QResizeEvent * /*event*/) { layout(); }
+/**
+ * the snapshot, dimmed and marked with the time it shows
+ */
+void Graph::drawSnapshot() {
+  trace_span trace("drawSnapshot");
+  fetchInBackground();
+
+  QPainter paint(this);
+  paint.eraseRect(contentsRect());
+  paint.drawPixmap(contentsRect().topLeft(), snapshot);
+  paint.fillRect(contentsRect(), QColor(128, 128, 128, 96));
+
+  paint.setFont(small_font);
+  const QString label =
+      i18n("Updating, shown as of %1",
+           Qstrftime(i18n("%Y-%m-%d %H:%M").toLatin1(),
+                     localtime(&snapshot_time)));
+  const QRect box = paint.fontMetrics()
+                        .boundingRect(label)
+                        .adjusted(-2 * marg, -marg, 2 * marg, marg);
+  const QRect r(contentsRect().right() - box.width() - marg,
+                contentsRect().top() + marg, box.width(), box.height());
+  paint.fillRect(r, color_graph_bg);
+  paint.setPen(color_major);
+  paint.drawText(r, Qt::AlignCenter, label);
+}
+
+void Graph::resizeEvent(QResizeEvent * /*event*/) {
+  layout();
+  // reduced to fewer columns than there are pixels now
+  if (downsampled && graph_rect.width() > downsampled) {
+    data_is_valid = false;
+    downsampled = 0;
+    redraw();
+  }
+}
 
 Graph::graph_list::iterator Graph::graphAt(const QPoint &pos) {
   for (graph_list::iterator i = begin(); i != end(); ++i) {
@@ -726,11 +1934,11 @@ Graph::graph_list::const_iterator Graph::graphAt(const QPoint &pos) const {
 void Graph::autoUpdate(bool active) {
   if (active == true) {
     if (autoUpdateTimer == -1) {
-      autoUpdateTimer = startTimer(10000);
+      autoUpdateTimer = startTimer(update_interval);
       timer_diff = 0.99 * span;
       start = time(0) - timer_diff;
       data_is_valid = false;
-      update();
+      redraw();
     }
   } else {
     if (autoUpdateTimer != -1) {
@@ -740,6 +1948,20 @@ void Graph::autoUpdate(bool active) {
   }
 }
 
+/**
+ * lay the live samples over the data every second
+ *
+ * the rrd-files are read again at the interval of auto-update only.
+ */
+void Graph::showLive(bool active) {
+  if (active && liveTimer == -1) {
+    liveTimer = startTimer(1000);
+  } else if (!active && liveTimer != -1) {
+    killTimer(liveTimer);
+    liveTimer = -1;
+  }
+}
+
 /**
  *
  */
@@ -754,7 +1976,7 @@ void Graph::removeGraph() {
     changed(true);
   }
   layout();
-  update();
+  redraw();
 }
 
 /**
@@ -763,7 +1985,7 @@ void Graph::removeGraph() {
 void Graph::splitGraph() {
   add();
   layout();
-  update();
+  redraw();
 }
 
 /**
@@ -776,11 +1998,19 @@ void Graph::mousePressEvent(QMouseEvent *e) {
   origin_start = data_start;
   origin_end = data_end;
 
+  // click on a legend
+  if (e->button() == Qt::LeftButton && toggleLegend(e->pos()))
+    return;
+
   // context-menu
   if (e->button() == Qt::RightButton) {
     // map for delete-datasource-options
     typedef std::map<QAction *, GraphInfo::iterator> actionmap;
     actionmap acts;
+    std::map<QAction *, std::pair<GraphInfo::iterator, aggregate_op>>
+        aggregate_acts;
+    std::map<QAction *, int> top_acts, rank_acts;
+    QAction *other_action = 0;
 
     // context-menu
     QMenu menu(this);
@@ -790,9 +2020,39 @@ void Graph::mousePressEvent(QMouseEvent *e) {
     menu.addAction(QIcon("list-add"), i18n("add new subgraph"), this,
                    SLOT(splitGraph()));
 
+    QAction *legend_action = 0, *expression_action = 0;
     if (s_graph != end()) {
       menu.addAction(QIcon("edit-delete"), i18n("delete this subgraph"), this,
                      SLOT(removeGraph()));
+      expression_action = menu.addAction(i18n("add expression…"));
+
+      // top-N
+      QMenu *top_menu = menu.addMenu(i18n("show top"));
+      static const int counts[] = {0, 5, 10, 20};
+      for (int c : counts) {
+        QAction *T = top_menu->addAction(c ? i18n("top %1", c) : i18n("all"));
+        T->setCheckable(true);
+        T->setChecked(s_graph->top_n() == c);
+        top_acts[T] = c;
+      }
+      top_menu->addSeparator();
+      for (int r = rank_max; r <= rank_p95; ++r) {
+        const QString name = i18n(rank_name(rank_op(r)));
+        QAction *T = top_menu->addAction(i18n("rank by %1", name));
+        T->setCheckable(true);
+        T->setChecked(s_graph->rank_by() == r);
+        rank_acts[T] = r;
+      }
+      top_menu->addSeparator();
+      other_action = top_menu->addAction(i18n("sum of the others"));
+      other_action->setCheckable(true);
+      other_action->setChecked(s_graph->show_other());
+      if (s_graph->legend_expanded() ||
+          s_graph->legend_shown() < int(s_graph->visible_size())) {
+        legend_action = menu.addAction(s_graph->legend_expanded()
+                                           ? i18n("collapse legend")
+                                           : i18n("expand legend"));
+      }
       menu.addSeparator();
 
       // generate entries to remove datasources
@@ -801,15 +2061,69 @@ void Graph::mousePressEvent(QMouseEvent *e) {
             menu.addAction(QIcon("list-remove"), i18n("remove ") + i->label);
         acts[T] = i;
       }
+
+      // and to change the kind of aggregates
+      for (GraphInfo::iterator i = s_graph->begin(); i != s_graph->end(); ++i) {
+        if (i->aggregate == agg_none)
+          continue;
+        QMenu *sub = menu.addMenu(i18n("aggregate ") + i->node);
+        for (int op = agg_sum; op <= agg_percentile; ++op) {
+          QAction *T = sub->addAction(
+              op == agg_percentile
+                  ? i18n("percentile band")
+                  : i18n(aggregate_name(aggregate_op(op))));
+          T->setCheckable(true);
+          T->setChecked(i->aggregate == op);
+          aggregate_acts[T] = std::make_pair(i, aggregate_op(op));
+        }
+      }
     }
 
     QAction *action = menu.exec(e->globalPos());
 
+    if (action && action == expression_action) {
+      addExpression(*s_graph);
+      return;
+    }
+
+    if (action && (top_acts.count(action) || rank_acts.count(action) ||
+                   action == other_action)) {
+      if (top_acts.count(action))
+        s_graph->top_n(top_acts[action]);
+      else if (rank_acts.count(action))
+        s_graph->rank_by(rank_op(rank_acts[action]));
+      else
+        s_graph->show_other(!s_graph->show_other());
+      s_graph->rank();
+      changed(true);
+      layout();
+      redraw();
+      return;
+    }
+
+    if (action && action == legend_action) {
+      s_graph->legend_expanded(!s_graph->legend_expanded());
+      layout();
+      redraw();
+      return;
+    }
+
     actionmap::iterator result = acts.find(action);
     if (result != acts.end()) {
       s_graph->erase(result->second);
       layout();
-      update();
+      redraw();
+    }
+
+    if (aggregate_acts.count(action)) {
+      GraphInfo::datasource &d = *aggregate_acts[action].first;
+      d.aggregate = aggregate_acts[action].second;
+      d.label = GraphInfo::aggregate_label(d);
+      d.label_width = -1;
+      changed(true);
+      data_is_valid = false;
+      layout();
+      redraw();
     }
   }
 }
@@ -844,15 +2158,108 @@ void Graph::mouseMoveEvent(QMouseEvent *e) {
       timer_diff = time(0) - start;
 
     data_is_valid = false;
-    update();
+    redraw();
   } else if (e->buttons() == Qt::MidButton) {
     dragging = true;
+    redraw();
+  } else if (e->buttons() == Qt::NoButton) {
+    crosshair = e->pos();
+    crosshair_shown = true;
     update();
   } else {
     e->ignore();
   }
 }
 
+void Graph::leaveEvent(QEvent * /*event*/) {
+  crosshair_shown = false;
+  update();
+}
+
+/**
+ * sample of @a data drawn at @a pos, 0 to 1 across the graph
+ */
+static double sampleAt(const series_handle &h, double pos) {
+  series_reader data(h);
+  if (data.empty())
+    return std::numeric_limits<double>::quiet_NaN();
+  return data[size_t(pos * (data.size() - 1) + 0.5)];
+}
+
+static QString readout(double v) {
+  if (std::isnan(v))
+    return QString("-");
+  double m;
+  const char *prefix = si_prefix(v, m);
+  return QString::fromStdString(si_number(v, 4, prefix, m));
+}
+
+/**
+ * a line through all subgraphs at the mouse-position, the time and the
+ * values of the subgraph under it
+ *
+ * drawn over the offscreen-map, the samples are found by their index.
+ */
+void Graph::drawCrosshair() {
+  if (!crosshair_shown || !drawn || graph_rect.width() < 2)
+    return;
+  const QPoint p = crosshair - contentsRect().topLeft();
+  if (p.x() < graph_rect.left() || p.x() > graph_rect.right())
+    return;
+
+  QPainter paint(this);
+  paint.translate(contentsRect().topLeft());
+  paint.setPen(QPen(color_major, 0, Qt::DashLine));
+  for (const GraphInfo &gi : glist)
+    paint.drawLine(p.x(), gi.top() - contentsRect().top(), p.x(),
+                   gi.bottom() - contentsRect().top());
+
+  graph_list::const_iterator g = graphAt(crosshair);
+  if (g == end())
+    return;
+  paint.drawLine(graph_rect.left(), p.y(), graph_rect.right(), p.y());
+
+  // time of the sample under the mouse
+  const double pos =
+      double(p.x() - graph_rect.left()) / (graph_rect.width() - 1);
+  time_t t = data_start + time_t(pos * (data_end - data_start));
+  if (step)
+    t = data_start + (t - data_start + step / 2) / step * step;
+
+  QStringList lines;
+  lines << Qstrftime(i18n("%Y-%m-%d %H:%M:%S").toLatin1(), localtime(&t));
+  const size_t n = std::min(g->visible_size(), size_t(16));
+  for (size_t k = 0; k < n; ++k) {
+    const GraphInfo::datasource &d = g->visible(k);
+    lines << i18n("%1: %2 (%3 to %4)", d.label,
+                  readout(sampleAt(d.avg_data, pos)),
+                  readout(sampleAt(d.min_data, pos)),
+                  readout(sampleAt(d.max_data, pos)));
+  }
+
+  paint.setFont(small_font);
+  const QFontMetrics &metric = paint.fontMetrics();
+  int w = 0;
+  for (const QString &l : lines)
+    w = std::max(w, metric.horizontalAdvance(l));
+  const int h = lines.size() * metric.lineSpacing();
+  int x = p.x() + 4 * marg;
+  if (x + w + 2 * marg > graph_rect.right())
+    x = p.x() - 4 * marg - w - 2 * marg;
+  const int y =
+      std::max(graph_rect.top(), std::min(p.y(), height() - h - 2 * marg));
+
+  QColor bg = color_graph_bg;
+  bg.setAlpha(200);
+  paint.fillRect(x, y, w + 2 * marg, h + 2 * marg, bg);
+  int ly = y + marg + metric.ascent();
+  for (int k = 0; k < lines.size(); ++k) {
+    paint.setPen(k ? color_line[(k - 1) % 8] : color_major);
+    paint.drawText(x + marg, ly, lines[k]);
+    ly += metric.lineSpacing();
+  }
+}
+
 /**
  *
  */
@@ -866,10 +2273,15 @@ void Graph::wheelEvent(QWheelEvent *e) {
 /**
  *
  */
-void Graph::timerEvent(QTimerEvent * /*event*/) {
+void Graph::timerEvent(QTimerEvent *event) {
+  if (event->timerId() == liveTimer) {
+    if (autoUpdateTimer != -1 && updateLive())
+      redraw();
+    return;
+  }
   data_is_valid = false;
   start = time(0) - timer_diff;
-  update();
+  redraw();
 }
 
 /**
@@ -920,20 +2332,14 @@ void Graph::dropEvent(QDropEvent *event) {
     return;
 
   event->acceptProposedAction();
-  const int numgraphs = glist.size();
-  if (numgraphs) {
-    graph_list::iterator target = graphAt(event->pos());
-    if (target != end()) {
-      target->add(mimeData->rrd(), mimeData->ds(), mimeData->label());
-    } else {
-      add(mimeData->rrd(), mimeData->ds(), mimeData->label());
-    }
-  } else {
-    add(mimeData->rrd(), mimeData->ds(), mimeData->label());
-  }
+  graph_list::iterator target = glist.empty() ? end() : graphAt(event->pos());
+  if (target != end())
+    target->add(mimeData->datasource());
+  else
+    add().add(mimeData->datasource());
   data_is_valid = false;
   layout();
-  update();
+  redraw();
 }
 
 /**
@@ -949,7 +2355,7 @@ void Graph::last(time_t new_span) {
     start = time(0) - 0.99 * span;
   }
   data_is_valid = false;
-  update();
+  redraw();
 }
 
 /**
@@ -978,7 +2384,35 @@ void Graph::zoom(double clicks) {
   }
 
   data_is_valid = false;
-  update();
+  redraw();
+}
+
+/**
+ * ds_minmax of packed series, a block at a time
+ */
+static Range packed_minmax(const GraphInfo::datasource &d) {
+  series_reader avg(d.avg_data), min(d.min_data), max(d.max_data);
+  const size_t size = avg.size();
+  if (size != min.size() || size != max.size())
+    return Range();
+
+  Range r;
+  std::vector<double> a, lo, hi;
+  for (size_t first = 0; first < size; first += packed_series::block_size) {
+    const size_t last = std::min(size, first + packed_series::block_size);
+    a.clear();
+    lo.clear();
+    hi.clear();
+    for (size_t i = first; i < last; ++i) {
+      a.push_back(avg[i]);
+      lo.push_back(min[i]);
+      hi.push_back(max[i]);
+    }
+    const Range b = ds_minmax(a, lo, hi);
+    if (b.isValid())
+      r = r.isValid() ? range_max(r, b) : b;
+  }
+  return r;
 }
 
 /**
@@ -986,8 +2420,11 @@ void Graph::zoom(double clicks) {
  */
 Range GraphInfo::minmax() {
   Range r;
-  for (const_iterator i = begin(); i != end(); ++i) {
-    Range a = ds_minmax(i->avg_data, i->min_data, i->max_data);
+  for (size_t k = 0; k < visible_size(); ++k) {
+    const datasource &d = visible(k);
+    Range a = d.avg_data.packed() || d.min_data.packed() || d.max_data.packed()
+                  ? packed_minmax(d)
+                  : ds_minmax(d.avg_data, d.min_data, d.max_data);
     if (a.isValid()) {
       if (r.isValid())
         r = range_max(r, a);
@@ -998,6 +2435,226 @@ Range GraphInfo::minmax() {
   return r;
 }
 
+/**
+ * label of an aggregate, e.g. "host•cpu (mean)"
+ */
+QString GraphInfo::aggregate_label(const datasource &d) {
+  if (d.aggregate == agg_percentile)
+    return i18n("%1 (p%2–p%3)", d.node, d.percentile, 100.0 - d.percentile);
+  return i18n("%1 (%2)", d.node, i18n(aggregate_name(d.aggregate)));
+}
+
+/**
+ * compile the expression of @a d, its variables are named by the members
+ *
+ * throws expression_error
+ */
+void GraphInfo::compile(datasource &d) {
+  std::vector<std::string> vars;
+  for (const source &m : d.members)
+    vars.push_back(m.name.toStdString());
+  d.program.compile(d.expr.toStdString(), vars);
+  d.avg_cache.clear();
+  d.min_cache.clear();
+  d.max_cache.clear();
+}
+
+/**
+ * replace the datasources of the pattern @a selection by @a found
+ *
+ * datasources found again are kept with their data, the new ones are
+ * appended.  Returns true if anything changed.
+ */
+bool GraphInfo::resolve(size_t selection,
+                        const std::vector<datasource> &found) {
+  std::set<std::pair<QString, QString>> wanted;
+  for (const datasource &d : found)
+    wanted.emplace(d.rrd, d.ds);
+
+  const size_t before = dslist.size();
+  iterator out = dslist.begin();
+  for (iterator i = dslist.begin(); i != dslist.end(); ++i) {
+    if (i->selection == int(selection) && !wanted.erase({i->rrd, i->ds}))
+      continue;
+    if (out != i)
+      *out = std::move(*i);
+    ++out;
+  }
+  dslist.erase(out, dslist.end());
+  const bool removed = dslist.size() != before;
+
+  for (const datasource &d : found)
+    if (wanted.erase({d.rrd, d.ds})) {
+      dslist.push_back(d);
+      dslist.back().selection = selection;
+    }
+  if (!removed && dslist.size() == before)
+    return false;
+  reset_visible();
+  return true;
+}
+
+static size_t memory(const GraphInfo::datasource &d) {
+  return d.avg_data.memory() + d.min_data.memory() + d.max_data.memory() +
+         d.avg_cache.memory() + d.min_cache.memory() + d.max_cache.memory();
+}
+
+/**
+ * @a h consolidated by @a op to at most @a width columns
+ *
+ * only done if it has more than twice as many, otherwise little is
+ * saved.
+ */
+static void downsample(series_handle &h, size_t width, aggregate_op op) {
+  const std::vector<double> &in = h;
+  if (width == 0 || in.size() <= 2 * width)
+    return;
+
+  const size_t f = (in.size() + width - 1) / width;
+  std::vector<double> out((in.size() + f - 1) / f);
+  for (size_t j = 0; j < out.size(); ++j) {
+    const size_t end = std::min(in.size(), (j + 1) * f);
+    double acc = std::numeric_limits<double>::quiet_NaN();
+    size_t n = 0;
+    for (size_t i = j * f; i < end; ++i) {
+      if (std::isnan(in[i]))
+        continue;
+      if (n++ == 0)
+        acc = in[i];
+      else if (op == agg_min)
+        acc = std::min(acc, in[i]);
+      else if (op == agg_max)
+        acc = std::max(acc, in[i]);
+      else
+        acc += in[i];
+    }
+    out[j] = op == agg_mean && n ? acc / n : acc;
+  }
+  h.assign(std::move(out));
+}
+
+static void pack(GraphInfo::datasource &d) {
+  d.avg_data.pack();
+  d.min_data.pack();
+  d.max_data.pack();
+  d.avg_cache = expression_cache();
+  d.min_cache = expression_cache();
+  d.max_cache = expression_cache();
+}
+
+static void unpack(GraphInfo::datasource &d) {
+  d.avg_data.unpack();
+  d.min_data.unpack();
+  d.max_data.unpack();
+}
+
+static void downsample(GraphInfo::datasource &d, size_t width) {
+  downsample(d.avg_data, width, agg_mean);
+  downsample(d.min_data, width, agg_min);
+  downsample(d.max_data, width, agg_max);
+  d.avg_cache = expression_cache();
+  d.min_cache = expression_cache();
+  d.max_cache = expression_cache();
+}
+
+static void release(GraphInfo::datasource &d) {
+  d.avg_data.reset();
+  d.min_data.reset();
+  d.max_data.reset();
+  d.avg_cache = expression_cache();
+  d.min_cache = expression_cache();
+  d.max_cache = expression_cache();
+}
+
+/**
+ * bytes of the series of all datasources
+ */
+size_t GraphInfo::memory() const {
+  size_t bytes = ::memory(other_);
+  for (const datasource &d : dslist)
+    bytes += ::memory(d);
+  return bytes;
+}
+
+/**
+ * reduce the series to about one column per pixel of @a width
+ */
+void GraphInfo::downsample(size_t width) {
+  ::downsample(other_, width);
+  for (datasource &d : dslist)
+    ::downsample(d, width);
+}
+
+void GraphInfo::pack() {
+  ::pack(other_);
+  for (datasource &d : dslist)
+    ::pack(d);
+}
+
+void GraphInfo::unpack() {
+  ::unpack(other_);
+  for (datasource &d : dslist)
+    ::unpack(d);
+}
+
+void GraphInfo::release() {
+  ::release(other_);
+  for (datasource &d : dslist)
+    ::release(d);
+}
+
+/**
+ * select the datasources to draw by their rank in the current data
+ *
+ * returns true if the legend changed
+ */
+bool GraphInfo::rank() {
+  const std::vector<int> before = visible_;
+  const QString other_label = other_.label;
+
+  if (top_n_ <= 0 || size_t(top_n_) >= dslist.size()) {
+    reset_visible();
+    return visible_ != before;
+  }
+
+  std::vector<int> top;
+  for (int i : visible_)
+    if (i >= 0)
+      top.push_back(i);
+
+  std::vector<double> scores(dslist.size()), scratch;
+  for (size_t i = 0; i < dslist.size(); ++i)
+    scores[i] = series_score(dslist[i].avg_data, rank_by_, scratch);
+  select_top(scores, top_n_, top);
+  visible_ = top;
+
+  if (show_other_) {
+    std::vector<char> drawn(dslist.size(), 0);
+    for (int i : top)
+      drawn[i] = 1;
+    series_aggregator avg(agg_sum), min(agg_sum), max(agg_sum);
+    for (size_t i = 0; i < dslist.size(); ++i) {
+      if (drawn[i])
+        continue;
+      avg.add(dslist[i].avg_data);
+      min.add(dslist[i].min_data);
+      max.add(dslist[i].max_data);
+    }
+    std::vector<double> result;
+    avg.result(result);
+    other_.avg_data.assign(std::move(result));
+    min.result(result);
+    other_.min_data.assign(std::move(result));
+    max.result(result);
+    other_.max_data.assign(std::move(result));
+    other_.label = i18n("other (%1)", int(avg.count()));
+    if (other_.label != other_label)
+      other_.label_width = -1;
+    visible_.push_back(-1);
+  }
+  return visible_ != before || other_.label != other_label;
+}
+
 /**
  * returns adjusted range for y-values
  */
@@ -1005,3 +2662,21 @@ Range GraphInfo::minmax_adj(double *base) {
   Range y = minmax();
   return range_adj(y, base);
 }
+
+/**
+ * the datasource that is dragged, aggregates are means by default
+ */
+GraphInfo::datasource GraphMimeData::datasource() const {
+  GraphInfo::datasource d;
+  if (members_.empty()) {
+    d.rrd = rrd_;
+    d.ds = ds_;
+    d.label = label_;
+  } else {
+    d.aggregate = agg_mean;
+    d.node = label_;
+    d.members = members_;
+    d.label = GraphInfo::aggregate_label(d);
+  }
+  return d;
+}
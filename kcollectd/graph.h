@@ -22,7 +22,9 @@
 #ifndef GRAPH_H
 #define GRAPH_H
 
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <QFrame>
@@ -33,32 +35,113 @@
 #include <QRect>
 #include <QWheelEvent>
 
+#include "aggregate.h"
+#include "expression.h"
+#include "labelcache.h"
 #include "misc.h"
+#include "pattern.h"
+#include "series_store.h"
+#include "timeaxis.h"
+#include "timing.h"
 
-class time_iterator;
+struct background_fetch;
+struct chunked_fetch;
 
 class GraphInfo {
 public:
+  struct source {
+    QString rrd;
+    QString ds;
+    QString name; // variable in an expression
+  };
   struct datasource {
     QString rrd;
     QString ds;
     QString label;
-    std::vector<double> avg_data, min_data, max_data;
+    int label_width = -1; // cached width of label in the legend
+    // aggregate of the members instead of rrd/ds
+    aggregate_op aggregate = agg_none;
+    double percentile = 10.0; // band from percentile to 100-percentile
+    QString node;             // tree-node the members were taken from
+    // derived from the members by an expression instead of rrd/ds
+    QString expr;
+    expression program;
+    expression_cache avg_cache, min_cache, max_cache;
+    std::vector<source> members;
+    series_handle avg_data, min_data, max_data;
+    // trailing columns of min, max and avg the rrd-file had no data for
+    size_t live_columns[3] = {0, 0, 0};
+    int selection = -1; // index of the pattern that selected it
   };
 
+  GraphInfo()
+      : top_(0), bottom_(0), legend_lines_(0), legend_shown_(0),
+        legend_top_(0), legend_bottom_(0), legend_expanded_(false),
+        top_n_(0), rank_by_(rank_max), show_other_(false) {}
+
   void add(const QString &rrd, const QString &ds, const QString &label);
-  void add(const datasource &d) { dslist.push_back(d); }
-  void clear() { dslist.clear(); }
+  void add(const datasource &d) {
+    dslist.push_back(d);
+    reset_visible();
+  }
+  void clear() {
+    dslist.clear();
+    selections_.clear();
+    reset_visible();
+  }
   size_t size() const { return dslist.size(); }
   Range minmax();
   Range minmax_adj(double *base);
 
+  // datasources selected by patterns, resolved against the rrd-tree
+  size_t select(const datasource_pattern &pattern) {
+    selections_.push_back(pattern);
+    return selections_.size() - 1;
+  }
+  const std::vector<datasource_pattern> &selections() const {
+    return selections_;
+  }
+  bool resolve(size_t selection, const std::vector<datasource> &found);
+
+  // memory of the fetched data
+  size_t memory() const;
+  void downsample(size_t width);
+  void pack();
+  void unpack();
+  void release();
+
+  // top-N: only the N highest ranking datasources are drawn
+  int top_n() const { return top_n_; }
+  rank_op rank_by() const { return rank_by_; }
+  bool show_other() const { return show_other_; }
+  void top_n(int n) { top_n_ = n; }
+  void rank_by(rank_op r) { rank_by_ = r; }
+  void show_other(bool o) { show_other_ = o; }
+  bool rank();
+
+  // the datasources drawn, in legend order
+  size_t visible_size() const { return visible_.size(); }
+  const datasource &visible(size_t k) const {
+    return visible_[k] < 0 ? other_ : dslist[visible_[k]];
+  }
+  datasource &visible(size_t k) {
+    return visible_[k] < 0 ? other_ : dslist[visible_[k]];
+  }
+
   int top() const { return top_; }
   int bottom() const { return bottom_; }
   int legend_lines() const { return legend_lines_; }
+  int legend_shown() const { return legend_shown_; }
+  int legend_top() const { return legend_top_; }
+  int legend_bottom() const { return legend_bottom_; }
+  bool legend_expanded() const { return legend_expanded_; }
   void top(int t) { top_ = t; }
   void bottom(int b) { bottom_ = b; }
   void legend_lines(int l) { legend_lines_ = l; }
+  void legend_shown(int s) { legend_shown_ = s; }
+  void legend_top(int t) { legend_top_ = t; }
+  void legend_bottom(int b) { legend_bottom_ = b; }
+  void legend_expanded(bool e) { legend_expanded_ = e; }
 
   // iterators pointing to datasources
   typedef std::vector<datasource>::iterator iterator;
@@ -69,12 +152,27 @@ public:
   const_iterator begin() const { return dslist.begin(); }
   const_iterator end() const { return dslist.end(); }
 
-  void erase(iterator i) { dslist.erase(i); }
+  void erase(iterator i) {
+    dslist.erase(i);
+    reset_visible();
+  }
+  static QString aggregate_label(const datasource &d);
+  static void compile(datasource &d);
   bool empty() const { return dslist.empty(); }
 
 private:
-  int top_, bottom_, legend_lines_;
+  int top_, bottom_, legend_lines_, legend_shown_;
+  int legend_top_, legend_bottom_;
+  bool legend_expanded_;
+  int top_n_;
+  rank_op rank_by_;
+  bool show_other_;
   std::vector<datasource> dslist;
+  std::vector<datasource_pattern> selections_;
+  std::vector<int> visible_; // indices into dslist, -1 is other_
+  datasource other_;         // sum of the datasources not drawn
+
+  void reset_visible();
 };
 
 /**
@@ -84,14 +182,19 @@ class GraphMimeData : public QMimeData {
   Q_OBJECT
 public:
   void setGraph(const QString &rrd, const QString &ds, const QString &label);
+  void setAggregate(const QString &node,
+                    const std::vector<GraphInfo::source> &members);
   const QString &rrd() const { return rrd_; }
   const QString &ds() const { return ds_; }
   const QString &label() const { return label_; }
+  bool isAggregate() const { return !members_.empty(); }
+  GraphInfo::datasource datasource() const;
 
 private:
   QString rrd_;
   QString ds_;
   QString label_;
+  std::vector<GraphInfo::source> members_;
 };
 
 /**
@@ -108,8 +211,10 @@ public:
   explicit Graph(QWidget *parent = 0);
   Graph(QWidget *parent, const std::string &rrd, const std::string &ds,
         const char *name = 0);
+  virtual ~Graph();
 
   void clear();
+  void reload();
   GraphInfo &add(const QString &rrd, const QString &ds, const QString &label);
   GraphInfo &add();
 
@@ -118,6 +223,7 @@ public:
 
   void autoUpdate(bool active);
   bool autoUpdate() { return (autoUpdateTimer != -1); }
+  void showLive(bool active);
 
   virtual QSize sizeHint() const override;
   virtual void paintEvent(QPaintEvent *ev) override;
@@ -127,8 +233,10 @@ public:
   virtual void zoom(double clicks);
   virtual void mousePressEvent(QMouseEvent *e) override;
   virtual void mouseMoveEvent(QMouseEvent *e) override;
+  virtual void leaveEvent(QEvent *e) override;
   virtual void wheelEvent(QWheelEvent *e) override;
   virtual void timerEvent(QTimerEvent *event) override;
+  virtual void customEvent(QEvent *event) override;
   // drag-and-drop
   virtual void dragEnterEvent(QDragEnterEvent *event) override;
   virtual void dragMoveEvent(QDragMoveEvent *event) override;
@@ -142,6 +250,27 @@ public:
 
   bool empty() const { return glist.empty(); }
   time_t range() { return span; }
+  time_t startTime() { return start; }
+
+  // data of graphs not shown, e.g. in other tabs
+  bool valid() const { return data_is_valid; }
+  bool fetching() const { return bool(pending); }
+  void warm();
+  size_t memory() const;
+  void downsample();
+  void fullResolution();
+  void pack();
+  void release();
+  // keep the data on disk for the next start
+  void remember();
+  // image of the last drawing, shown until the data is fetched again
+  bool saveSnapshot(const QString &file) const;
+  void showSnapshot(const QString &file);
+
+  // timing-instrumentation
+  void showTiming(bool show);
+  bool showTiming() const { return show_timing; }
+  const frame_timing &timing() const { return timing_; }
 
 public slots:
   virtual void removeGraph();
@@ -149,8 +278,33 @@ public slots:
 
 private:
   bool fetchAllData();
+  bool fetchCached();
+  void fetchInBackground();
+  void fetchChunked();
+  void takeChunks();
+  void rebuildChunked();
+  void cancelChunks();
+  void rank();
+  void unpack();
+  void fetchBatch(std::vector<series_ptr> &held);
+  series_ptr fetchSeries(const QString &rrd, const QString &ds,
+                         const char *cf);
+  void flushCached();
+  void overlayLive(GraphInfo::datasource &d);
+  void overlayLive(GraphInfo::datasource &d, int k);
+  bool updateLive();
+  void fetchAggregate(GraphInfo::datasource &d, stage_timer &rrd_timer);
+  void fetchDerived(GraphInfo::datasource &d, stage_timer &rrd_timer);
+  void addExpression(GraphInfo &gi);
+  void redraw() {
+    drawn = false;
+    update();
+  }
   void drawAll();
-  int calcLegendHeights(int box_size, int width);
+  void drawSnapshot();
+  void drawCrosshair();
+  int calcLegendHeights(int box_size, int width, int max_lines);
+  bool toggleLegend(const QPoint &pos);
   void drawLegend(QPainter &paint, int left, int pos, int box_size,
                   const GraphInfo &ginfo);
   void drawFooter(QPainter &paint, int left, int right);
@@ -159,15 +313,17 @@ private:
                   double base, QColor color);
   void drawYLabel(QPainter &paint, const QRect &rect, const Range &range,
                   double base);
-  void drawXLines(QPainter &paint, const QRect &rect, time_iterator it,
+  void drawXLines(QPainter &paint, const QRect &rect, const time_ticks &ticks,
                   QColor color);
-  void drawXLabel(QPainter &paint, int y, int left, int right, time_iterator it,
-                  QString format, bool center);
-  void findXGrid(int width, QString &format, bool &center,
-                 time_iterator &minor_x, time_iterator &major_x,
-                 time_iterator &label_x);
+  void drawXLabel(QPainter &paint, int y, int left, int right,
+                  const time_ticks &ticks, const char *format, bool center);
+  void findXGrid(int width, const char *&format, bool &center,
+                 time_ticks &minor_x, time_ticks &major_x,
+                 time_ticks &label_x);
+  void updateXAxis();
   void drawGraph(QPainter &paint, const QRect &rect, const GraphInfo &gi,
                  double min, double max);
+  void drawTiming(QPainter &paint);
   void layout();
 
   graph_list::iterator graphAt(const QPoint &pos);
@@ -176,6 +332,15 @@ private:
   // rrd-data
   graph_list glist;
   bool data_is_valid;
+  bool data_packed; // valid, but stored compressed
+  int downsampled;  // width the data was reduced to, 0 if not
+  bool data_cached; // last known from disk, fetched again in background
+  bool cache_tried; // the disk-cache is only asked for the first fetch
+  time_t fetched_at;
+  std::shared_ptr<background_fetch> pending;
+  std::thread fetcher;
+  std::shared_ptr<chunked_fetch> chunks; // long windows, fetched in parts
+  std::vector<std::shared_ptr<chunked_fetch>> stopped_chunks; // not joined
   time_t start;      // user set start of graph
   time_t span;       // user-set span of graph
   time_t data_start; // real start of data (from rrd_fetch)
@@ -183,14 +348,29 @@ private:
   time_t tz_off;     // offset of the local timezone from GMT
   unsigned long step;
 
+  // time-axis, shared by all subgraphs
+  tz_window tz;
+  time_ticks minor_x, major_x, label_x;
+  const char *format_x;
+  bool center_x;
+  time_t axis_start, axis_end; // window the ticks were generated for
+  int axis_width;
+
   // technical helpers
   int origin_x, origin_y;
   time_t origin_start, origin_end;
   bool dragging;
+  QPoint crosshair; // mouse-position, when hovering over the graphs
+  bool crosshair_shown;
 
   // widget-data
   QFont font, header_font, small_font;
+  label_cache xlabels, ylabels; // labels of the axes in small_font and font
   QPixmap offscreen;
+  bool drawn; // offscreen shows the current state
+  QPixmap snapshot;
+  time_t snapshot_start, snapshot_span; // window it is shown for
+  time_t snapshot_time;                 // end of the data drawn in it
   QRect graph_rect;
   int graph_height, label_width, box_size;
   int label_y1, label_y2;
@@ -199,10 +379,16 @@ private:
 
   // Auto-Update
   int autoUpdateTimer;
+  int update_interval; // ms
   time_t timer_diff;
+  int liveTimer; // laying the live samples over the data again
 
   // state
   bool changed_state;
+
+  // timing-instrumentation
+  frame_timing timing_;
+  bool show_timing;
 };
 
 /**
@@ -215,6 +401,16 @@ inline void GraphInfo::add(const QString &rrd, const QString &ds,
   new_ds.ds = ds;
   new_ds.label = label;
   dslist.push_back(new_ds);
+  reset_visible();
+}
+
+/**
+ * draw all datasources, until they are ranked again
+ */
+inline void GraphInfo::reset_visible() {
+  visible_.resize(dslist.size());
+  for (size_t i = 0; i < dslist.size(); ++i)
+    visible_[i] = i;
 }
 
 /**
@@ -227,6 +423,17 @@ inline void GraphMimeData::setGraph(const QString &r, const QString &d,
   label_ = l;
 }
 
+/**
+ * set an aggregate of @a members, taken from the tree-node @a node
+ */
+inline void GraphMimeData::setAggregate(
+    const QString &node, const std::vector<GraphInfo::source> &members) {
+  rrd_.clear();
+  ds_.clear();
+  label_ = node;
+  members_ = members;
+}
+
 /**
  *
  */
@@ -243,7 +450,7 @@ inline GraphInfo &Graph::add() {
   glist.push_back(gi);
   changed(true);
   layout();
-  update();
+  redraw();
   return glist.back();
 }
 
@@ -18,28 +18,36 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
 #include <iostream>
-#include <set>
-#include <sstream>
-#include <stack>
-
-#include <boost/filesystem.hpp>
 
 #include <QAction>
+#include <QApplication>
 #include <QDomDocument>
 #include <QDrag>
 #include <QFile>
 #include <QFileDialog>
+#include <QHeaderView>
 #include <QIcon>
+#include <QInputDialog>
 #include <QKeySequence>
 #include <QLabel>
 #include <QLayout>
+#include <QLineEdit>
+#include <QListWidget>
 #include <QMenu>
 #include <QMenuBar>
 #include <QPushButton>
 #include <QSplitter>
 #include <QStandardPaths>
-#include <QTreeWidget>
+#include <QStatusBar>
+#include <QTabWidget>
+#include <QTableView>
+#include <QTimer>
+#include <QTreeView>
 #include <QUrl>
 #include <QWhatsThis>
 #include <QWidget>
@@ -53,9 +61,15 @@
 #include <kactioncollection.h>
 #include <kmessagebox.h>
 
+#include "current_values.h"
+#include "export.h"
 #include "graph.h"
 #include "gui.h"
+#include "live.h"
 #include "rrd_interface.h"
+#include "rrdcached.h"
+#include "rrdtree.h"
+#include "trace.h"
 
 #include "drag_pixmap.xpm"
 
@@ -63,6 +77,13 @@
 
 #define I18N_NOOP(text) text
 
+// ms between polls of the current values, and while collectd is away
+static const int values_interval = 10000;
+static const int max_values_interval = 300000;
+
+static const QEvent::Type values_event =
+    QEvent::Type(QEvent::registerEventType());
+
 static struct {
   KStandardAction::StandardAction actionType;
   const char *name;
@@ -85,160 +106,22 @@ static struct {
     {I18N_NOOP("Last Week"), "lastWeek", SLOT(last_week())},
     {I18N_NOOP("Last Month"), "lastMonth", SLOT(last_month())},
     {I18N_NOOP("Add New Subgraph"), "splitGraph", SLOT(splitGraph())},
+    {I18N_NOOP("Add New Tab"), "newTab", SLOT(newTab())},
+    {I18N_NOOP("Rescan Sensor Data"), "rescan", SLOT(rescan())},
+    {I18N_NOOP("Log Timing Summary"), "logTiming", SLOT(logTiming())},
+    {I18N_NOOP("Export Data..."), "exportData", SLOT(exportData())},
 };
 
-static const std::string delimiter("•");
-
-static void get_datasources(const std::string &rrdfile, const std::string &info,
-                            QTreeWidgetItem *item) {
-  std::set<std::string> datasources;
-  get_dsinfo(rrdfile, datasources);
-
-  if (datasources.size() == 1) {
-    item->setFlags(item->flags() | Qt::ItemIsSelectable);
-    item->setText(1, QString::fromUtf8(info.c_str()));
-    item->setText(2, QString::fromUtf8(rrdfile.c_str()));
-    item->setText(3, QString::fromUtf8((*datasources.begin()).c_str()));
-  } else {
-    for (std::set<std::string>::iterator i = datasources.begin();
-         i != datasources.end(); ++i) {
-      QStringList SL(i->c_str());
-      SL.append(QString::fromUtf8((info + delimiter + *i).c_str()));
-      SL.append(QString::fromUtf8(rrdfile.c_str()));
-      SL.append(QString::fromUtf8(i->c_str()));
-      QTreeWidgetItem *dsitem = new QTreeWidgetItem(item, SL);
-      item->setFlags(dsitem->flags() & ~Qt::ItemIsSelectable);
-    }
-  }
-}
-
-static QTreeWidgetItem *mkItem(QTreeWidget *listview, std::string s) {
-  return new QTreeWidgetItem(listview, QStringList(QString(s.c_str())));
-}
-
-static QTreeWidgetItem *mkItem(QTreeWidgetItem *item, std::string s) {
-  return new QTreeWidgetItem(item, QStringList(QString(s.c_str())));
-}
-
-static void recurseTree(QTreeWidgetItem *item,
-                        const boost::filesystem::directory_iterator &host) {
-  const boost::filesystem::directory_iterator end_itr;
-  const QString separator = QStringLiteral("-");
-
-  for (int childNumber = 0; childNumber < item->childCount(); ++childNumber) {
-    QTreeWidgetItem *newroot = item->child(childNumber);
-    QString rootstr = newroot->text(0);
-    int lastpos = rootstr.lastIndexOf(separator);
-
-    while (childNumber + 1 < item->childCount()) {
-      QTreeWidgetItem *newchild = item->child(childNumber + 1);
-      QString newchildstr = newchild->text(0);
-      int endsearch = std::min(lastpos + 1, newchildstr.length());
-      bool abort = true;
-      int newlastpos = -1;
-
-      for (int characterIndex = 0; characterIndex < endsearch;
-           ++characterIndex) {
-        const QChar character = newchildstr.at(characterIndex);
-        if (character != rootstr.at(characterIndex))
-          break;
-
-        if (character == separator) {
-          newlastpos = characterIndex;
-          if (abort) {
-            if (newroot->childCount() == 0)
-              new QTreeWidgetItem(newroot, QStringList(rootstr));
-            item->removeChild(newchild);
-            newroot->addChild(newchild);
-            abort = false;
-          }
-        }
-      }
-
-      if (abort)
-        break;
-
-      lastpos = newlastpos;
-    }
-
-    if (newroot->childCount() > 0) {
-      newroot->setText(0, rootstr.left(lastpos));
-      for (int newchildNumber = 0; newchildNumber < newroot->childCount();
-           ++newchildNumber) {
-        QTreeWidgetItem *newchild = newroot->child(newchildNumber);
-        newchild->setText(0, newchild->text(0).mid(lastpos + 1, -1));
-        newchild->setFlags(newchild->flags() & ~Qt::ItemIsSelectable);
-      }
-
-      // continue building subfolders
-      recurseTree(newroot, host);
-      continue;
-    }
-
-    // this is the terminal node corresponding to
-    // the full directory
-    std::stack<std::string> stack;
-    std::ostringstream sensorbuilder;
-
-    for (const QTreeWidgetItem *current = newroot; current != NULL;
-         current = current->parent())
-      stack.push(current->text(0).toStdString());
-
-    // don't use the hostname
-    stack.pop();
-
-    // don't start with a separator symbol
-    sensorbuilder << stack.top();
-    stack.pop();
-
-    for (; stack.size() > 0; stack.pop())
-      sensorbuilder << separator.toStdString() << stack.top();
-
-    std::string sensor = sensorbuilder.str();
-
-    for (boost::filesystem::directory_iterator rrd(absolute(*host) / sensor);
-         rrd != end_itr; ++rrd) {
-      if (!is_regular(*rrd) && extension(*rrd) == ".rrd")
-        continue;
-
-      QTreeWidgetItem *rrditem = mkItem(newroot, basename(*rrd));
-      rrditem->setFlags(rrditem->flags() & ~Qt::ItemIsSelectable);
-
-      std::ostringstream info;
-      info << sensor << delimiter << basename(*rrd);
-
-      get_datasources(rrd->path().string(), info.str(), rrditem);
-    }
-  }
-}
-
-static void get_rrds(const boost::filesystem::path rrdpath,
-                     QTreeWidget *listview) {
-  using namespace boost::filesystem;
-
-  const directory_iterator end_itr;
-  for (directory_iterator host(rrdpath); host != end_itr; ++host) {
-    if (!is_directory(*host))
-      continue;
-
-    QTreeWidgetItem *hostitem =
-        mkItem(listview, host->path().filename().string());
-    hostitem->setFlags(hostitem->flags() & ~Qt::ItemIsSelectable);
-
-    for (directory_iterator sensor(*host); sensor != end_itr; ++sensor) {
-      if (!is_directory(*sensor))
-        continue;
-
-      QTreeWidgetItem *sensoritem =
-          mkItem(hostitem, sensor->path().filename().string());
-      sensoritem->setFlags(sensoritem->flags() & ~Qt::ItemIsSelectable);
-    }
-
-    hostitem->sortChildren(0, Qt::AscendingOrder);
-    recurseTree(hostitem, host);
-  }
-
-  listview->sortItems(0, Qt::AscendingOrder);
+/**
+ * all datasources in the subtree of @a id
+ */
+static void collect_sources(const rrd_tree &tree, uint32_t id,
+                            std::vector<GraphInfo::source> &list) {
+  std::vector<uint32_t> leaves;
+  tree.leaves(id, leaves);
+  for (uint32_t l : leaves)
+    list.push_back({QString::fromUtf8(tree.rrd(l).c_str()),
+                    QString::fromUtf8(tree.ds(l).c_str())});
 }
 
 /**
@@ -247,7 +130,10 @@ static void get_rrds(const boost::filesystem::path rrdpath,
  * @param parent parent-widget see KMainWindow
  */
 KCollectdGui::KCollectdGui(QWidget *parent)
-    : KMainWindow(parent), rrdbasedir(), mHelpMenu(this), action_collection(parent) {
+    : KMainWindow(parent), graph(0), memory_budget(256 << 20),
+      pack_tabs(true), tabs_changed(false), live(new LiveListener(this)),
+      live_address(":25826"), rrdbasedir(), mHelpMenu(this),
+      action_collection(parent) {
   // standard_actions
   for (size_t i = 0; i < sizeof(standard_actions) / sizeof(*standard_actions);
        ++i)
@@ -269,12 +155,23 @@ KCollectdGui::KCollectdGui(QWidget *parent)
   actionCollection()->addAction("autoUpdate", auto_action);
   connect(auto_action, SIGNAL(toggled(bool)), this, SLOT(autoUpdate(bool)));
 
+  live_action = new QAction(i18n("Live Updates from collectd"), this);
+  live_action->setCheckable(true);
+  actionCollection()->addAction("liveUpdate", live_action);
+  connect(live_action, SIGNAL(toggled(bool)), this, SLOT(liveUpdate(bool)));
+
   panel_action = new QAction(i18n("Hide Sensor Data Tree"), this);
   panel_action->setCheckable(true);
   panel_action->setShortcut(QKeySequence("f9"));
   actionCollection()->addAction("hideTree", panel_action);
   connect(panel_action, SIGNAL(toggled(bool)), this, SLOT(hideTree(bool)));
 
+  timing_action = new QAction(i18n("Show Timing Overlay"), this);
+  timing_action->setCheckable(true);
+  timing_action->setShortcut(QKeySequence("f10"));
+  actionCollection()->addAction("showTiming", timing_action);
+  connect(timing_action, SIGNAL(toggled(bool)), this, SLOT(showTiming(bool)));
+
   // build widgets
   QWidget *main_widget = new QWidget(this);
   setCentralWidget(main_widget);
@@ -282,19 +179,55 @@ KCollectdGui::KCollectdGui(QWidget *parent)
   QHBoxLayout *hboxLayout = new QHBoxLayout(main_widget);
   treeSplitter_ = new QSplitter;
   hboxLayout->addWidget(treeSplitter_);
-  listview_ = new QTreeWidget;
-  listview_->setColumnCount(1);
-  listview_->setHeaderLabels(QStringList(i18n("Sensor Data")));
+
+  // search-box with tree or search-results below
+  QWidget *treeWidget = new QWidget;
+  QVBoxLayout *treeLayout = new QVBoxLayout(treeWidget);
+  treeLayout->setContentsMargins(0, 0, 0, 0);
+  search_ = new QLineEdit;
+  search_->setPlaceholderText(i18n("Search (e.g. eth0 or cpu*idle)"));
+  search_->setClearButtonEnabled(true);
+  treeLayout->addWidget(search_);
+  model_ = new RRDTreeModel(this);
+  listview_ = new QTreeView;
+  listview_->setModel(model_);
+  listview_->setUniformRowHeights(true);
   listview_->setRootIsDecorated(true);
   listview_->setSizePolicy(QSizePolicy::Minimum, QSizePolicy::Preferred);
-  treeSplitter_->addWidget(listview_);
+  treeLayout->addWidget(listview_);
+  results_ = new QListWidget;
+  results_->setSizePolicy(QSizePolicy::Minimum, QSizePolicy::Preferred);
+  results_->hide();
+  treeLayout->addWidget(results_);
+
+  // the tree and the table of current values share the side-panel
+  side_ = new QTabWidget;
+  side_->setDocumentMode(true);
+  side_->addTab(treeWidget, i18n("Sensor Data"));
+  values_model = new CurrentValuesModel(this);
+  values_ = new QTableView;
+  values_->setModel(values_model);
+  values_->setShowGrid(false);
+  values_->setWordWrap(false);
+  values_->verticalHeader()->hide();
+  values_->verticalHeader()->setDefaultSectionSize(
+      values_->fontMetrics().height() + 2);
+  values_->horizontalHeader()->setStretchLastSection(true);
+  values_->setSelectionMode(QAbstractItemView::NoSelection);
+  side_->addTab(values_, i18n("Current Values"));
+  treeSplitter_->addWidget(side_);
 
   QWidget *vboxWidget = new QWidget;
   vbox = new QVBoxLayout;
   vboxWidget->setLayout(vbox);
   treeSplitter_->addWidget(vboxWidget);
-  graph = new Graph;
-  vbox->addWidget(graph);
+  tabs_ = new QTabWidget;
+  tabs_->setDocumentMode(true);
+  tabs_->setTabsClosable(true);
+  tabs_->setMovable(true);
+  tabs_->setTabBarAutoHide(true);
+  vbox->addWidget(tabs_);
+  graph = addTab(i18n("Tab %1", 1));
   connect(treeSplitter_, SIGNAL(splitterMoved(int, int)), this, SLOT(resizeTree(int, int)));
 
   QHBoxLayout *hbox2 = new QHBoxLayout;
@@ -336,8 +269,30 @@ KCollectdGui::KCollectdGui(QWidget *parent)
   hbox2->addWidget(auto_button);
 
   // signals
-  connect(listview_, SIGNAL(itemPressed(QTreeWidgetItem *, int)),
-          SLOT(startDrag(QTreeWidgetItem *, int)));
+  connect(listview_, SIGNAL(pressed(const QModelIndex &)),
+          SLOT(startDrag(const QModelIndex &)));
+  connect(tabs_, SIGNAL(currentChanged(int)), this, SLOT(showTab(int)));
+  connect(tabs_, SIGNAL(tabCloseRequested(int)), this, SLOT(closeTab(int)));
+  connect(tabs_, SIGNAL(tabBarDoubleClicked(int)), this, SLOT(renameTab(int)));
+  warm_timer = new QTimer(this);
+  warm_timer->setSingleShot(true);
+  warm_timer->setInterval(500);
+  connect(warm_timer, SIGNAL(timeout()), this, SLOT(warmTabs()));
+  // data is fetched when painted, the budget is checked periodically
+  memory_timer = new QTimer(this);
+  memory_timer->setInterval(2000);
+  connect(memory_timer, SIGNAL(timeout()), this, SLOT(releaseTabs()));
+  memory_timer->start();
+  memory_label = new QLabel;
+  statusBar()->addPermanentWidget(memory_label);
+  values_timer = new QTimer(this);
+  values_timer->setInterval(values_interval);
+  connect(values_timer, SIGNAL(timeout()), this, SLOT(updateValues()));
+  connect(side_, SIGNAL(currentChanged(int)), this, SLOT(showSide(int)));
+  connect(search_, SIGNAL(textChanged(const QString &)), this,
+          SLOT(search(const QString &)));
+  connect(results_, SIGNAL(itemPressed(QListWidgetItem *)),
+          SLOT(startSearchDrag(QListWidgetItem *)));
   connect(last_month, SIGNAL(clicked()), this, SLOT(last_month()));
   connect(last_week, SIGNAL(clicked()), this, SLOT(last_week()));
   connect(last_day, SIGNAL(clicked()), this, SLOT(last_day()));
@@ -351,12 +306,14 @@ KCollectdGui::KCollectdGui(QWidget *parent)
   menuBar()->addMenu(fileMenu);
   fileMenu->addAction(actionCollection()->action("open"));
   fileMenu->addAction(actionCollection()->action("save"));
+  fileMenu->addAction(actionCollection()->action("exportData"));
   fileMenu->addSeparator();
   fileMenu->addAction(actionCollection()->action("quit"));
 
   QMenu *editMenu = new QMenu(i18n("&Edit"));
   menuBar()->addMenu(editMenu);
   editMenu->addAction(actionCollection()->action("splitGraph"));
+  editMenu->addAction(actionCollection()->action("newTab"));
 
   QMenu *viewMenu = new QMenu(i18n("&View"));
   menuBar()->addMenu(viewMenu);
@@ -369,26 +326,106 @@ KCollectdGui::KCollectdGui(QWidget *parent)
   viewMenu->addAction(actionCollection()->action("lastMonth"));
   viewMenu->addSeparator();
   viewMenu->addAction(actionCollection()->action("autoUpdate"));
+  viewMenu->addAction(actionCollection()->action("liveUpdate"));
   viewMenu->addSeparator();
   viewMenu->addAction(actionCollection()->action("hideTree"));
+  viewMenu->addAction(actionCollection()->action("rescan"));
+  viewMenu->addSeparator();
+  viewMenu->addAction(actionCollection()->action("showTiming"));
+  viewMenu->addAction(actionCollection()->action("logTiming"));
 
   menuBar()->addMenu(mHelpMenu.menu());
 }
 
 KCollectdGui::~KCollectdGui() {}
 
-void KCollectdGui::startDrag(QTreeWidgetItem *widget, int /*col*/) {
+void KCollectdGui::startDrag(const QModelIndex &item) {
   //       if (event->button() == Qt::LeftButton
   // && iconLabel->geometry().contains(event->pos())) {
 
-  QDrag *drag = new QDrag(this);
+  const rrd_tree &tree = model_->tree();
+  const uint32_t id = model_->nodeId(item);
+  if (id == rrd_tree::none)
+    return;
+
   GraphMimeData *mimeData = new GraphMimeData;
+  if (tree.leaf(id)) {
+    const QString label = QString::fromUtf8(tree.label(id).c_str());
+    mimeData->setText(label);
+    mimeData->setGraph(QString::fromUtf8(tree.rrd(id).c_str()),
+                       QString::fromUtf8(tree.ds(id).c_str()), label);
+  } else {
+    // an inner node is dragged as aggregate of all its datasources
+    std::vector<GraphInfo::source> members;
+    collect_sources(tree, id, members);
+    if (members.empty()) {
+      delete mimeData;
+      return;
+    }
+    const QString node = QString::fromUtf8(tree.path(id).c_str());
+    mimeData->setText(node);
+    mimeData->setAggregate(node, members);
+  }
+
+  QDrag *drag = new QDrag(this);
+  drag->setMimeData(mimeData);
+  drag->setPixmap(QPixmap(drag_pixmap_xpm));
+  drag->exec();
+}
 
-  if (widget->text(1).isEmpty())
+/**
+ * show the datasources matching @a text instead of the tree
+ */
+void KCollectdGui::search(const QString &text) {
+  // more results are not helpful and slow down the list
+  const int max_results = 1000;
+
+  if (text.isEmpty()) {
+    results_->hide();
+    results_->clear();
+    listview_->show();
+    return;
+  }
+
+  trace_span trace("search", TRACE_DETAIL(text.toStdString()));
+  const std::vector<int> &ids = index.query(text.toStdString());
+
+  results_->setUpdatesEnabled(false);
+  results_->clear();
+  const int shown = std::min(int(ids.size()), max_results);
+  const rrd_tree &tree = model_->tree();
+  for (int i = 0; i < shown; ++i) {
+    const uint32_t id = index[ids[i]];
+    QListWidgetItem *item = new QListWidgetItem(
+        QString::fromUtf8(tree.title(id).c_str()), results_);
+    item->setData(Qt::UserRole, id);
+    item->setToolTip(QString::fromUtf8(tree.rrd(id).c_str()));
+  }
+  if (ids.empty() || shown < int(ids.size())) {
+    QListWidgetItem *item = new QListWidgetItem(
+        ids.empty() ? i18n("no match")
+                    : i18n("(%1 more)", int(ids.size()) - shown),
+        results_);
+    item->setFlags(Qt::NoItemFlags);
+  }
+  results_->setUpdatesEnabled(true);
+
+  listview_->hide();
+  results_->show();
+}
+
+void KCollectdGui::startSearchDrag(QListWidgetItem *item) {
+  if (!(item->flags() & Qt::ItemIsEnabled))
     return;
 
-  mimeData->setText(widget->text(1));
-  mimeData->setGraph(widget->text(2), widget->text(3), widget->text(1));
+  const rrd_tree &tree = model_->tree();
+  const uint32_t id = item->data(Qt::UserRole).toUInt();
+  const QString label = item->text();
+  QDrag *drag = new QDrag(this);
+  GraphMimeData *mimeData = new GraphMimeData;
+  mimeData->setText(label);
+  mimeData->setGraph(QString::fromUtf8(tree.rrd(id).c_str()),
+                     QString::fromUtf8(tree.ds(id).c_str()), label);
 
   drag->setMimeData(mimeData);
   drag->setPixmap(QPixmap(drag_pixmap_xpm));
@@ -399,17 +436,296 @@ void KCollectdGui::setRRDBaseDir(const QString &newrrdbasedir) {
   if (rrdbasedir.isEmpty()) {
     rrdbasedir = QString(newrrdbasedir);
     // build rrd-tree
-    get_rrds(rrdbasedir.toStdString(), listview());
+    index.clear();
+    model_->build(rrdbasedir.toStdString(), index);
   } 
   // XXX: silently fail on new unimplemented change of rrd base
 }
 
+/**
+ * scan the rrd-directory again and select the datasources of the
+ * patterns again
+ */
+void KCollectdGui::rescan() {
+  if (rrdbasedir.isEmpty())
+    return;
+
+  index.clear();
+  forget_layouts();
+  model_->build(rrdbasedir.toStdString(), index);
+  patterns.clear();
+  if (!search_->text().isEmpty())
+    search(search_->text());
+
+  for (int k = 0; k < tabs_->count(); ++k) {
+    Graph *g = tab(k);
+    bool changed = false;
+    for (GraphInfo &gi : *g)
+      changed |= resolve(gi);
+    if (changed)
+      g->reload();
+  }
+}
+
+/**
+ * select the datasources matching the patterns of @a gi
+ *
+ * returns true if the datasources of @a gi changed
+ */
+bool KCollectdGui::resolve(GraphInfo &gi) {
+  const rrd_tree &tree = model_->tree();
+  bool changed = false;
+  for (size_t k = 0; k < gi.selections().size(); ++k) {
+    std::vector<GraphInfo::datasource> found;
+    for (uint32_t id : patterns.resolve(tree, gi.selections()[k])) {
+      GraphInfo::datasource d;
+      d.rrd = QString::fromUtf8(tree.rrd(id).c_str());
+      d.ds = QString::fromUtf8(tree.ds(id).c_str());
+      d.label = QString::fromUtf8(tree.title(id).c_str());
+      found.push_back(d);
+    }
+    changed |= gi.resolve(k, found);
+  }
+  return changed;
+}
+
 void KCollectdGui::autoUpdate(bool t) {
   auto_button->setChecked(t);
   auto_action->setChecked(t);
   graph->autoUpdate(t);
 }
 
+/**
+ * receive collectds network-packets and lay them over the graph every
+ * second
+ *
+ * the samples are shown where the rrd-files have no data yet.
+ */
+void KCollectdGui::liveUpdate(bool t) {
+  live_action->setChecked(t);
+  if (t) {
+    QString error;
+    if (!live->listen(live_address, error)) {
+      KMessageBox::detailedSorry(
+          this, i18n("receiving from collectd at ‘%1’ failed.", live_address),
+          i18n("System message is: ‘%1’", error));
+      live_action->setChecked(false);
+      return;
+    }
+    graph->showLive(true);
+    autoUpdate(true);
+  } else {
+    live->close();
+    live_store::instance().clear();
+    graph->showLive(false);
+  }
+}
+
+void KCollectdGui::showTiming(bool t) { graph->showTiming(t); }
+
+/**
+ * current values are only polled while they are shown
+ */
+void KCollectdGui::showSide(int k) {
+  if (side_->widget(k) == values_) {
+    updateValues();
+    values_timer->start();
+  } else {
+    values_timer->stop();
+  }
+}
+
+/**
+ * poll the latest values from collectd, or from the rrd-files if
+ * collectd can't be asked
+ *
+ * they are read in another thread and shown by customEvent.
+ */
+void KCollectdGui::updateValues() {
+  values_reader.start(model_->tree(), this, values_event);
+}
+
+/**
+ * the current values are read
+ *
+ * while collectd can't be asked, the interval doubles up to five
+ * minutes, so the rrd-files are not all read every ten seconds.
+ */
+void KCollectdGui::customEvent(QEvent *event) {
+  if (event->type() != values_event) {
+    KMainWindow::customEvent(event);
+    return;
+  }
+  std::vector<current_value> values;
+  const bool asked = values_reader.take(values);
+  values_model->update(values);
+  values_timer->setInterval(
+      asked ? values_interval
+            : std::min(2 * values_timer->interval(), max_values_interval));
+}
+
+/**
+ * write the timing-statistics of the graph to stderr
+ */
+void KCollectdGui::logTiming() { graph->timing().summary(std::cerr); }
+
+Graph *KCollectdGui::tab(int k) const {
+  return static_cast<Graph *>(tabs_->widget(k));
+}
+
+Graph *KCollectdGui::addTab(const QString &label) {
+  Graph *g = new Graph;
+  tabs_->addTab(g, label);
+  recent.push_back(g);
+  return g;
+}
+
+void KCollectdGui::newTab() {
+  Graph *g = addTab(i18n("Tab %1", tabs_->count() + 1));
+  tabs_->setCurrentWidget(g);
+  tabs_changed = true;
+}
+
+/**
+ * remove tab @a k, the last tab is never removed
+ */
+void KCollectdGui::closeTab(int k) {
+  if (tabs_->count() < 2)
+    return;
+  Graph *g = tab(k);
+  recent.erase(std::find(recent.begin(), recent.end(), g));
+  tabs_->removeTab(k);
+  delete g;
+  tabs_changed = true;
+}
+
+void KCollectdGui::renameTab(int k) {
+  if (k < 0)
+    return;
+  bool ok;
+  const QString label = QInputDialog::getText(
+      this, i18n("Rename Tab"), i18n("Name:"), QLineEdit::Normal,
+      KLocalizedString::removeAcceleratorMarker(tabs_->tabText(k)), &ok);
+  if (ok && !label.isEmpty()) {
+    tabs_->setTabText(k, label);
+    tabs_changed = true;
+  }
+}
+
+/**
+ * tab @a k became visible
+ *
+ * only the tab shown follows automatic updates.  Data of the other
+ * tabs is fetched when idle and released again when it exceeds the
+ * memory budget.
+ */
+void KCollectdGui::showTab(int k) {
+  Graph *g = tab(k);
+  if (!g || g == graph)
+    return;
+
+  graph->autoUpdate(false);
+  graph->showLive(false);
+  graph = g;
+  graph->fullResolution();
+  graph->showTiming(timing_action->isChecked());
+  graph->showLive(live->listening());
+  graph->autoUpdate(auto_action->isChecked());
+
+  recent.erase(std::find(recent.begin(), recent.end(), g));
+  recent.insert(recent.begin(), g);
+  releaseTabs();
+  warm_timer->start();
+}
+
+/**
+ * fetch the data of one tab not shown, the most recently viewed first,
+ * as long as the data of all tabs fits into the budget
+ *
+ * the rrd-files are read in another thread, one tab at a time, the
+ * next is started once the last is done.
+ */
+void KCollectdGui::warmTabs() {
+  if (memoryUsed() >= memory_budget)
+    return;
+
+  for (Graph *g : recent) {
+    if (g != graph && !g->valid() && !g->empty()) {
+      if (!g->fetching())
+        g->warm();
+      warm_timer->start();
+      return;
+    }
+  }
+}
+
+/**
+ * bytes of all series and caches held, shared series counted once
+ */
+size_t KCollectdGui::memoryUsed() const {
+  size_t used = live_store::instance().memory();
+  for (const Graph *g : recent)
+    used += g->memory();
+  return used;
+}
+
+/**
+ * fit the data into the budget, the tab shown is kept
+ *
+ * the data of the tabs viewed least recently is reduced to the
+ * resolution it is drawn with first, then compressed and released if
+ * that is not enough.
+ */
+void KCollectdGui::releaseTabs() {
+  enum { downsample, pack, release, passes };
+  size_t used = memoryUsed();
+  for (int pass = downsample; pass < passes; ++pass) {
+    if (pass == pack && !pack_tabs)
+      continue;
+    for (std::vector<Graph *>::reverse_iterator i = recent.rbegin();
+         i != recent.rend() && used > memory_budget; ++i) {
+      if (*i == graph)
+        continue;
+      used -= (*i)->memory();
+      if (pass == downsample)
+        (*i)->downsample();
+      else if (pass == pack)
+        (*i)->pack();
+      else
+        (*i)->release();
+      used += (*i)->memory();
+    }
+  }
+  showMemory(used);
+}
+
+/**
+ * usage of the budget in the status-bar
+ */
+void KCollectdGui::showMemory(size_t used) {
+  memory_label->setText(i18n("Memory: %1 of %2 MiB",
+                             QString::number(used / 1048576.0, 'f', 1),
+                             qulonglong(memory_budget >> 20)));
+}
+
+/**
+ * true if the tabs or any graph changed since loading or saving
+ */
+bool KCollectdGui::changed() const {
+  if (tabs_changed)
+    return true;
+  for (int k = 0; k < tabs_->count(); ++k)
+    if (tab(k)->changed())
+      return true;
+  return false;
+}
+
+void KCollectdGui::changed(bool c) {
+  tabs_changed = c;
+  for (int k = 0; k < tabs_->count(); ++k)
+    tab(k)->changed(c);
+}
+
 void KCollectdGui::hideTree(bool t) {
   if (t) {
     treeSplitter_->setSizes({0,width()});
@@ -456,31 +772,107 @@ void KCollectdGui::save() {
   save(file);
 }
 
+/**
+ * write the datasources of the tab shown, in its window, to a file
+ *
+ * aggregates and expressions are written as their members.  The data
+ * is read from the rrd-files part by part, not from the graph.
+ */
+void KCollectdGui::exportData() {
+  std::vector<export_column> columns;
+  std::vector<std::string> files;
+  for (const GraphInfo &gi : *graph)
+    for (const GraphInfo::datasource &d : gi) {
+      if (d.aggregate == agg_none && d.expr.isEmpty()) {
+        columns.push_back({QFile::encodeName(d.rrd).toStdString(),
+                           d.ds.toStdString(), d.label.toStdString()});
+      } else {
+        for (const GraphInfo::source &m : d.members)
+          columns.push_back({QFile::encodeName(m.rrd).toStdString(),
+                             m.ds.toStdString(),
+                             (m.rrd + ':' + m.ds).toStdString()});
+      }
+    }
+  if (columns.empty())
+    return;
+
+  bool ok;
+  const QString cf = QInputDialog::getItem(
+      this, i18n("Export Data"), i18n("Consolidation function:"),
+      QStringList() << "AVERAGE" << "MIN" << "MAX", 0, false, &ok);
+  if (!ok)
+    return;
+  const QString file = QFileDialog::getSaveFileName(
+      this, i18n("Export Data"), QDir::homePath(),
+      i18n("CSV (*.csv);;Binary Columns (*.kcx)"));
+  if (file.isEmpty())
+    return;
+
+  for (const export_column &c : columns)
+    files.push_back(c.rrd);
+  const time_t start = graph->startTime(), end = start + graph->range();
+  rrdcached_client::instance().flush(files, end);
+
+  QApplication::setOverrideCursor(Qt::WaitCursor);
+  std::ofstream out(QFile::encodeName(file).constData(),
+                    std::ios::out | std::ios::binary);
+  ok = out && export_data(out, columns, cf.toLatin1().constData(), start, end,
+                          file.endsWith(".csv", Qt::CaseInsensitive)
+                              ? export_csv
+                              : export_binary);
+  QApplication::restoreOverrideCursor();
+  if (!ok)
+    KMessageBox::detailedSorry(this, i18n("exporting to ‘%1’ failed.", file),
+                               i18n("System message is: ‘%1’",
+                                    QString::fromLocal8Bit(strerror(errno))));
+}
+
 void KCollectdGui::load(const QString &file) {
   QFile in(file);
   if (in.open(QIODevice::ReadOnly)) {
     QDomDocument doc;
     doc.setContent(&in);
 
+    // the first tab is kept with its time-range and mode
+    tabs_->setCurrentIndex(0);
+    while (tabs_->count() > 1)
+      closeTab(tabs_->count() - 1);
     graph->clear();
 
+    int n = 0;
     QDomElement t = doc.documentElement().firstChildElement("tab");
     while (!t.isNull()) {
+      const QString label = t.attribute("label", i18n("Tab %1", n + 1));
+      Graph *target = n == 0 ? graph : addTab(label);
+      tabs_->setTabText(n++, label);
       QDomElement g = t.firstChildElement("graph");
       while (!g.isNull()) {
-        GraphInfo &graphinfo = graph->add();
+        GraphInfo &graphinfo = target->add();
+        graphinfo.top_n(g.attribute("top", "0").toInt());
+        graphinfo.rank_by(
+            rank_from_name(g.attribute("rank", "max").toStdString()));
+        graphinfo.show_other(g.attribute("other", "0").toInt() != 0);
         QDomElement p = g.firstChildElement("plot");
         while (!p.isNull()) {
-          graphinfo.add(p.attribute("rrd"), p.attribute("ds"),
-                        p.attribute("label"));
+          if (p.hasAttribute("aggregate"))
+            graphinfo.add(loadAggregate(p));
+          else if (p.hasAttribute("expression"))
+            graphinfo.add(loadExpression(p));
+          else if (!p.hasAttribute("rrd"))
+            loadSelection(p, graphinfo);
+          else
+            graphinfo.add(p.attribute("rrd"), p.attribute("ds"),
+                          p.attribute("label"));
           p = p.nextSiblingElement();
         }
+        resolve(graphinfo);
         g = g.nextSiblingElement();
       }
       t = t.nextSiblingElement();
     }
     filename = file;
-    graph->changed(false);
+    changed(false);
+    warm_timer->start();
   } else {
     KMessageBox::detailedSorry(
         this, i18n("reading file ‘%1’ failed.", filename),
@@ -488,6 +880,81 @@ void KCollectdGui::load(const QString &file) {
   }
 }
 
+/**
+ * read an aggregate from a <plot> element
+ *
+ * if the tree-node the members were taken from still exists, the
+ * members are taken from the tree again, so new datasources (e.g. more
+ * CPUs) are included.
+ */
+GraphInfo::datasource KCollectdGui::loadAggregate(const QDomElement &p) {
+  GraphInfo::datasource d;
+  d.aggregate = aggregate_from_name(p.attribute("aggregate").toStdString());
+  if (d.aggregate == agg_none)
+    d.aggregate = agg_mean;
+  d.percentile = p.attribute("percentile", "10").toDouble();
+  d.node = p.attribute("node");
+
+  const rrd_tree &tree = model_->tree();
+  const uint32_t id =
+      d.node.isEmpty() ? rrd_tree::none : tree.find(d.node.toStdString());
+  if (id != rrd_tree::none)
+    collect_sources(tree, id, d.members);
+  if (d.members.empty()) {
+    for (QDomElement m = p.firstChildElement("member"); !m.isNull();
+         m = m.nextSiblingElement("member"))
+      d.members.push_back({m.attribute("rrd"), m.attribute("ds")});
+  }
+
+  d.label = p.attribute("label");
+  if (d.label.isEmpty())
+    d.label = GraphInfo::aggregate_label(d);
+  return d;
+}
+
+/**
+ * read an expression and its variables from a <plot> element
+ */
+GraphInfo::datasource KCollectdGui::loadExpression(const QDomElement &p) {
+  GraphInfo::datasource d;
+  d.expr = p.attribute("expression");
+  for (QDomElement v = p.firstChildElement("var"); !v.isNull();
+       v = v.nextSiblingElement("var"))
+    d.members.push_back(
+        {v.attribute("rrd"), v.attribute("ds"), v.attribute("name")});
+  d.label = p.attribute("label", d.expr);
+
+  try {
+    GraphInfo::compile(d);
+  } catch (const expression_error &e) {
+    KMessageBox::detailedSorry(
+        this, i18n("The expression ‘%1’ is invalid.", d.expr),
+        i18n("Error at position %1: %2", int(e.position) + 1,
+             QString::fromUtf8(e.what())));
+  }
+  return d;
+}
+
+/**
+ * read a <plot> selecting datasources by patterns for host, plugin,
+ * type and ds, they are globs or with match="regex" regular expressions
+ */
+void KCollectdGui::loadSelection(const QDomElement &p, GraphInfo &gi) {
+  const bool regex = p.attribute("match") == "regex";
+  try {
+    gi.select(datasource_pattern(p.attribute("host").toStdString(),
+                                 p.attribute("plugin").toStdString(),
+                                 p.attribute("type").toStdString(),
+                                 p.attribute("ds").toStdString(), regex));
+  } catch (const std::regex_error &e) {
+    KMessageBox::detailedSorry(
+        this, i18n("A pattern of the plot ‘%1•%2•%3•%4’ is invalid.",
+                   p.attribute("host"), p.attribute("plugin"),
+                   p.attribute("type"), p.attribute("ds")),
+        QString::fromUtf8(e.what()));
+  }
+}
+
 void KCollectdGui::save(const QString &file) {
   QFile out(file);
   if (out.open(QIODevice::WriteOnly)) {
@@ -498,24 +965,73 @@ void KCollectdGui::save(const QString &file) {
                     "\"/usr/share/kcollectd/kcollectd.xsd\">");
 
     stream.writeStartElement("kcollectd");
-    stream.writeStartElement("tab");
-    for (Graph::const_iterator i = graph->begin(); i != graph->end(); ++i) {
-      stream.writeStartElement("graph");
-      for (GraphInfo::const_iterator j = i->begin(); j != i->end(); ++j) {
-        stream.writeStartElement("plot");
-        stream.writeAttribute("rrd", j->rrd);
-        stream.writeAttribute("ds", j->ds);
-        stream.writeAttribute("label", j->label);
+    for (int k = 0; k < tabs_->count(); ++k) {
+      stream.writeStartElement("tab");
+      stream.writeAttribute("label", KLocalizedString::removeAcceleratorMarker(
+                                         tabs_->tabText(k)));
+      const Graph *g = tab(k);
+      for (Graph::const_iterator i = g->begin(); i != g->end(); ++i) {
+        stream.writeStartElement("graph");
+        if (i->top_n() > 0) {
+          stream.writeAttribute("top", QString::number(i->top_n()));
+          stream.writeAttribute("rank", rank_name(i->rank_by()));
+          stream.writeAttribute("other", i->show_other() ? "1" : "0");
+        }
+        for (const datasource_pattern &sel : i->selections()) {
+          static const char *fields[] = {"host", "plugin", "type", "ds"};
+          stream.writeStartElement("plot");
+          for (int f = 0; f < datasource_pattern::fields; ++f) {
+            const std::string &text = sel.text(datasource_pattern::field(f));
+            if (!text.empty())
+              stream.writeAttribute(fields[f], QString::fromStdString(text));
+          }
+          if (sel.regex())
+            stream.writeAttribute("match", "regex");
+          stream.writeEndElement();
+        }
+        for (GraphInfo::const_iterator j = i->begin(); j != i->end(); ++j) {
+          if (j->selection >= 0)
+            continue;
+          stream.writeStartElement("plot");
+          if (j->aggregate != agg_none) {
+            stream.writeAttribute("label", j->label);
+            stream.writeAttribute("aggregate", aggregate_name(j->aggregate));
+            if (j->aggregate == agg_percentile)
+              stream.writeAttribute("percentile",
+                                    QString::number(j->percentile));
+            stream.writeAttribute("node", j->node);
+            for (const GraphInfo::source &m : j->members) {
+              stream.writeStartElement("member");
+              stream.writeAttribute("rrd", m.rrd);
+              stream.writeAttribute("ds", m.ds);
+              stream.writeEndElement();
+            }
+          } else if (!j->expr.isEmpty()) {
+            stream.writeAttribute("label", j->label);
+            stream.writeAttribute("expression", j->expr);
+            for (const GraphInfo::source &m : j->members) {
+              stream.writeStartElement("var");
+              stream.writeAttribute("name", m.name);
+              stream.writeAttribute("rrd", m.rrd);
+              stream.writeAttribute("ds", m.ds);
+              stream.writeEndElement();
+            }
+          } else {
+            stream.writeAttribute("rrd", j->rrd);
+            stream.writeAttribute("ds", j->ds);
+            stream.writeAttribute("label", j->label);
+          }
+          stream.writeEndElement();
+        }
         stream.writeEndElement();
       }
       stream.writeEndElement();
     }
     stream.writeEndElement();
-    stream.writeEndElement();
 
     stream.writeEndDocument();
     filename = file;
-    graph->changed(false);
+    changed(false);
   } else {
     KMessageBox::detailedSorry(
         this, i18n("opening the file ‘%1’ for writing failed.", filename),
@@ -524,10 +1040,13 @@ void KCollectdGui::save(const QString &file) {
 }
 
 void KCollectdGui::saveProperties(KConfigGroup &conf) {
+  for (int k = 0; k < tabs_->count(); ++k)
+    tab(k)->remember();
   conf.writeEntry("hide-navigation", panel_action->isChecked());
   conf.writeEntry("auto-update", graph->autoUpdate());
   conf.writeEntry("range", qint64(graph->range()));
-  if (!graph->changed() && !filename.isEmpty()) {
+  conf.writeEntry("tab", tabs_->currentIndex());
+  if (!changed() && !filename.isEmpty()) {
     conf.writeEntry("filename", QDir().absoluteFilePath(filename));
     conf.writeEntry("file-is-session", false);
   } else {
@@ -542,25 +1061,49 @@ void KCollectdGui::saveProperties(KConfigGroup &conf) {
     conf.writeEntry("filename", file);
     conf.writeEntry("file-is-session", true);
   }
+
+  // the tab shown, drawn at once when restored
+  const QString dir =
+      QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+  char hostname[100];
+  gethostname(hostname, sizeof(hostname));
+  const QString snapshot =
+      QString("%1/snapshot-%2-%3.png").arg(dir).arg(hostname).arg(getpid());
+  if (QDir().mkpath(dir) && graph->saveSnapshot(snapshot)) {
+    conf.writeEntry("snapshot", snapshot);
+  } else {
+    conf.deleteEntry("snapshot");
+  }
 }
 
 void KCollectdGui::readProperties(const KConfigGroup &conf) {
   bool nav = conf.readEntry("hide-navigation", false);
   bool aut = conf.readEntry("auto-update", false);
   time_t range = conf.readEntry("range", 24 * 3600);
+  int current = conf.readEntry("tab", 0);
   QString file = conf.readEntry("filename", QString());
   bool file_is_session = conf.readEntry("file-is-session", false);
   if (!file.isEmpty()) {
     load(file);
     if (file_is_session) {
       QFile::remove(file);
-      graph->changed(true);
+      tabs_changed = true;
     } else {
       filename = file;
     }
   }
   panel_action->setChecked(nav);
   hideTree(nav);
+  if (tab(current))
+    tabs_->setCurrentIndex(current);
   autoUpdate(aut);
   graph->last(range);
+
+  // the snapshot is of the tab shown when saved
+  const QString snapshot = conf.readEntry("snapshot", QString());
+  if (!snapshot.isEmpty()) {
+    if (tabs_->currentIndex() == current)
+      graph->showSnapshot(snapshot);
+    QFile::remove(snapshot);
+  }
 }
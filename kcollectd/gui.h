@@ -27,16 +27,27 @@
 #include <KHelpMenu>
 #include <kactioncollection.h>
 
+#include "current_values.h"
 #include "graph.h"
+#include "search_index.h"
 
+class QDomElement;
 class QLabel;
+class QLineEdit;
+class QListWidget;
+class QListWidgetItem;
 class Graph;
 class QSplitter;
-class QTreeWidget;
-class QTreeWidgetItem;
+class QTabWidget;
+class QTimer;
+class QModelIndex;
+class QTableView;
+class QTreeView;
+class RRDTreeModel;
 class QVBoxLayout;
 class QAction;
 class QPushButton;
+class LiveListener;
 
 class KCollectdGui : public KMainWindow // QWidget
 {
@@ -46,16 +57,28 @@ public:
   KCollectdGui(QWidget *parent = 0);
   virtual ~KCollectdGui();
 
-  QTreeWidget *listview() { return listview_; }
+  QTreeView *listview() { return listview_; }
   KActionCollection *actionCollection() { return &action_collection; }
 
   void set(Graph *graph);
   void setRRDBaseDir(const QString &newrrdbasedir);
+  // budget for all series and caches, in bytes
+  void setMemoryBudget(size_t bytes) { memory_budget = bytes; }
+  // compress the data of tabs not shown before releasing it
+  void setPackTabs(bool pack) { pack_tabs = pack; }
+  // [host]:port to receive collectd network-packets on
+  void setLiveAddress(const QString &address) { live_address = address; }
+  // socket of collectds unixsock-plugin for the current values
+  void setUnixSock(const std::string &path) {
+    values_reader.unixsock().address(path);
+  }
   void load(const QString &filename);
   void save(const QString &filename);
 
 public slots:
-  void startDrag(QTreeWidgetItem *widget, int col);
+  void startDrag(const QModelIndex &item);
+  void startSearchDrag(QListWidgetItem *item);
+  void search(const QString &text);
   virtual void last_month();
   virtual void last_week();
   virtual void last_day();
@@ -63,23 +86,68 @@ public slots:
   virtual void zoomIn();
   virtual void zoomOut();
   virtual void autoUpdate(bool active);
+  virtual void liveUpdate(bool active);
   virtual void hideTree(bool active);
   virtual void resizeTree(int pot, int);
   virtual void splitGraph();
+  virtual void newTab();
+  virtual void closeTab(int k);
+  virtual void renameTab(int k);
+  virtual void showTab(int k);
+  virtual void warmTabs();
+  virtual void releaseTabs();
+  virtual void showTiming(bool active);
+  virtual void showSide(int k);
+  virtual void updateValues();
+  virtual void logTiming();
+  virtual void rescan();
   virtual void load();
   virtual void save();
+  virtual void exportData();
 
 protected:
+  virtual void customEvent(QEvent *event) override;
   virtual void saveProperties(KConfigGroup &) override;
   virtual void readProperties(const KConfigGroup &) override;
 
 private:
-  QTreeWidget *listview_;
+  GraphInfo::datasource loadAggregate(const QDomElement &p);
+  GraphInfo::datasource loadExpression(const QDomElement &p);
+  void loadSelection(const QDomElement &p, GraphInfo &gi);
+  bool resolve(GraphInfo &gi);
+  Graph *tab(int k) const;
+  Graph *addTab(const QString &label);
+  size_t memoryUsed() const;
+  void showMemory(size_t used);
+  bool changed() const;
+  void changed(bool c);
+
+  QTreeView *listview_;
+  RRDTreeModel *model_;
+  QLineEdit *search_;
+  QListWidget *results_;
+  QTabWidget *side_;
+  QTableView *values_;
+  CurrentValuesModel *values_model;
+  QTimer *values_timer;
+  current_values_reader values_reader;
+  search_index index;
+  pattern_cache patterns;
   QSplitter *treeSplitter_;
   QVBoxLayout *vbox;
-  Graph *graph;
+  Graph *graph; // of the tab shown
+  QTabWidget *tabs_;
+  QTimer *warm_timer;
+  std::vector<Graph *> recent; // tabs, most recently viewed first
+  size_t memory_budget;
+  bool pack_tabs;
+  QTimer *memory_timer;
+  QLabel *memory_label;
+  bool tabs_changed;
+  LiveListener *live;
+  QString live_address;
   QPushButton *auto_button;
-  QAction *auto_action, *panel_action;
+  QAction *auto_action, *live_action, *panel_action, *timing_action;
   QString filename;
   QString rrdbasedir;
   KHelpMenu mHelpMenu;
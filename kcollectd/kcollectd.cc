@@ -18,16 +18,23 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
 #include <exception>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <set>
 #include <string>
 
 #include <boost/filesystem.hpp>
 
 #include <QApplication>
 #include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
 #include <QStringList>
-#include <QTreeWidgetItem>
 
 #include <KAboutData>
 #include <KLocalizedString>
@@ -35,13 +42,135 @@
 
 #include "../config.h"
 
+#include "export.h"
 #include "gui.h"
+#include "rrd_interface.h"
+#include "rrdcached.h"
+#include "series_cache.h"
+#include "trace.h"
+
+/**
+ * a time given as seconds since the epoch, as ISO-date or as -<n> with
+ * one of s, m, h, d, w, y before @a now, -1 if it is none of these
+ */
+static time_t parse_time(const QString &text, time_t now) {
+  bool ok;
+  if (text.startsWith('-')) {
+    static const struct {
+      char unit;
+      time_t seconds;
+    } units[] = {{'s', 1},
+                 {'m', 60},
+                 {'h', 3600},
+                 {'d', 24 * 3600},
+                 {'w', 7 * 24 * 3600},
+                 {'y', 365 * 24 * 3600}};
+    time_t m = 1;
+    QString n = text.mid(1);
+    for (const auto &u : units)
+      if (n.endsWith(u.unit)) {
+        m = u.seconds;
+        n.chop(1);
+        break;
+      }
+    const qint64 v = n.toLongLong(&ok);
+    return ok ? now - v * m : -1;
+  }
+  const qint64 v = text.toLongLong(&ok);
+  if (ok)
+    return v;
+  const QDateTime d = QDateTime::fromString(text, Qt::ISODate);
+  return d.isValid() ? d.toMSecsSinceEpoch() / 1000 : -1;
+}
+
+/**
+ * write the datasources given by --series to --export, without showing
+ * the gui
+ *
+ * a series is <rrd-file>[:<ds>], all datasources of the file without
+ * <ds>.  Relative files are taken from @a basedir.
+ */
+static int run_export(const QString &file, const QStringList &series,
+                      const QString &basedir, const QString &from,
+                      const QString &to, const QString &cf,
+                      const QString &format) {
+  const time_t now = time(0);
+  const time_t start = parse_time(from, now), end = parse_time(to, now);
+  if (start < 0 || end < 0 || end <= start) {
+    std::cerr << "invalid time-range ‘" << from.toStdString() << "’ to ‘"
+              << to.toStdString() << "’" << std::endl;
+    return 1;
+  }
+  if (cf != "AVERAGE" && cf != "MIN" && cf != "MAX") {
+    std::cerr << "invalid consolidation-function ‘" << cf.toStdString()
+              << "’" << std::endl;
+    return 1;
+  }
+
+  std::vector<export_column> columns;
+  std::vector<std::string> files;
+  for (const QString &s : series) {
+    const int colon = s.lastIndexOf(':');
+    QString rrd = colon < 0 ? s : s.left(colon);
+    if (QDir::isRelativePath(rrd))
+      rrd = basedir + '/' + rrd;
+    const std::string path = QFile::encodeName(rrd).toStdString();
+    std::set<std::string> ds;
+    if (colon < 0)
+      get_dsinfo(path, ds);
+    else
+      ds.insert(s.mid(colon + 1).toStdString());
+    const std::string name = (colon < 0 ? s : s.left(colon)).toStdString();
+    for (const std::string &d : ds)
+      columns.push_back({path, d, name + ':' + d});
+    files.push_back(path);
+  }
+  if (columns.empty()) {
+    std::cerr << "nothing to export, give datasources with --series"
+              << std::endl;
+    return 1;
+  }
+  rrdcached_client::instance().flush(files, end);
+
+  const export_format f = format == "binary" ? export_binary : export_csv;
+  bool ok;
+  if (file == "-") {
+    ok = export_data(std::cout, columns, cf.toLatin1().constData(), start,
+                     end, f);
+  } else {
+    std::ofstream out(QFile::encodeName(file).constData(),
+                      std::ios::out | std::ios::binary);
+    ok = out && export_data(out, columns, cf.toLatin1().constData(), start,
+                            end, f);
+  }
+  if (!ok)
+    std::cerr << "exporting to ‘" << file.toStdString() << "’ failed"
+              << std::endl;
+  return ok ? 0 : 1;
+}
+
+/**
+ * true if --export is among the options of the command-line
+ *
+ * looked for before the application is made, as the export must not
+ * need a display.
+ */
+static bool exporting(int argc, char **argv) {
+  for (int k = 1; k < argc && strcmp(argv[k], "--") != 0; ++k)
+    if (strcmp(argv[k], "--export") == 0 ||
+        strncmp(argv[k], "--export=", 9) == 0)
+      return true;
+  return false;
+}
 
 int main(int argc, char **argv) {
   using namespace boost::filesystem;
 
   std::vector<std::string> rrds;
-  QApplication application(argc, argv);
+  // the export runs without a display, e.g. from cron or over ssh
+  std::unique_ptr<QCoreApplication> application(
+      exporting(argc, argv) ? new QCoreApplication(argc, argv)
+                            : new QApplication(argc, argv));
   KAboutData about(
       QStringLiteral("kcollectd"), i18n("KCollectd"), VERSION,
       i18n("Viewer for collectd databases"), KAboutLicense::GPL_V3,
@@ -68,20 +197,153 @@ int main(int argc, char **argv) {
                                    QString("rrdbase"),
                                    QString(RRD_BASEDIR));
 
+  QCommandLineOption traceOption(QStringList() << "trace",
+                                 i18n("Write a Chrome trace-event file of "
+                                      "internal timings to <tracefile> "
+                                      "(also set by KCOLLECTD_TRACE)"),
+                                 QString("tracefile"));
+
+  QCommandLineOption memoryOption(QStringList() << "memory" << "tab-memory",
+                                  i18n("Keep at most <MiB> of series and "
+                                       "caches in memory"),
+                                  QString("MiB"), QString("256"));
+
+  QCommandLineOption noPackOption(QStringList() << "no-compress",
+                                  i18n("Release the data of hidden tabs "
+                                       "instead of compressing it"));
+
+  QCommandLineOption listenOption(QStringList() << "listen",
+                                  i18n("Show values collectd sends to "
+                                       "[<host>]:<port> live"),
+                                  QString("address"));
+
+  QCommandLineOption daemonOption(QStringList() << "d" << "daemon",
+                                  i18n("Flush rrdcached at <address> before "
+                                       "reading (also set by "
+                                       "RRDCACHED_ADDRESS)"),
+                                  QString("address"));
+
+  QCommandLineOption unixsockOption(QStringList() << "unixsock",
+                                    i18n("Read current values from collectds "
+                                         "unixsock-plugin at <socket>"),
+                                    QString("socket"),
+                                    QString("/var/run/collectd-unixsock"));
+
+  QCommandLineOption cacheOption(QStringList() << "cache",
+                                 i18n("Keep at most <MiB> of fetched data on "
+                                      "disk to show at the next start, 0 "
+                                      "disables it"),
+                                 QString("MiB"), QString("64"));
+
+  QCommandLineOption exportOption(QStringList() << "export",
+                                  i18n("Write the datasources given by "
+                                       "--series to <file> (- for stdout) "
+                                       "instead of showing them"),
+                                  QString("file"));
+
+  QCommandLineOption seriesOption(QStringList() << "series",
+                                  i18n("A datasource to export, all of the "
+                                       "file without <ds>"),
+                                  QString("rrd[:ds]"));
+
+  QCommandLineOption fromOption(QStringList() << "from",
+                                i18n("Start of the export, seconds since "
+                                     "the epoch, ISO-date or -<n>[smhdwy]"),
+                                QString("time"), QString("-1d"));
+
+  QCommandLineOption toOption(QStringList() << "to",
+                              i18n("End of the export, like --from"),
+                              QString("time"), QString("-0"));
+
+  QCommandLineOption cfOption(QStringList() << "cf",
+                              i18n("Consolidation function of the export, "
+                                   "AVERAGE, MIN or MAX"),
+                              QString("cf"), QString("AVERAGE"));
+
+  QCommandLineOption formatOption(QStringList() << "format",
+                                  i18n("Format of the export, csv or "
+                                       "binary"),
+                                  QString("format"), QString("csv"));
+
   parser.addOption(rrdbaseOption);
+  parser.addOption(traceOption);
+  parser.addOption(memoryOption);
+  parser.addOption(noPackOption);
+  parser.addOption(listenOption);
+  parser.addOption(daemonOption);
+  parser.addOption(unixsockOption);
+  parser.addOption(cacheOption);
+  parser.addOption(exportOption);
+  parser.addOption(seriesOption);
+  parser.addOption(fromOption);
+  parser.addOption(toOption);
+  parser.addOption(cfOption);
+  parser.addOption(formatOption);
   parser.addPositionalArgument("+[file]", i18n("A kcollectd-file to open"));
-  parser.process(application);
+  parser.process(*application);
+
+  // tracing, as early as possible to include scanning the rrd-tree
+  QString tracefile = parser.value(traceOption);
+  if (tracefile.isEmpty())
+    tracefile = QString::fromLocal8Bit(qgetenv("KCOLLECTD_TRACE"));
+  if (!tracefile.isEmpty())
+    tracer::start(QFile::encodeName(tracefile).toStdString());
+
+  QString daemon = parser.value(daemonOption);
+  if (daemon.isEmpty())
+    daemon = QString::fromLocal8Bit(qgetenv("RRDCACHED_ADDRESS"));
+  rrdcached_client::instance().address(QFile::encodeName(daemon).toStdString());
+
+  if (parser.isSet(exportOption)) {
+    const int result = run_export(
+        parser.value(exportOption), parser.values(seriesOption),
+        parser.value(rrdbaseOption), parser.value(fromOption),
+        parser.value(toOption), parser.value(cfOption),
+        parser.value(formatOption));
+    tracer::stop();
+    return result;
+  }
+  // --export only as the value of another option
+  QApplication *app = qobject_cast<QApplication *>(application.get());
+  if (!app) {
+    std::cerr << "no --export given" << std::endl;
+    return 1;
+  }
+
+  const QString cachedir =
+      QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+      "/series";
+  const uint64_t cache_size = parser.value(cacheOption).toULongLong() << 20;
+  if (cache_size && QDir().mkpath(cachedir))
+    series_cache::instance().open(QFile::encodeName(cachedir).toStdString(),
+                                  cache_size);
+
+  // the options of every window, new or restored
+  const auto configure = [&](KCollectdGui *gui) {
+    gui->setMemoryBudget(size_t(parser.value(memoryOption).toULong()) << 20);
+    gui->setPackTabs(!parser.isSet(noPackOption));
+    gui->setUnixSock(
+        QFile::encodeName(parser.value(unixsockOption)).toStdString());
+    if (parser.isSet(listenOption)) {
+      gui->setLiveAddress(parser.value(listenOption));
+      gui->liveUpdate(true);
+    }
+  };
 
   const QStringList args = parser.positionalArguments();
   try {
-    if (application.isSessionRestored()) {
+    if (app->isSessionRestored()) {
       kRestoreMainWindows<KCollectdGui>();
+      for (KMainWindow *w : KMainWindow::memberList())
+        if (KCollectdGui *gui = qobject_cast<KCollectdGui *>(w))
+          configure(gui);
     } else {
       KCollectdGui *gui = new KCollectdGui;
       gui->setRRDBaseDir(parser.value(rrdbaseOption));
       // handling arguments
       if (args.length() == 1)
         gui->load(args.at(0));
+      configure(gui);
       gui->setObjectName("kcollectd#");
       gui->show();
     }
@@ -89,8 +351,13 @@ int main(int argc, char **argv) {
     KMessageBox::error(0, i18n("Failed to read RRD tree at \'%1\' (change with --basedir)\n"
                                "Terminating.",
                                parser.value(rrdbaseOption)));
+    tracer::stop();
     exit(1);
   }
 
-  return application.exec();
+  const int result = app->exec();
+  if (!tracer::stop())
+    std::cerr << "writing trace-file ‘" << tracefile.toStdString()
+              << "’ failed" << std::endl;
+  return result;
 }
@@ -0,0 +1,126 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <functional>
+
+#include <KLocalizedString>
+
+#include "labelcache.h"
+#include "misc.h"
+
+enum { kind_number, kind_time, kind_sample };
+
+static inline uint64_t bits(double d) {
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  return u;
+}
+
+size_t label_cache::key_hash::operator()(const key &k) const {
+  size_t h = std::hash<uint64_t>()(k.value);
+  h ^= std::hash<uint64_t>()(k.extra) + 0x9e3779b97f4a7c15ULL + (h << 6) +
+       (h >> 2);
+  h ^= std::hash<const void *>()(k.format) + 0x9e3779b97f4a7c15ULL +
+       (h << 6) + (h >> 2);
+  return h ^ k.kind;
+}
+
+label_cache::label_cache(const QFont &font, size_t capacity)
+    : metrics(font), capacity(capacity) {
+  map.reserve(capacity);
+}
+
+/**
+ * set the font used for measuring, drops all labels if it changed
+ */
+void label_cache::setFont(const QFont &font) {
+  QFontMetrics m(font);
+  if (m == metrics)
+    return;
+  metrics = m;
+  map.clear();
+}
+
+const label_cache::entry &label_cache::insert(const key &k,
+                                              const QString &text) {
+  // a simple bound on the size: start over
+  if (map.size() >= capacity)
+    map.clear();
+  entry &e = map[k];
+  e.text = text;
+  e.width = text.isNull() ? 0 : metrics.horizontalAdvance(text);
+  return e;
+}
+
+const QByteArray &label_cache::translated(const char *format) {
+  std::unordered_map<const void *, QByteArray>::iterator i =
+      formats.find(format);
+  if (i != formats.end())
+    return i->second;
+  return formats[format] = i18n(format).toLatin1();
+}
+
+/**
+ * a number of the y-axis, formatted by si_format
+ */
+const label_cache::entry &label_cache::number(double value, int precision,
+                                              const char *prefix,
+                                              double magnitude) {
+  const key k = {kind_number + (precision << 2), bits(value), bits(magnitude),
+                 prefix};
+  map_type::const_iterator i = map.find(k);
+  if (i != map.end())
+    return i->second;
+
+  char buffer[64];
+  const size_t len =
+      si_format(buffer, sizeof(buffer), value, precision, prefix, magnitude);
+  return insert(k, QString::fromUtf8(buffer, len));
+}
+
+/**
+ * a time of the x-axis, @a format is translated before use
+ */
+const label_cache::entry &label_cache::time(time_t t, const struct tm &tm,
+                                            const char *format) {
+  const key k = {kind_time, uint64_t(t), 0, format};
+  map_type::const_iterator i = map.find(k);
+  if (i != map.end())
+    return i->second;
+
+  return insert(k, Qstrftime(translated(format), &tm));
+}
+
+/**
+ * a sample label in @a format to estimate the width of labels,
+ * translated like the labels of time
+ */
+const label_cache::entry &label_cache::sample(const char *format) {
+  const key k = {kind_sample, 0, 0, format};
+  map_type::const_iterator i = map.find(k);
+  if (i != map.end())
+    return i->second;
+
+  const time_t now = ::time(0);
+  struct tm tm;
+  localtime_r(&now, &tm);
+  return insert(k, Qstrftime(translated(format), &tm));
+}
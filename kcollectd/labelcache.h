@@ -0,0 +1,84 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LABELCACHE_H
+#define LABELCACHE_H
+
+#include <time.h>
+
+#include <cstdint>
+#include <unordered_map>
+
+#include <QFont>
+#include <QFontMetrics>
+#include <QString>
+
+/**
+ * cache of formatted axis-labels together with their width
+ *
+ * numbers are keyed by value, precision and SI-magnitude, times by
+ * time and format.  Formats are identified by their address, so they
+ * have to be static strings.  Once a label is cached, looking it up
+ * allocates nothing.
+ */
+class label_cache {
+public:
+  struct entry {
+    QString text;
+    int width;
+  };
+
+  explicit label_cache(const QFont &font, size_t capacity = 4096);
+
+  void setFont(const QFont &font);
+  void clear() { map.clear(); }
+
+  const entry &number(double value, int precision, const char *prefix,
+                      double magnitude);
+  const entry &time(time_t t, const struct tm &tm, const char *format);
+  const entry &sample(const char *format);
+
+private:
+  struct key {
+    int kind;
+    uint64_t value;
+    uint64_t extra;
+    const void *format;
+    bool operator==(const key &o) const {
+      return kind == o.kind && value == o.value && extra == o.extra &&
+             format == o.format;
+    }
+  };
+  struct key_hash {
+    size_t operator()(const key &k) const;
+  };
+  typedef std::unordered_map<key, entry, key_hash> map_type;
+
+  const entry &insert(const key &k, const QString &text);
+  const QByteArray &translated(const char *format);
+
+  QFontMetrics metrics;
+  size_t capacity;
+  map_type map;
+  std::unordered_map<const void *, QByteArray> formats;
+};
+
+#endif
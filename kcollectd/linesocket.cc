@@ -0,0 +1,142 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "linesocket.h"
+
+/**
+ * connect to the socket at @a address, unix:/path or /path
+ *
+ * sets errno and returns false on failure.
+ */
+bool line_socket::connect(const std::string &address) {
+  close();
+
+  std::string path = address;
+  if (path.compare(0, 5, "unix:") == 0)
+    path.erase(0, 5);
+
+  struct sockaddr_un sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  if (path.empty() || path[0] != '/' || path.size() >= sizeof(sa.sun_path)) {
+    errno = EINVAL;
+    return false;
+  }
+  path.copy(sa.sun_path, path.size());
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return false;
+  // don't hang the gui on a stuck daemon
+  struct timeval timeout = {5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  if (::connect(fd, reinterpret_cast<struct sockaddr *>(&sa), sizeof(sa))) {
+    const int error = errno;
+    close();
+    errno = error;
+    return false;
+  }
+  return true;
+}
+
+void line_socket::close() {
+  if (fd != -1)
+    ::close(fd);
+  fd = -1;
+  input.clear();
+}
+
+bool line_socket::send(const std::string &commands) {
+  for (size_t done = 0; done < commands.size();) {
+    ssize_t n = ::send(fd, commands.data() + done, commands.size() - done,
+                       MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+/**
+ * the next line of the answers without the newline
+ */
+bool line_socket::read_line(std::string &line) {
+  size_t nl;
+  while ((nl = input.find('\n')) == std::string::npos) {
+    char buffer[4096];
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      if (n == 0)
+        errno = ECONNRESET;
+      return false;
+    }
+    input.append(buffer, n);
+  }
+  line.assign(input, 0, nl);
+  input.erase(0, nl + 1);
+  return true;
+}
+
+/**
+ * the answer to one command, the lines following the status go to
+ * @a lines if it is not 0
+ */
+bool line_socket::read_answer(long &status, std::vector<std::string> *lines) {
+  std::string line;
+  if (!read_line(line))
+    return false;
+  status = strtol(line.c_str(), 0, 10);
+  if (lines)
+    lines->clear();
+  for (long k = 0; k < status; ++k) {
+    if (!read_line(line))
+      return false;
+    if (lines)
+      lines->push_back(line);
+  }
+  return true;
+}
+
+/**
+ * append @a s to @a out as a double-quoted argument
+ */
+void line_socket::quote(std::string &out, const std::string &s) {
+  out += '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  out += '"';
+}
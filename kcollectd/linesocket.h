@@ -0,0 +1,57 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LINESOCKET_H
+#define LINESOCKET_H
+
+#include <string>
+#include <vector>
+
+/**
+ * connection to a daemon speaking a line-based protocol on a unix
+ * socket, like rrdcached and collectds unixsock-plugin
+ *
+ * both answer every command with a status line "<status> <message>",
+ * a positive status is the number of lines following it.
+ */
+class line_socket {
+public:
+  line_socket() : fd(-1) {}
+  ~line_socket() { close(); }
+  line_socket(const line_socket &) = delete;
+  line_socket &operator=(const line_socket &) = delete;
+
+  bool connect(const std::string &address);
+  void close();
+  bool is_open() const { return fd != -1; }
+
+  bool send(const std::string &commands);
+  bool read_line(std::string &line);
+  bool read_answer(long &status, std::vector<std::string> *lines);
+
+  static void quote(std::string &out, const std::string &s);
+
+private:
+  int fd;
+  std::string input; // read, but not yet consumed
+};
+
+#endif
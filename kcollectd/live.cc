@@ -0,0 +1,357 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <QSocketNotifier>
+
+#include "live.h"
+#include "rrd_interface.h"
+#include "trace.h"
+
+/**
+ * the @a k-th value, counters as they are, not as rates
+ */
+double value_list::value(size_t k) const {
+  const unsigned char *v = values + 8 * k;
+  switch (types[k]) {
+  case gauge: {
+    // gauges are little-endian doubles
+    uint64_t bits = 0;
+    for (int i = 7; i >= 0; --i)
+      bits = bits << 8 | v[i];
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+  }
+  case derive:
+    return int64_t(get_be64(v));
+  case counter:
+  case absolute:
+    return get_be64(v);
+  default:
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+}
+
+/**
+ * host/plugin[-instance]/type[-instance], the path of the rrd-file
+ * collectd writes it to
+ */
+void value_list::identifier(std::string &id) const {
+  id.assign(host);
+  id += '/';
+  id += plugin;
+  if (!plugin_instance.empty()) {
+    id += '-';
+    id += plugin_instance;
+  }
+  id += '/';
+  id += type;
+  if (!type_instance.empty()) {
+    id += '-';
+    id += type_instance;
+  }
+}
+
+/**
+ * add the @a k-th value of @a vl
+ *
+ * counters and derives are turned into rates from the previous value,
+ * absolutes into rates over the interval, like rrdtool does.
+ */
+void live_series::add(const value_list &vl, size_t k) {
+  double v;
+  switch (vl.types[k]) {
+  case value_list::gauge:
+    v = vl.value(k);
+    break;
+  case value_list::counter:
+  case value_list::derive: {
+    const uint64_t raw = get_be64(vl.values + 8 * k);
+    const double dt = vl.time - last_time;
+    const uint64_t prev = last_raw;
+    const bool first = last_time == 0;
+    last_raw = raw;
+    last_time = vl.time;
+    if (first || dt <= 0)
+      return;
+    if (vl.types[k] == value_list::derive)
+      v = int64_t(raw - prev) / dt;
+    else if (raw < prev && prev < (uint64_t(1) << 32))
+      v = (raw + (uint64_t(1) << 32) - prev) / dt; // 32 bit wrap
+    else
+      v = (raw - prev) / dt;
+    break;
+  }
+  case value_list::absolute:
+    v = vl.interval > 0 ? vl.value(k) / vl.interval : vl.value(k);
+    break;
+  default:
+    return;
+  }
+
+  const sample s = {vl.time, v};
+  if (ring.size() < capacity) {
+    ring.push_back(s);
+  } else {
+    ring[head] = s;
+    head = (head + 1) % capacity;
+  }
+}
+
+/**
+ * @a in with the values after the last one known to the rrd-file
+ * replaced by the samples, consolidated by @a cf
+ *
+ * @a in starts at @a start with columns of @a step seconds like
+ * rrd_fetch returns them.  Returns false and leaves @a out alone if
+ * no sample falls into these columns.
+ */
+bool live_series::overlay(time_t start, unsigned long step,
+                          const std::vector<double> &in, const char *cf,
+                          std::vector<double> &out) const {
+  if (ring.empty() || step == 0)
+    return false;
+
+  size_t first = in.size();
+  while (first > 0 && std::isnan(in[first - 1]))
+    --first;
+  const size_t n = in.size() - first;
+  if (n == 0)
+    return false;
+
+  enum { avg, min, max } op = avg;
+  if (strcmp(cf, "MIN") == 0)
+    op = min;
+  else if (strcmp(cf, "MAX") == 0)
+    op = max;
+
+  std::vector<double> acc(n, 0.0);
+  std::vector<unsigned> count(n, 0);
+  for (const sample &s : ring) {
+    // column i holds (start + i * step, start + (i + 1) * step]
+    const double col = std::ceil((s.time - start) / step) - 1;
+    if (std::isnan(s.value) || col < first || col >= in.size())
+      continue;
+    const size_t c = size_t(col) - first;
+    if (count[c]++ == 0)
+      acc[c] = s.value;
+    else if (op == avg)
+      acc[c] += s.value;
+    else if (op == min)
+      acc[c] = std::min(acc[c], s.value);
+    else
+      acc[c] = std::max(acc[c], s.value);
+  }
+
+  bool any = false;
+  for (size_t c = 0; c < n; ++c)
+    any |= count[c] != 0;
+  if (!any)
+    return false;
+
+  out = in;
+  for (size_t c = 0; c < n; ++c)
+    if (count[c])
+      out[first + c] = op == avg ? acc[c] / count[c] : acc[c];
+  return true;
+}
+
+live_store &live_store::instance() {
+  static live_store store;
+  return store;
+}
+
+/**
+ * bytes of all samples held
+ */
+size_t live_store::memory() const {
+  size_t bytes = 0;
+  for (const auto &s : series) {
+    bytes += s.first.capacity();
+    for (const live_series &l : s.second)
+      bytes += sizeof(live_series) + l.memory();
+  }
+  return bytes;
+}
+
+/**
+ * add the values of a collectd network-packet
+ *
+ * returns the number of value-lists in it.
+ */
+size_t live_store::receive(const unsigned char *packet, size_t size) {
+  size_t lists = 0;
+  parse_collectd(packet, size, [&](const value_list &vl) {
+    vl.identifier(id);
+    std::vector<live_series> &values = series[id];
+    if (values.size() < vl.count)
+      values.resize(vl.count);
+    for (size_t k = 0; k < vl.count; ++k)
+      values[k].add(vl, k);
+    ++lists;
+  });
+  return lists;
+}
+
+/**
+ * the samples of datasource @a ds of @a rrd, 0 if none were received
+ */
+const live_series *live_store::find(const std::string &rrd,
+                                    const std::string &ds) {
+  if (series.empty())
+    return 0;
+
+  // the identifier is the last three components without .rrd
+  size_t e = rrd.size();
+  if (e > 4 && rrd.compare(e - 4, 4, ".rrd") == 0)
+    e -= 4;
+  size_t b = e;
+  for (int k = 0; k < 3; ++k)
+    if (b == 0 || (b = rrd.rfind('/', b - 1)) == std::string::npos)
+      return 0;
+  id.assign(rrd, b + 1, e - b - 1);
+
+  auto i = series.find(id);
+  if (i == series.end())
+    return 0;
+
+  std::string key = rrd;
+  key += '\0';
+  key += ds;
+  auto d = ds_index.find(key);
+  if (d == ds_index.end())
+    d = ds_index.emplace(key, get_dsindex(rrd, ds)).first;
+  if (d->second < 0 || size_t(d->second) >= i->second.size())
+    return 0;
+  return &i->second[d->second];
+}
+
+LiveListener::LiveListener(QObject *parent)
+    : QObject(parent), fd(-1), notifier(0), buffer(65536) {}
+
+LiveListener::~LiveListener() { close(); }
+
+/**
+ * listen on @a address, [host]:port or host, for collectd packets
+ *
+ * the port defaults to 25826, the host to all interfaces.  Multicast
+ * groups are joined.  Returns false with a message in @a error if the
+ * socket can't be bound.
+ */
+bool LiveListener::listen(const QString &address, QString &error) {
+  close();
+
+  QString host = address, port = "25826";
+  const int colon = address.lastIndexOf(':');
+  if (colon >= 0 && address.indexOf(':') == colon) {
+    host = address.left(colon);
+    port = address.mid(colon + 1);
+  } else if (address.startsWith('[')) {
+    const int bracket = address.indexOf(']');
+    host = address.mid(1, bracket - 1);
+    if (address.mid(bracket + 1).startsWith(':'))
+      port = address.mid(bracket + 2);
+  }
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE;
+  struct addrinfo *ai;
+  const std::string h = host.toStdString(), p = port.toStdString();
+  int status = getaddrinfo(h.empty() ? 0 : h.c_str(), p.c_str(), &hints, &ai);
+  if (status != 0) {
+    error = QString::fromLocal8Bit(gai_strerror(status));
+    return false;
+  }
+
+  for (struct addrinfo *a = ai; a && fd == -1; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                a->ai_protocol);
+    if (fd == -1)
+      continue;
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, a->ai_addr, a->ai_addrlen) == -1) {
+      error = QString::fromLocal8Bit(strerror(errno));
+      ::close(fd);
+      fd = -1;
+      continue;
+    }
+
+    // collectds default is the multicast group 239.192.74.66
+    if (a->ai_family == AF_INET) {
+      const sockaddr_in *sa = reinterpret_cast<sockaddr_in *>(a->ai_addr);
+      if (IN_MULTICAST(ntohl(sa->sin_addr.s_addr))) {
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr = sa->sin_addr;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+      }
+    } else if (a->ai_family == AF_INET6) {
+      const sockaddr_in6 *sa = reinterpret_cast<sockaddr_in6 *>(a->ai_addr);
+      if (IN6_IS_ADDR_MULTICAST(&sa->sin6_addr)) {
+        struct ipv6_mreq mreq;
+        mreq.ipv6mr_multiaddr = sa->sin6_addr;
+        mreq.ipv6mr_interface = 0;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq));
+      }
+    }
+  }
+  freeaddrinfo(ai);
+  if (fd == -1)
+    return false;
+
+  notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+  connect(notifier, SIGNAL(activated(int)), this, SLOT(readPackets()));
+  return true;
+}
+
+void LiveListener::close() {
+  delete notifier;
+  notifier = 0;
+  if (fd != -1)
+    ::close(fd);
+  fd = -1;
+}
+
+/**
+ * read all pending packets, each into the same buffer
+ */
+void LiveListener::readPackets() {
+  trace_span trace("LiveListener::readPackets");
+  live_store &store = live_store::instance();
+  ssize_t n;
+  while ((n = recv(fd, buffer.data(), buffer.size(), 0)) >= 0)
+    store.receive(buffer.data(), n);
+}
@@ -0,0 +1,231 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <time.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <QObject>
+#include <QString>
+
+class QSocketNotifier;
+
+/**
+ * one value-list of a collectd network-packet
+ *
+ * the strings point into the packet, the values are decoded by value().
+ */
+struct value_list {
+  std::string_view host, plugin, plugin_instance, type, type_instance;
+  double time;     // seconds since the epoch
+  double interval; // seconds
+  size_t count;    // number of values
+  const unsigned char *types, *values;
+
+  enum { counter = 0, gauge = 1, derive = 2, absolute = 3 };
+  double value(size_t k) const;
+  void identifier(std::string &id) const;
+};
+
+/**
+ * calls @a f with every value-list in the collectd binary-protocol
+ * packet @a p of @a size bytes
+ *
+ * returns false if the packet is malformed or encrypted, the
+ * value-lists up to the error have been passed then.
+ */
+template <class F>
+bool parse_collectd(const unsigned char *p, size_t size, F f);
+
+/**
+ * the latest samples of one value, as rates like in the rrd-files
+ */
+class live_series {
+public:
+  live_series() : head(0), last_raw(0), last_time(0) {}
+
+  void add(const value_list &vl, size_t k);
+  bool overlay(time_t start, unsigned long step, const std::vector<double> &in,
+               const char *cf, std::vector<double> &out) const;
+  size_t size() const { return ring.size(); }
+  size_t memory() const { return ring.capacity() * sizeof(sample); }
+
+  static const size_t capacity = 900;
+
+private:
+  struct sample {
+    double time, value;
+  };
+  std::vector<sample> ring; // grows up to capacity, then wraps at head
+  size_t head;
+  uint64_t last_raw; // previous counter for rates
+  double last_time;
+};
+
+/**
+ * samples received from collectd, by identifier and value-index
+ */
+class live_store {
+public:
+  static live_store &instance();
+
+  size_t receive(const unsigned char *packet, size_t size);
+  const live_series *find(const std::string &rrd, const std::string &ds);
+  bool empty() const { return series.empty(); }
+  size_t memory() const;
+  void clear() { series.clear(); }
+
+private:
+  live_store() {}
+
+  std::unordered_map<std::string, std::vector<live_series>> series;
+  std::unordered_map<std::string, int> ds_index; // rrd \0 ds to value-index
+  std::string id;                                // buffer for identifiers
+};
+
+/**
+ * receives collectd network-packets on a UDP-socket into live_store
+ */
+class LiveListener : public QObject {
+  Q_OBJECT
+
+public:
+  explicit LiveListener(QObject *parent = 0);
+  virtual ~LiveListener();
+
+  bool listen(const QString &address, QString &error);
+  void close();
+  bool listening() const { return fd != -1; }
+
+private slots:
+  void readPackets();
+
+private:
+  int fd;
+  QSocketNotifier *notifier;
+  std::vector<unsigned char> buffer;
+};
+
+/**
+ * 16 and 64 bit integers in network byte-order
+ */
+inline uint16_t get_be16(const unsigned char *p) { return p[0] << 8 | p[1]; }
+
+inline uint64_t get_be64(const unsigned char *p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; ++i)
+    v = v << 8 | p[i];
+  return v;
+}
+
+template <class F>
+bool parse_collectd(const unsigned char *p, size_t size, F f) {
+  enum {
+    part_host = 0x0000,
+    part_time = 0x0001,
+    part_plugin = 0x0002,
+    part_plugin_instance = 0x0003,
+    part_type = 0x0004,
+    part_type_instance = 0x0005,
+    part_values = 0x0006,
+    part_interval = 0x0007,
+    part_time_hr = 0x0008,
+    part_interval_hr = 0x0009,
+    part_encrypted = 0x0210
+  };
+
+  value_list vl = value_list();
+  const unsigned char *end = p + size;
+  while (end - p >= 4) {
+    const uint16_t type = get_be16(p);
+    const uint16_t length = get_be16(p + 2);
+    if (length < 4 || length > end - p)
+      return false;
+    const unsigned char *body = p + 4;
+    const size_t n = length - 4;
+    p += length;
+
+    switch (type) {
+    case part_host:
+    case part_plugin:
+    case part_plugin_instance:
+    case part_type:
+    case part_type_instance: {
+      // zero-terminated
+      if (n == 0 || body[n - 1] != 0)
+        return false;
+      std::string_view s(reinterpret_cast<const char *>(body), n - 1);
+      if (type == part_host)
+        vl.host = s;
+      else if (type == part_plugin)
+        vl.plugin = s;
+      else if (type == part_plugin_instance)
+        vl.plugin_instance = s;
+      else if (type == part_type)
+        vl.type = s;
+      else
+        vl.type_instance = s;
+      break;
+    }
+    case part_time:
+    case part_interval:
+    case part_time_hr:
+    case part_interval_hr: {
+      if (n != 8)
+        return false;
+      double v = get_be64(body);
+      if (type == part_time_hr || type == part_interval_hr)
+        v /= 1073741824.0; // 2^-30 seconds
+      if (type == part_time || type == part_time_hr)
+        vl.time = v;
+      else
+        vl.interval = v;
+      break;
+    }
+    case part_values:
+      if (n < 2)
+        return false;
+      vl.count = get_be16(body);
+      if (n != 2 + vl.count * 9)
+        return false;
+      vl.types = body + 2;
+      vl.values = vl.types + vl.count;
+      f(static_cast<const value_list &>(vl));
+      break;
+    case part_encrypted:
+      return false;
+    default:
+      // messages, severities, signatures
+      break;
+    }
+  }
+  return p == end;
+}
+
+#endif
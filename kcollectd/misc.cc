@@ -18,29 +18,31 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <charconv>
 #include <cmath>
-#include <iomanip>
+#include <cstring>
 #include <limits>
-#include <sstream>
 #include <string>
 
 #include <qstring.h>
 
 #include "misc.h"
 
+static const struct {
+  double factor;
+  const char *const si_char;
+} si_table[] = {
+    {1e-24, "y"}, {1e-21, "z"}, {1e-18, "a"}, {1e-15, "f"}, {1e-12, "p"},
+    {1e-9, "n"},  {1e-6, "µ"},  {1e-3, "m"},  {1, ""},      {1e3, "k"},
+    {1e6, "M"},   {1e9, "G"},   {1e12, "T"},  {1e15, "P"},  {1e18, "E"},
+    {1e21, "Z"},  {1e24, "Y"},
+};
+
 /**
- * determine the appropriate SI-prefix for a number
+ * index of the appropriate SI-prefix in si_table, -1 if there is none
  */
-bool si_char(double d, std::string &s, double &m) {
-  const struct {
-    double factor;
-    const char *const si_char;
-  } si_table[] = {
-      {1e-24, "y"}, {1e-21, "z"}, {1e-18, "a"}, {1e-15, "f"}, {1e-12, "p"},
-      {1e-9, "n"},  {1e-6, "µ"},  {1e-3, "m"},  {1, ""},      {1e3, "k"},
-      {1e6, "M"},   {1e9, "G"},   {1e12, "T"},  {1e15, "P"},  {1e18, "E"},
-      {1e21, "Z"},  {1e24, "Y"},
-  };
+static int si_index(double d) {
   const int tablesize = sizeof(si_table) / sizeof(*si_table);
 
   int i;
@@ -48,27 +50,70 @@ bool si_char(double d, std::string &s, double &m) {
     if (d < si_table[i].factor)
       break;
   }
-  if (i == 0 || i == tablesize) {
+  if (i == 0 || i == tablesize)
+    return -1;
+  return i - 1;
+}
+
+/**
+ * determine the appropriate SI-prefix for a number
+ */
+bool si_char(double d, std::string &s, double &m) {
+  const int i = si_index(d);
+  if (i < 0) {
     m = 1.0;
     s = "";
     return false;
   } else {
-    --i;
     m = si_table[i].factor;
     s = si_table[i].si_char;
     return true;
   }
 }
 
+/**
+ * determine the appropriate SI-prefix for a number
+ *
+ * like si_char, but returns a static string.
+ */
+const char *si_prefix(double d, double &m) {
+  const int i = si_index(d);
+  m = i < 0 ? 1.0 : si_table[i].factor;
+  return i < 0 ? "" : si_table[i].si_char;
+}
+
 /**
  * formats a number with prefix s and magnitude m, precision p
  */
 std::string si_number(double d, int p, const std::string &s, double m) {
-  std::ostringstream os;
-  os << std::setprecision(p) << d / m;
-  if (!s.empty())
-    os << " " << s;
-  return os.str();
+  char buffer[64];
+  const size_t len = si_format(buffer, sizeof(buffer), d, p, s.c_str(), m);
+  return std::string(buffer, len);
+}
+
+/**
+ * formats a number with prefix s and magnitude m, precision p into
+ * @a buffer without allocating memory
+ *
+ * the result is like printf's %g, independent of the locale.  Returns
+ * the length of the result, which is truncated to @a size - 1.
+ */
+size_t si_format(char *buffer, size_t size, double d, int p, const char *s,
+                 double m) {
+  if (!size)
+    return 0;
+  char *const last = buffer + size - 1;
+  std::to_chars_result r =
+      std::to_chars(buffer, last, d / m, std::chars_format::general, p);
+  char *end = r.ec == std::errc() ? r.ptr : buffer;
+  if (*s && end < last) {
+    *end++ = ' ';
+    const size_t n = std::min<size_t>(strlen(s), last - end);
+    memcpy(end, s, n);
+    end += n;
+  }
+  *end = 0;
+  return end - buffer;
 }
 
 /**
@@ -182,5 +227,85 @@ Range range_max(const Range &a, const Range &b) {
   return r;
 }
 
+/**
+ * maximum of ranges of a vector in O(1) after O(n log n) setup
+ */
+class range_max_table {
+public:
+  explicit range_max_table(const std::vector<int> &v) : log(v.size() + 1, 0) {
+    const size_t n = v.size();
+    for (size_t i = 2; i <= n; ++i)
+      log[i] = log[i / 2] + 1;
+    table.push_back(v);
+    for (size_t k = 1; (size_t(1) << k) <= n; ++k) {
+      const std::vector<int> &prev = table.back();
+      const size_t half = size_t(1) << (k - 1);
+      std::vector<int> cur(n - 2 * half + 1);
+      for (size_t i = 0; i < cur.size(); ++i)
+        cur[i] = std::max(prev[i], prev[i + half]);
+      table.push_back(cur);
+    }
+  }
+  // maximum of [l, r)
+  int operator()(size_t l, size_t r) const {
+    const int k = log[r - l];
+    return std::max(table[k][l], table[k][r - (size_t(1) << k)]);
+  }
+
+private:
+  std::vector<int> log;
+  std::vector<std::vector<int>> table;
+};
+
+/**
+ * smallest number of rows for a legend, so that its columns fit into
+ * @a width
+ *
+ * the legend is filled column by column with entries of @a widths,
+ * columns are as wide as their widest entry and separated by @a gap.
+ * Returns the number of entries if no number of rows fits.  Testing r
+ * rows costs n/r maximum-queries, so this is O(n log n) overall.
+ */
+int legend_rows(const std::vector<int> &widths, int gap, int width) {
+  const int n = widths.size();
+  if (n == 0)
+    return 0;
+
+  const range_max_table range_max(widths);
+  int r;
+  for (r = 1; r < n; ++r) {
+    const int cols = (n + r - 1) / r;
+    int total_width = gap * (cols - 1);
+    for (int c = 0; c < cols && total_width <= width; ++c)
+      total_width += range_max(c * r, std::min(n, (c + 1) * r));
+    if (total_width <= width)
+      break;
+  }
+  return r;
+}
+
+/**
+ * number of entries of a legend with @a rows rows, whose columns fit
+ * into @a width
+ */
+int legend_shown(const std::vector<int> &widths, int rows, int gap,
+                 int width) {
+  const int n = widths.size();
+  if (rows <= 0)
+    return 0;
+
+  int total_width = 0, shown = 0;
+  for (int l = 0; l < n; l += rows) {
+    const int r = std::min(n, l + rows);
+    const int column =
+        *std::max_element(widths.begin() + l, widths.begin() + r);
+    total_width += (l ? gap : 0) + column;
+    if (total_width > width)
+      break;
+    shown = r;
+  }
+  return shown;
+}
+
 // definition of NaN in Range
 const double Range::NaN = std::numeric_limits<double>::quiet_NaN();
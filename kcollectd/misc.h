@@ -27,8 +27,13 @@
 
 bool si_char(double d, std::string &s, double &m);
 
+const char *si_prefix(double d, double &m);
+
 std::string si_number(double d, int p, const std::string &s, double m);
 
+size_t si_format(char *buffer, size_t size, double d, int p, const char *s,
+                 double m);
+
 QString Qstrftime(const char *format, const tm *t);
 
 /**
@@ -76,4 +81,8 @@ Range range_adj(const Range &range, double *base);
 
 Range range_max(const Range &a, const Range &b);
 
+int legend_rows(const std::vector<int> &widths, int gap, int width);
+
+int legend_shown(const std::vector<int> &widths, int rows, int gap, int width);
+
 #endif
@@ -0,0 +1,194 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "packed_series.h"
+
+/*
+ * codes, per value:
+ *   0                         same as the previous value
+ *   10  <bits>                XOR fits into the previous window
+ *   110 <lead:5> <len:6> <bits>  new window of len (0 is 64) bits
+ *   111 <run-1:10>            run of NaN
+ * the previous value is the last one not NaN, 0 at a block-start.
+ */
+
+namespace {
+
+const unsigned run_bits = 10;
+static_assert(packed_series::block_size == 1 << run_bits,
+              "a run of NaN fills at most a block");
+
+class bit_writer {
+public:
+  explicit bit_writer(std::vector<uint64_t> &w) : words(w), pos(0) {}
+
+  void put(uint64_t v, unsigned n) {
+    if (n == 0)
+      return;
+    if (n < 64)
+      v &= (uint64_t(1) << n) - 1;
+    const unsigned used = pos % 64;
+    if (used == 0)
+      words.push_back(0);
+    const unsigned room = 64 - used;
+    if (n <= room) {
+      words.back() |= v << (room - n);
+    } else {
+      words.back() |= v >> (n - room);
+      words.push_back(v << (64 - (n - room)));
+    }
+    pos += n;
+  }
+  size_t position() const { return pos; }
+
+private:
+  std::vector<uint64_t> &words;
+  size_t pos;
+};
+
+class bit_reader {
+public:
+  bit_reader(const std::vector<uint64_t> &w, size_t p) : words(w), pos(p) {}
+
+  uint64_t get(unsigned n) {
+    if (n == 0)
+      return 0;
+    const size_t word = pos / 64;
+    const unsigned used = pos % 64;
+    uint64_t v = (words[word] << used) >> (64 - n);
+    if (n > 64 - used)
+      v |= words[word + 1] >> (128 - used - n);
+    pos += n;
+    return v;
+  }
+  bool bit() { return get(1); }
+
+private:
+  const std::vector<uint64_t> &words;
+  size_t pos;
+};
+
+inline uint64_t to_bits(double d) {
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  return u;
+}
+
+inline double from_bits(uint64_t u) {
+  double d;
+  memcpy(&d, &u, sizeof(d));
+  return d;
+}
+
+} // namespace
+
+packed_series::packed_series(const std::vector<double> &data)
+    : size_(data.size()) {
+  bit_writer out(bits);
+  for (size_t b = 0; b < data.size(); b += block_size) {
+    offsets.push_back(out.position());
+    const size_t end = std::min(data.size(), b + block_size);
+    uint64_t prev = 0;
+    unsigned lead = 0, len = 0; // window, none yet
+    for (size_t i = b; i < end;) {
+      if (std::isnan(data[i])) {
+        size_t run = 1;
+        while (i + run < end && std::isnan(data[i + run]))
+          ++run;
+        out.put(7, 3);
+        out.put(run - 1, run_bits);
+        i += run;
+        continue;
+      }
+
+      const uint64_t u = to_bits(data[i++]);
+      const uint64_t x = u ^ prev;
+      prev = u;
+      if (x == 0) {
+        out.put(0, 1);
+        continue;
+      }
+      const unsigned l = std::min(31, __builtin_clzll(x));
+      const unsigned t = __builtin_ctzll(x);
+      if (len && l >= lead && 64 - lead - len <= t) {
+        out.put(2, 2);
+        out.put(x >> (64 - lead - len), len);
+      } else {
+        lead = l;
+        len = 64 - l - t;
+        out.put(6, 3);
+        out.put(lead, 5);
+        out.put(len & 63, 6);
+        out.put(x >> t, len);
+      }
+    }
+  }
+  bits.shrink_to_fit();
+  offsets.shrink_to_fit();
+}
+
+size_t packed_series::memory() const {
+  return bits.capacity() * sizeof(uint64_t) +
+         offsets.capacity() * sizeof(size_t);
+}
+
+/**
+ * decode block @a k to @a out, which takes up to block_size values
+ */
+void packed_series::decode_block(size_t k, double *out) const {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const size_t n = std::min(block_size, size_ - k * block_size);
+  bit_reader in(bits, offsets[k]);
+  uint64_t prev = 0;
+  unsigned lead = 0, len = 0;
+  for (size_t i = 0; i < n;) {
+    if (in.bit()) {
+      if (!in.bit()) {
+        // 10: previous window
+        prev ^= in.get(len) << (64 - lead - len);
+      } else if (!in.bit()) {
+        // 110: new window
+        lead = in.get(5);
+        len = in.get(6);
+        if (len == 0)
+          len = 64;
+        prev ^= in.get(len) << (64 - lead - len);
+      } else {
+        // 111: NaN-run
+        const size_t run = in.get(run_bits) + 1;
+        std::fill_n(out + i, run, nan);
+        i += run;
+        continue;
+      }
+    }
+    out[i++] = from_bits(prev);
+  }
+}
+
+void packed_series::unpack(std::vector<double> &out) const {
+  out.resize(size_);
+  for (size_t k = 0; k < blocks(); ++k)
+    decode_block(k, out.data() + k * block_size);
+}
@@ -0,0 +1,57 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKED_SERIES_H
+#define PACKED_SERIES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * a series of doubles compressed without loss
+ *
+ * values are XOR-ed with the previous one and only the bits that
+ * differ are stored (as in Facebooks Gorilla), runs of NaN by their
+ * length.  Blocks of block_size values are coded independently and
+ * can be decoded one at a time.  All NaN decode to the quiet NaN.
+ */
+class packed_series {
+public:
+  static constexpr size_t block_size = 1024;
+
+  packed_series() : size_(0) {}
+  explicit packed_series(const std::vector<double> &data);
+
+  size_t size() const { return size_; }
+  size_t blocks() const { return offsets.size(); }
+  size_t memory() const;
+
+  void decode_block(size_t k, double *out) const;
+  void unpack(std::vector<double> &out) const;
+
+private:
+  std::vector<uint64_t> bits;
+  std::vector<size_t> offsets; // bit-position of every block
+  size_t size_;
+};
+
+#endif
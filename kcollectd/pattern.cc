@@ -0,0 +1,131 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pattern.h"
+#include "rrdtree.h"
+#include "trace.h"
+
+/**
+ * glob-matching of the whole string @a s with @a p (* and ?)
+ */
+bool glob_match(const char *s, const char *p) {
+  const char *star = 0, *retry = 0;
+  while (*s) {
+    if (*p == '*') {
+      star = ++p;
+      retry = s;
+    } else if (*p == '?' || *p == *s) {
+      ++p;
+      ++s;
+    } else if (star) {
+      p = star;
+      s = ++retry;
+    } else {
+      return false;
+    }
+  }
+  while (*p == '*')
+    ++p;
+  return !*p;
+}
+
+/**
+ * throws std::regex_error if @a regex is set and a pattern is invalid
+ */
+datasource_pattern::datasource_pattern(const std::string &host,
+                                       const std::string &plugin,
+                                       const std::string &type,
+                                       const std::string &ds, bool regex)
+    : text_{host, plugin, type, ds}, regex_(regex) {
+  if (regex_)
+    for (int f = 0; f < fields; ++f)
+      if (!text_[f].empty())
+        compiled[f].assign(text_[f]);
+}
+
+/**
+ * identifies the pattern, equal patterns have equal keys
+ */
+std::string datasource_pattern::key() const {
+  std::string k(regex_ ? "r" : "g");
+  for (int f = 0; f < fields; ++f) {
+    k += '\0';
+    k += text_[f];
+  }
+  return k;
+}
+
+bool datasource_pattern::matches(field f, const std::string &name) const {
+  if (text_[f].empty())
+    return true;
+  if (regex_)
+    return std::regex_match(name, compiled[f]);
+  return glob_match(name.c_str(), text_[f].c_str());
+}
+
+/**
+ * all leafs of @a tree matching, in the order of the nodes
+ *
+ * names are interned, so every distinct name is matched only once.
+ */
+void datasource_pattern::resolve(const rrd_tree &tree,
+                                 std::vector<uint32_t> &leaves) const {
+  trace_span trace("datasource_pattern::resolve");
+
+  // verdicts by interned string: -1 not yet matched, 0 no, 1 yes
+  std::vector<signed char> verdict[fields];
+  for (int f = 0; f < fields; ++f)
+    verdict[f].assign(text_[f].empty() ? 0 : tree.strings(), -1);
+  auto match = [&](field f, uint32_t s) {
+    if (text_[f].empty())
+      return true;
+    signed char &v = verdict[f][s];
+    if (v < 0)
+      v = matches(f, tree.interned(s));
+    return v > 0;
+  };
+
+  leaves.clear();
+  for (uint32_t id = 0; id < tree.size(); ++id) {
+    if (!tree.leaf(id))
+      continue;
+    const rrd_tree::node &n = tree[id];
+    if (match(host, n.host) && match(plugin, n.dir) &&
+        match(type, tree.type(id)) && match(ds, n.ds))
+      leaves.push_back(id);
+  }
+}
+
+/**
+ * the leafs of @a tree matching @a pattern, resolved on the first call
+ *
+ * has to be cleared when the tree is rebuilt.
+ */
+const std::vector<uint32_t> &
+pattern_cache::resolve(const rrd_tree &tree,
+                       const datasource_pattern &pattern) {
+  const std::string key = pattern.key();
+  auto i = resolved.find(key);
+  if (i == resolved.end()) {
+    i = resolved.emplace(key, std::vector<uint32_t>()).first;
+    pattern.resolve(tree, i->second);
+  }
+  return i->second;
+}
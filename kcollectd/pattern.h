@@ -0,0 +1,78 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class rrd_tree;
+
+bool glob_match(const char *s, const char *p);
+
+/**
+ * selects datasources by patterns for host, plugin-directory, type
+ * (the rrd-file without .rrd) and datasource
+ *
+ * patterns are globs (* and ?) or, if regex is set, regular
+ * expressions; both have to match the whole name.  An empty pattern
+ * matches everything.
+ */
+class datasource_pattern {
+public:
+  enum field { host, plugin, type, ds, fields };
+
+  datasource_pattern() : regex_(false) {}
+  datasource_pattern(const std::string &host, const std::string &plugin,
+                     const std::string &type, const std::string &ds,
+                     bool regex);
+
+  const std::string &text(field f) const { return text_[f]; }
+  bool regex() const { return regex_; }
+  std::string key() const;
+
+  bool matches(field f, const std::string &name) const;
+  void resolve(const rrd_tree &tree, std::vector<uint32_t> &leaves) const;
+
+private:
+  std::string text_[fields];
+  std::regex compiled[fields];
+  bool regex_;
+};
+
+/**
+ * the leafs matching a pattern, resolved once per tree
+ */
+class pattern_cache {
+public:
+  const std::vector<uint32_t> &resolve(const rrd_tree &tree,
+                                       const datasource_pattern &pattern);
+  void clear() { resolved.clear(); }
+
+private:
+  std::unordered_map<std::string, std::vector<uint32_t>> resolved;
+};
+
+#endif
@@ -23,47 +23,53 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <rrd.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "rrd_interface.h"
+#include "trace.h"
 
 /**
- * wrapper for rrd_info taking a string instead of char*
+ * wrapper for rrd_info_r taking a string instead of char*
  *
- * copying the filename is probably unnecessary, but the signature of
- * rrd_info does not guarantee leaving it alone.
+ * rrd_info_r is the reentrant form of rrd_info, files are read from
+ * the gui-thread and from fetch-threads at once.  Older versions of
+ * librrd take a char*, so the filename is copied.
  */
-static inline rrd_info_t *rrd_info(int, const std::string &filename) {
-  char *c_file = (char *)malloc(sizeof(char)*(filename.length() + 1));
-  if (!c_file)
-    return NULL;
-  filename.copy(c_file, std::string::npos);
-  c_file[filename.length()] = 0;
-  char *arg[] = {0, c_file, 0};
-  rrd_info_t *result = rrd_info(2, arg);
-  free(c_file);
-  return result;
+static inline rrd_info_t *rrd_info_r(const std::string &filename) {
+  std::vector<char> c_file(filename.begin(), filename.end());
+  c_file.push_back(0);
+  return rrd_info_r(c_file.data());
 }
 
 /**
  * read the datasources-names of a rrd
  *
- * using rrd_info
+ * using rrd_info_r
  */
 void get_dsinfo(const std::string &rrdfile, std::set<std::string> &list) {
   using namespace std;
+  trace_span trace("get_dsinfo", TRACE_DETAIL(rrdfile));
 
   list.clear();
 
-  rrd_info_t *infos = rrd_info(2, rrdfile);
+  rrd_info_t *infos = rrd_info_r(rrdfile);
   rrd_info_t *i = infos;
   while (i) {
     string line(i->key);
@@ -81,41 +87,488 @@ void get_dsinfo(const std::string &rrdfile, std::set<std::string> &list) {
 }
 
 /**
- * gets data from a rrd
+ * the index of the datasource @a ds in @a rrdfile, -1 if it has none
  *
- * @a start and @a end may get changed from this function and represent
- * the start and end of the data returned.
+ * the index is the position of the value in collectds value-lists.
  */
-void get_rrd_data(const std::string &file, const std::string &ds, time_t *start,
-                  time_t *end, unsigned long *step, const char *type,
-                  std::vector<double> *result) {
-  unsigned long ds_cnt = 0;
-  char **ds_name;
-  rrd_value_t *data;
-  int status;
+int get_dsindex(const std::string &rrdfile, const std::string &ds) {
+  trace_span trace("get_dsindex", TRACE_DETAIL(rrdfile));
 
-  result->clear();
+  const std::string key = "ds[" + ds + "].index";
+  int index = -1;
+  rrd_info_t *infos = rrd_info_r(rrdfile);
+  for (rrd_info_t *i = infos; i; i = i->next)
+    if (i->type == RD_I_CNT && key == i->key)
+      index = i->value.u_cnt;
+  if (infos)
+    rrd_info_free(infos);
+  return index;
+}
 
-  status = rrd_fetch_r(file.c_str(), type, start, end, step, &ds_cnt, &ds_name,
-                       &data);
-  if (status != 0) {
-    return;
+namespace {
+
+struct rra_info {
+  std::string cf;
+  unsigned long rows = 0, pdp_per_row = 0;
+};
+
+/**
+ * the archives of a rrd-file, read once
+ *
+ * only what doesn't change with updates, the last update and the rows
+ * written last are read from the file when needed.  A file made again,
+ * e.g. with other datasources, is another inode or has another size.
+ */
+struct rrd_layout {
+  dev_t dev = 0;
+  ino_t ino = 0;
+  off_t size = 0;
+  unsigned long step = 0;
+  unsigned long header_size = 0, ds_cnt = 0;
+  std::vector<std::string> ds_names; // by index
+  std::vector<rra_info> rras;
+};
+
+typedef std::shared_ptr<const rrd_layout> layout_ptr;
+
+std::mutex layout_mutex;
+std::unordered_map<std::string, layout_ptr> layouts;
+
+/**
+ * true if @a st is the file @a l was read from
+ */
+bool same_file(const rrd_layout &l, const struct stat &st) {
+  return l.dev == st.st_dev && l.ino == st.st_ino && l.size == st.st_size;
+}
+
+/**
+ * true if the file open as @a fd is the one @a l was read from
+ */
+bool same_file(const rrd_layout &l, int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 && same_file(l, st);
+}
+
+layout_ptr read_layout(const std::string &rrdfile, const struct stat &st) {
+  trace_span trace("read_layout", TRACE_DETAIL(rrdfile));
+
+  std::shared_ptr<rrd_layout> l = std::make_shared<rrd_layout>();
+  l->dev = st.st_dev;
+  l->ino = st.st_ino;
+  l->size = st.st_size;
+  rrd_info_t *infos = rrd_info_r(rrdfile);
+  for (rrd_info_t *i = infos; i; i = i->next) {
+    unsigned k;
+    char field[32];
+    if (strcmp(i->key, "step") == 0 && i->type == RD_I_CNT) {
+      l->step = i->value.u_cnt;
+    } else if (strcmp(i->key, "header_size") == 0 && i->type == RD_I_CNT) {
+      l->header_size = i->value.u_cnt;
+    } else if (strncmp(i->key, "ds[", 3) == 0 && i->type == RD_I_CNT &&
+               strstr(i->key, "].index")) {
+      const char *name = i->key + 3;
+      const size_t k = i->value.u_cnt;
+      if (k >= l->ds_names.size())
+        l->ds_names.resize(k + 1);
+      l->ds_names[k].assign(name, strstr(name, "].index") - name);
+      ++l->ds_cnt;
+    } else if (sscanf(i->key, "rra[%u].%31s", &k, field) == 2) {
+      if (k >= l->rras.size())
+        l->rras.resize(k + 1);
+      if (strcmp(field, "cf") == 0 && i->type == RD_I_STR)
+        l->rras[k].cf = i->value.u_str;
+      else if (strcmp(field, "rows") == 0 && i->type == RD_I_CNT)
+        l->rras[k].rows = i->value.u_cnt;
+      else if (strcmp(field, "pdp_per_row") == 0 && i->type == RD_I_CNT)
+        l->rras[k].pdp_per_row = i->value.u_cnt;
+    }
   }
+  if (infos)
+    rrd_info_free(infos);
+  return l;
+}
 
-  const unsigned long length = (*end - *start) / *step;
+/**
+ * the layout of @a rrdfile, 0 if it can't be read
+ *
+ * read again if the file was made again since.
+ */
+layout_ptr get_layout(const std::string &rrdfile) {
+  struct stat st;
+  if (stat(rrdfile.c_str(), &st) != 0)
+    return layout_ptr();
+  {
+    std::lock_guard<std::mutex> lock(layout_mutex);
+    auto i = layouts.find(rrdfile);
+    if (i != layouts.end() && same_file(*i->second, st))
+      return i->second;
+  }
+  layout_ptr l = read_layout(rrdfile, st);
+  if (!l->step)
+    return layout_ptr();
+  std::lock_guard<std::mutex> lock(layout_mutex);
+  layouts[rrdfile] = l;
+  return l;
+}
 
-  for (unsigned int i = 0; i < ds_cnt; ++i) {
-    if (ds != ds_name[i]) {
-      free(ds_name[i]);
+/**
+ * the finest archive of @a cf still holding @a start at the last
+ * update @a last, the coarsest if none does, -1 if there is none of
+ * @a cf
+ */
+int pick_rra(const rrd_layout &l, const char *cf, time_t start,
+             time_t last) {
+  int best = -1, coarsest = -1;
+  unsigned long best_step = 0, coarsest_step = 0;
+  for (size_t k = 0; k < l.rras.size(); ++k) {
+    const rra_info &r = l.rras[k];
+    if (r.cf != cf)
       continue;
+    const unsigned long s = l.step * r.pdp_per_row;
+    if (s > coarsest_step) {
+      coarsest = k;
+      coarsest_step = s;
     }
+    if (last - time_t(s * r.rows) <= start && (best < 0 || s < best_step)) {
+      best = k;
+      best_step = s;
+    }
+  }
+  return best >= 0 ? best : coarsest;
+}
+
+/**
+ * position of the rows of archive @a k in the file
+ *
+ * the archives follow the header one after the other, a row holds a
+ * double of every datasource.  0 if the header-size is unknown.
+ */
+off_t rra_offset(const rrd_layout &l, int k) {
+  if (!l.header_size || k < 0)
+    return 0;
+  off_t offset = l.header_size;
+  for (int j = 0; j < k; ++j)
+    offset += off_t(l.rras[j].rows) * l.ds_cnt * sizeof(rrd_value_t);
+  return offset;
+}
+
+/**
+ * the row of the last update of every archive of the file open as
+ * @a fd
+ *
+ * they are the last field of the header, rra_ptr, an unsigned long
+ * each.
+ */
+bool read_cur_rows(int fd, const rrd_layout &l,
+                   std::vector<unsigned long> &rows) {
+  rows.assign(l.rras.size(), 0);
+  const size_t size = rows.size() * sizeof(unsigned long);
+  if (!l.header_size || l.header_size < size)
+    return false;
+  return pread(fd, rows.data(), size, l.header_size - size) == ssize_t(size);
+}
 
-    for (unsigned int n = 0; n < length; ++n)
-      result->push_back(data[n * ds_cnt + i]);
-    break;
+/**
+ * ask the kernel to read the rows of archive @a k from @a start to
+ * @a end of the file open as @a fd ahead
+ *
+ * an archive is a ring, @a cur_row is the row of the last update
+ * @a last and moves on by a row every step, so the row of a time
+ * follows from both.  The window may wrap around the end of the ring.
+ */
+void advise(int fd, const rrd_layout &l, int k, time_t start, time_t end,
+            time_t last, unsigned long cur_row) {
+  const off_t base = rra_offset(l, k);
+  if (!base || !l.ds_cnt)
+    return;
+  const rra_info &r = l.rras[k];
+  const long long s = l.step * r.pdp_per_row;
+  if (!r.rows || !s || cur_row >= r.rows)
+    return;
+  const long long rows = r.rows;
+  const long long n = std::min(rows, (end - start) / s + 2);
+  const long long first =
+      ((long long)(cur_row) - (last - last % s - start) / s % rows + rows) %
+      rows;
+  const off_t row_size = l.ds_cnt * sizeof(rrd_value_t);
 
+  const long long tail = std::min(n, rows - first);
+  posix_fadvise(fd, base + first * row_size, tail * row_size,
+                POSIX_FADV_WILLNEED);
+  if (n > tail)
+    posix_fadvise(fd, base, (n - tail) * row_size, POSIX_FADV_WILLNEED);
+}
+
+/**
+ * all datasources of a file as rrd_fetch returned them, row by row
+ */
+struct rrd_block {
+  time_t start, end;
+  unsigned long step;
+  std::vector<std::string> names;
+  std::vector<double> data;
+};
+
+typedef std::shared_ptr<const rrd_block> block_ptr;
+
+block_ptr read_block(const std::string &file, const char *cf, time_t start,
+                     time_t end, unsigned long step) {
+  trace_span trace("rrd_fetch", TRACE_DETAIL(file + " " + cf));
+
+  unsigned long ds_cnt = 0;
+  char **ds_name;
+  rrd_value_t *data;
+  std::shared_ptr<rrd_block> b = std::make_shared<rrd_block>();
+  b->start = start;
+  b->end = end;
+  b->step = step;
+  if (rrd_fetch_r(file.c_str(), cf, &b->start, &b->end, &b->step, &ds_cnt,
+                  &ds_name, &data) != 0)
+    return block_ptr();
+
+  const unsigned long length = (b->end - b->start) / b->step;
+  for (unsigned long i = 0; i < ds_cnt; ++i) {
+    b->names.push_back(ds_name[i]);
     free(ds_name[i]);
   }
   free(ds_name);
+  b->data.assign(data, data + length * ds_cnt);
   free(data);
+  return b;
+}
+
+// reads running, waited for by everyone asking for the same
+std::mutex flight_mutex;
+std::unordered_map<std::string, std::shared_future<block_ptr>> in_flight;
+
+/**
+ * the block of @a file and @a cf from @a start to @a end
+ *
+ * rrd_fetch always reads all datasources.  Asking for a window of a
+ * file while it is read waits for that read instead of reading it
+ * again.
+ */
+block_ptr fetch_block(const std::string &file, const char *cf, time_t start,
+                      time_t end, unsigned long step) {
+  std::string key = file;
+  key += '\0';
+  key += cf;
+  key += '\0';
+  key.append(reinterpret_cast<const char *>(&start), sizeof(start));
+  key.append(reinterpret_cast<const char *>(&end), sizeof(end));
+  key.append(reinterpret_cast<const char *>(&step), sizeof(step));
+
+  std::promise<block_ptr> promise;
+  std::shared_future<block_ptr> running;
+  {
+    std::lock_guard<std::mutex> lock(flight_mutex);
+    auto i = in_flight.find(key);
+    if (i != in_flight.end())
+      running = i->second;
+    else
+      in_flight.emplace(key, promise.get_future().share());
+  }
+  if (running.valid()) {
+    trace_span trace("rrd_fetch shared", TRACE_DETAIL(file + " " + cf));
+    return running.get();
+  }
+
+  block_ptr b = read_block(file, cf, start, end, step);
+  {
+    std::lock_guard<std::mutex> lock(flight_mutex);
+    in_flight.erase(key);
+  }
+  promise.set_value(b);
+  return b;
+}
+
+/**
+ * the column of @a ds in @a b
+ */
+void extract(const block_ptr &b, const std::string &ds, time_t *start,
+             time_t *end, unsigned long *step, std::vector<double> *result) {
+  result->clear();
+  if (!b)
+    return;
+  *start = b->start;
+  *end = b->end;
+  *step = b->step;
+
+  const size_t ds_cnt = b->names.size();
+  const size_t i =
+      std::find(b->names.begin(), b->names.end(), ds) - b->names.begin();
+  if (i == ds_cnt)
+    return;
+  const size_t length = b->data.size() / ds_cnt;
+  result->reserve(length);
+  for (size_t n = 0; n < length; ++n)
+    result->push_back(b->data[n * ds_cnt + i]);
+}
+
+} // namespace
+
+/**
+ * forget the layouts of all files read, e.g. after the files were
+ * looked for again
+ */
+void forget_layouts() {
+  std::lock_guard<std::mutex> lock(layout_mutex);
+  layouts.clear();
+}
+
+/**
+ * the time of the last update of @a rrdfile
+ *
+ * read from the file every time, it moves on with every update.  Now
+ * if the file can't be read.
+ */
+time_t get_last_update(const std::string &rrdfile) {
+  const time_t last = rrd_last_r(rrdfile.c_str());
+  return last > 0 ? last : time(0);
+}
+
+/**
+ * the step of the finest archive of consolidation-function @a cf in
+ * @a rrdfile still holding @a start, the coarsest if none does
+ *
+ * rrd_fetch picks this archive for a window from @a start on, asking
+ * for it keeps the step of windows fetched in parts the same.  The
+ * archives of a file are read once, the last update every time.
+ * Returns 0 if the file can't be read.
+ */
+unsigned long get_resolution(const std::string &rrdfile, const char *cf,
+                             time_t start) {
+  const layout_ptr l = get_layout(rrdfile);
+  if (!l)
+    return 0;
+  const int k = pick_rra(*l, cf, start, get_last_update(rrdfile));
+  return k < 0 ? 0 : l->step * l->rras[k].pdp_per_row;
+}
+
+/**
+ * gets data from a rrd
+ *
+ * @a start and @a end may get changed from this function and represent
+ * the start and end of the data returned.
+ */
+void get_rrd_data(const std::string &file, const std::string &ds, time_t *start,
+                  time_t *end, unsigned long *step, const char *type,
+                  std::vector<double> *result) {
+  extract(fetch_block(file, type, *start, *end, *step), ds, start, end, step,
+          result);
+}
+
+/**
+ * gets the data of all @a requests
+ *
+ * requests of the same file, consolidation-function and window are
+ * read at once.  The reads are sorted by file and position of the
+ * archive in it, and the kernel is asked to read ahead all of them
+ * before the first, so reading from a cold cache mostly goes forward.
+ */
+void get_rrd_data(std::vector<rrd_request> &requests) {
+  trace_span trace("get_rrd_data",
+                  TRACE_DETAIL(std::to_string(requests.size())));
+
+  struct group {
+    const rrd_request *first;
+    layout_ptr layout;
+    time_t last;
+    int rra;
+    off_t offset;
+    std::vector<rrd_request *> requests;
+  };
+  std::vector<group> reads;
+  std::unordered_map<std::string, size_t> index;
+  for (rrd_request &r : requests) {
+    std::string key = r.file;
+    key += '\0';
+    key += r.cf;
+    key += '\0';
+    key.append(reinterpret_cast<const char *>(&r.start), sizeof(r.start));
+    key.append(reinterpret_cast<const char *>(&r.end), sizeof(r.end));
+    key.append(reinterpret_cast<const char *>(&r.step), sizeof(r.step));
+    auto i = index.emplace(key, reads.size());
+    if (i.second) {
+      group g{&r, get_layout(r.file), 0, -1, 0, {}};
+      if (g.layout) {
+        g.last = get_last_update(r.file);
+        g.rra = pick_rra(*g.layout, r.cf, r.start, g.last);
+        g.offset = rra_offset(*g.layout, g.rra);
+      }
+      reads.push_back(std::move(g));
+    }
+    reads[i.first->second].requests.push_back(&r);
+  }
+
+  std::sort(reads.begin(), reads.end(), [](const group &a, const group &b) {
+    if (a.first->file != b.first->file)
+      return a.first->file < b.first->file;
+    return a.offset < b.offset;
+  });
+
+  for (size_t k = 0; k < reads.size();) {
+    const std::string &file = reads[k].first->file;
+    const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    std::vector<unsigned long> cur_rows;
+    const bool ok = fd >= 0 && reads[k].layout &&
+                    same_file(*reads[k].layout, fd) &&
+                    read_cur_rows(fd, *reads[k].layout, cur_rows);
+    for (; k < reads.size() && reads[k].first->file == file; ++k)
+      if (ok && reads[k].rra >= 0)
+        advise(fd, *reads[k].layout, reads[k].rra, reads[k].first->start,
+               reads[k].first->end, reads[k].last, cur_rows[reads[k].rra]);
+    if (fd >= 0)
+      close(fd);
+  }
+
+  for (const group &g : reads) {
+    const rrd_request &f = *g.first;
+    const block_ptr b = fetch_block(f.file, f.cf, f.start, f.end, f.step);
+    for (rrd_request *r : g.requests)
+      extract(b, r->ds, &r->start, &r->end, &r->step, r->result);
+  }
+}
+
+/**
+ * the latest value of every datasource of @a file
+ *
+ * reads only the row of the last update of the finest average-archive
+ * at its place in the file, not rrd_fetch for a window.  Datasources
+ * unknown in that row get NaN.
+ */
+bool get_last_values(const std::string &file, std::vector<std::string> &names,
+                     std::vector<double> &values) {
+  trace_span trace("get_last_values", TRACE_DETAIL(file));
+
+  names.clear();
+  values.clear();
+  const layout_ptr l = get_layout(file);
+  if (!l || !l->ds_cnt || l->ds_names.size() != l->ds_cnt)
+    return false;
+  int k = -1;
+  for (size_t j = 0; j < l->rras.size(); ++j)
+    if (l->rras[j].cf == "AVERAGE" &&
+        (k < 0 || l->rras[j].pdp_per_row < l->rras[k].pdp_per_row))
+      k = j;
+  const off_t base = rra_offset(*l, k);
+  if (!base)
+    return false;
+
+  const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  std::vector<unsigned long> cur_rows;
+  std::vector<double> row(l->ds_cnt);
+  const size_t size = row.size() * sizeof(rrd_value_t);
+  const bool ok = same_file(*l, fd) && read_cur_rows(fd, *l, cur_rows) &&
+                  cur_rows[k] < l->rras[k].rows &&
+                  pread(fd, row.data(), size, base + cur_rows[k] * size) ==
+                      ssize_t(size);
+  close(fd);
+  if (!ok)
+    return false;
+  names = l->ds_names;
+  values.swap(row);
+  return true;
 }
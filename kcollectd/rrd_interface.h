@@ -26,14 +26,38 @@
 #ifndef RRD_INTERAFCE_H
 #define RRD_INTERAFCE_H
 
+#include <time.h>
+
 #include <set>
 #include <string>
 #include <vector>
 
 void get_dsinfo(const std::string &rrdfile, std::set<std::string> &list);
+int get_dsindex(const std::string &rrdfile, const std::string &ds);
+time_t get_last_update(const std::string &rrdfile);
+void forget_layouts();
+unsigned long get_resolution(const std::string &rrdfile, const char *cf,
+                             time_t start);
 
 void get_rrd_data(const std::string &file, const std::string &ds, time_t *start,
                   time_t *end, unsigned long *step, const char *type,
                   std::vector<double> *result);
 
+/**
+ * a datasource asked for from get_rrd_data, start, end and step are
+ * set to the ones of the data returned
+ */
+struct rrd_request {
+  std::string file, ds;
+  const char *cf;
+  time_t start, end;
+  unsigned long step;
+  std::vector<double> *result;
+};
+
+void get_rrd_data(std::vector<rrd_request> &requests);
+
+bool get_last_values(const std::string &file, std::vector<std::string> &names,
+                     std::vector<double> &values);
+
 #endif
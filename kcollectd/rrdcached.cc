@@ -0,0 +1,108 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <sys/stat.h>
+
+#include "rrdcached.h"
+#include "trace.h"
+
+// commands sent before reading their answers, keeps both socket-buffers
+// from filling up
+static const size_t pipeline_depth = 256;
+
+rrdcached_client &rrdcached_client::instance() {
+  static rrdcached_client client;
+  return client;
+}
+
+void rrdcached_client::address(const std::string &a) {
+  socket.close();
+  addr = a;
+  failed = false;
+}
+
+/**
+ * flush the updates rrdcached holds of those @a files, that may fall
+ * before @a end
+ *
+ * files written at or after @a end are skipped, the daemon can only
+ * hold newer updates of them.  Returns false if the daemon could not
+ * be asked, the files are read as they are on disk then.
+ */
+bool rrdcached_client::flush(const std::vector<std::string> &files,
+                             time_t end) {
+  if (!enabled())
+    return true;
+  trace_span trace("rrdcached::flush");
+
+  std::vector<std::string> commands(1);
+  size_t count = 0;
+  for (const std::string &f : files) {
+    struct stat st;
+    if (stat(f.c_str(), &st) == 0 && st.st_mtime >= end)
+      continue;
+    if (count == pipeline_depth) {
+      commands.emplace_back();
+      count = 0;
+    }
+    std::string &c = commands.back();
+    c += "FLUSH ";
+    for (char ch : f) {
+      if (ch == ' ' || ch == '\\')
+        c += '\\';
+      c += ch;
+    }
+    c += '\n';
+    ++count;
+  }
+  if (commands.front().empty())
+    return true;
+
+  // the daemon may have closed a connection kept open, it is noticed
+  // on the first answer and the connection opened again once
+  bool ok = true;
+  for (size_t k = 0; ok && k < commands.size(); ++k) {
+    const bool reused = socket.is_open();
+    const size_t n = k + 1 < commands.size() ? pipeline_depth : count;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+      ok = (socket.is_open() || socket.connect(addr)) &&
+           socket.send(commands[k]);
+      long status;
+      for (size_t i = 0; ok && i < n; ++i)
+        ok = socket.read_answer(status, 0);
+      if (ok || !reused || attempt > 0)
+        break;
+      socket.close();
+    }
+  }
+
+  if (!ok) {
+    if (!failed)
+      std::cerr << "flushing rrdcached at ‘" << addr
+                << "’ failed: " << strerror(errno) << std::endl;
+    socket.close();
+  }
+  failed = !ok;
+  return ok;
+}
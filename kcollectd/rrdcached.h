@@ -0,0 +1,59 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RRDCACHED_H
+#define RRDCACHED_H
+
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "linesocket.h"
+
+/**
+ * client of rrdcached, flushing the cached updates of rrd-files
+ * before they are read
+ *
+ * one connection to the daemon is kept open and reused; the FLUSH
+ * commands of all files are sent at once and the answers read
+ * afterwards, so flushing many files costs one round-trip.
+ */
+class rrdcached_client {
+public:
+  static rrdcached_client &instance();
+
+  // unix:/path or /path of the daemons socket, empty disables it
+  void address(const std::string &addr);
+  const std::string &address() const { return addr; }
+  bool enabled() const { return !addr.empty(); }
+
+  bool flush(const std::vector<std::string> &files, time_t end);
+
+private:
+  rrdcached_client() : failed(false) {}
+
+  std::string addr;
+  line_socket socket;
+  bool failed; // error already reported
+};
+
+#endif
@@ -0,0 +1,368 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <set>
+
+#include <boost/filesystem.hpp>
+
+#include <KLocalizedString>
+
+#include "rrd_interface.h"
+#include "rrdtree.h"
+#include "search_index.h"
+#include "trace.h"
+
+const std::string rrd_tree::delimiter("•");
+
+uint32_t string_pool::intern(std::string_view s) {
+  auto i = ids.find(s);
+  if (i != ids.end())
+    return i->second;
+  const uint32_t id = strings.size();
+  strings.emplace_back(s);
+  ids.emplace(strings.back(), id);
+  return id;
+}
+
+void string_pool::clear() {
+  ids.clear();
+  strings.clear();
+}
+
+void rrd_tree::clear() {
+  nodes.clear();
+  pool.clear();
+  roots_ = 0;
+}
+
+/**
+ * append @a count children of @a parent, returns the first
+ */
+uint32_t rrd_tree::allocate(uint32_t parent, size_t count) {
+  const uint32_t first = nodes.size();
+  nodes.resize(nodes.size() + count,
+               node{none, parent, none, 0, 0, none, none, none, none});
+  for (size_t r = 0; r < count; ++r)
+    nodes[first + r].row = r;
+  if (parent != none) {
+    nodes[parent].first = first;
+    nodes[parent].count = count;
+  }
+  return first;
+}
+
+/**
+ * reads all hosts, plugin-directories, rrd-files and their datasources
+ * below @a dir and adds the datasources to @a index
+ */
+void rrd_tree::build(const std::string &dir, search_index &index) {
+  using namespace boost::filesystem;
+  trace_span trace("rrd_tree::build", TRACE_DETAIL(dir));
+
+  clear();
+  basedir = absolute(dir).string();
+
+  std::vector<std::string> hosts;
+  const directory_iterator end_itr;
+  for (directory_iterator host(basedir); host != end_itr; ++host)
+    if (is_directory(*host))
+      hosts.push_back(host->path().filename().string());
+  std::sort(hosts.begin(), hosts.end());
+
+  roots_ = hosts.size();
+  allocate(none, hosts.size());
+  for (size_t h = 0; h < hosts.size(); ++h) {
+    nodes[h].name = nodes[h].host = pool.intern(hosts[h]);
+
+    std::vector<std::string> dirs;
+    const boost::filesystem::path hostdir =
+        boost::filesystem::path(basedir) / hosts[h];
+    for (directory_iterator sensor(hostdir); sensor != end_itr; ++sensor)
+      if (is_directory(*sensor))
+        dirs.push_back(sensor->path().filename().string());
+    std::sort(dirs.begin(), dirs.end());
+
+    std::vector<entry> items;
+    for (const std::string &d : dirs) {
+      const uint32_t id = pool.intern(d);
+      items.push_back({pool[id], id, {}});
+    }
+    group(h, items, index);
+  }
+}
+
+/**
+ * adds the sorted @a items as children of @a parent
+ *
+ * consecutive items sharing a prefix up to a dash are grouped in one
+ * node named by the prefix, its children are the items without the
+ * prefix, which are grouped again.
+ */
+void rrd_tree::group(uint32_t parent, const std::vector<entry> &items,
+                     search_index &index) {
+  std::vector<entry> level;
+  for (size_t i = 0; i < items.size();) {
+    const std::string_view root = items[i].text;
+    size_t lastpos = root.rfind('-');
+    size_t j = i + 1;
+    for (; j < items.size() && lastpos != std::string_view::npos; ++j) {
+      const std::string_view text = items[j].text;
+      const size_t endsearch = std::min(lastpos + 1, text.size());
+      size_t newlastpos = std::string_view::npos;
+      for (size_t c = 0; c < endsearch && text[c] == root[c]; ++c)
+        if (text[c] == '-')
+          newlastpos = c;
+      if (newlastpos == std::string_view::npos)
+        break;
+      lastpos = newlastpos;
+    }
+
+    if (j == i + 1) {
+      // a plugin-directory
+      level.push_back(items[i]);
+    } else {
+      entry e{root.substr(0, lastpos), none, {}};
+      for (size_t k = i; k < j; ++k)
+        e.members.push_back(
+            {items[k].text.substr(lastpos + 1), items[k].dir, {}});
+      level.push_back(std::move(e));
+    }
+    i = j;
+  }
+
+  std::stable_sort(level.begin(), level.end(),
+                   [](const entry &a, const entry &b) { return a.text < b.text; });
+
+  const uint32_t host = nodes[parent].host;
+  const uint32_t first = allocate(parent, level.size());
+  for (size_t r = 0; r < level.size(); ++r) {
+    node &n = nodes[first + r];
+    n.name = pool.intern(level[r].text);
+    n.host = host;
+    n.dir = level[r].dir;
+  }
+  for (size_t r = 0; r < level.size(); ++r) {
+    if (level[r].dir == none)
+      group(first + r, level[r].members, index);
+    else
+      files(first + r, index);
+  }
+}
+
+/**
+ * adds the rrd-files of the plugin-directory @a id and their datasources
+ */
+void rrd_tree::files(uint32_t id, search_index &index) {
+  using namespace boost::filesystem;
+
+  const uint32_t host = nodes[id].host, dir = nodes[id].dir;
+  std::vector<std::pair<std::string, std::string>> names; // stem, file-name
+  const directory_iterator end_itr;
+  const boost::filesystem::path sensor =
+      boost::filesystem::path(basedir) / pool[host] / pool[dir];
+  for (directory_iterator rrd(sensor); rrd != end_itr; ++rrd) {
+    if (!is_regular(*rrd) && extension(*rrd) == ".rrd")
+      continue;
+    names.emplace_back(basename(*rrd), rrd->path().filename().string());
+  }
+  std::sort(names.begin(), names.end());
+
+  const uint32_t first = allocate(id, names.size());
+  std::set<std::string> datasources;
+  for (size_t r = 0; r < names.size(); ++r) {
+    const uint32_t f = first + r;
+    nodes[f].name = pool.intern(names[r].first);
+    nodes[f].host = host;
+    nodes[f].dir = dir;
+    nodes[f].file = pool.intern(names[r].second);
+
+    get_dsinfo(rrd(f), datasources);
+    if (datasources.size() == 1) {
+      nodes[f].ds = pool.intern(*datasources.begin());
+      index.add(title(f), f);
+    } else {
+      const uint32_t ds = allocate(f, datasources.size());
+      std::set<std::string>::const_iterator i = datasources.begin();
+      for (size_t k = 0; k < datasources.size(); ++k, ++i) {
+        node &n = nodes[ds + k];
+        n.name = n.ds = pool.intern(*i);
+        n.host = host;
+        n.dir = dir;
+        n.file = nodes[f].file;
+        index.add(title(ds + k), ds + k);
+      }
+    }
+  }
+}
+
+/**
+ * path of the rrd-file of the file- or datasource-node @a id
+ */
+std::string rrd_tree::rrd(uint32_t id) const {
+  const node &n = nodes[id];
+  return basedir + '/' + pool[n.host] + '/' + pool[n.dir] + '/' +
+         pool[n.file];
+}
+
+/**
+ * interned type of the leaf @a id, the name of its rrd-file
+ */
+uint32_t rrd_tree::type(uint32_t id) const {
+  const node &n = nodes[id];
+  const node &p = nodes[n.parent];
+  return p.file == n.file ? p.name : n.name;
+}
+
+/**
+ * label of the leaf @a id in a graph: plugin-directory, file and, if
+ * the file has more than one, the datasource
+ */
+std::string rrd_tree::label(uint32_t id) const {
+  const node &n = nodes[id];
+  const node &p = nodes[n.parent];
+  if (p.file == n.file)
+    return pool[n.dir] + delimiter + pool[p.name] + delimiter + pool[n.name];
+  return pool[n.dir] + delimiter + pool[n.name];
+}
+
+/**
+ * names of the node @a id and its ancestors, joined by the delimiter
+ */
+std::string rrd_tree::path(uint32_t id) const {
+  std::string p = pool[nodes[id].name];
+  for (id = nodes[id].parent; id != none; id = nodes[id].parent)
+    p = pool[nodes[id].name] + delimiter + p;
+  return p;
+}
+
+/**
+ * the node with @a path, none if it does not exist
+ */
+uint32_t rrd_tree::find(const std::string &path) const {
+  return find(0, roots_, path);
+}
+
+/**
+ * the node with @a path below the siblings first…first+count
+ *
+ * sibling names are not unique (a directory cpu next to the group of
+ * cpu-0 and cpu-1), so all siblings with the name are tried.
+ */
+uint32_t rrd_tree::find(uint32_t first, uint32_t count,
+                        std::string_view path) const {
+  if (count == 0)
+    return none;
+  const size_t end = std::min(path.find(delimiter), path.size());
+  const std::string_view name = path.substr(0, end);
+
+  // the children are sorted by name
+  const node *b = nodes.data() + first, *e = b + count;
+  const node *i = std::lower_bound(
+      b, e, name, [this](const node &n, std::string_view s) {
+        return std::string_view(pool[n.name]) < s;
+      });
+  for (; i != e && pool[i->name] == name; ++i) {
+    const uint32_t id = i - nodes.data();
+    if (end == path.size())
+      return id;
+    const uint32_t found =
+        find(i->first, i->count, path.substr(end + delimiter.size()));
+    if (found != none)
+      return found;
+  }
+  return none;
+}
+
+/**
+ * all leafs in the subtree of @a id
+ */
+void rrd_tree::leaves(uint32_t id, std::vector<uint32_t> &list) const {
+  if (leaf(id))
+    list.push_back(id);
+  for (uint32_t c = 0; c < nodes[id].count; ++c)
+    leaves(nodes[id].first + c, list);
+}
+
+void RRDTreeModel::build(const std::string &basedir, search_index &index) {
+  beginResetModel();
+  tree_.build(basedir, index);
+  endResetModel();
+}
+
+QModelIndex RRDTreeModel::nodeIndex(uint32_t id) const {
+  if (id == rrd_tree::none)
+    return QModelIndex();
+  return createIndex(tree_[id].row, 0, quintptr(id));
+}
+
+QModelIndex RRDTreeModel::index(int row, int column,
+                                const QModelIndex &parent) const {
+  if (row < 0 || column != 0 || row >= rowCount(parent))
+    return QModelIndex();
+  const uint32_t first = parent.isValid() ? tree_[nodeId(parent)].first : 0;
+  return createIndex(row, column, quintptr(first + row));
+}
+
+QModelIndex RRDTreeModel::parent(const QModelIndex &child) const {
+  if (!child.isValid())
+    return QModelIndex();
+  return nodeIndex(tree_[nodeId(child)].parent);
+}
+
+int RRDTreeModel::rowCount(const QModelIndex &parent) const {
+  if (!parent.isValid())
+    return tree_.roots();
+  if (parent.column() != 0)
+    return 0;
+  return tree_[nodeId(parent)].count;
+}
+
+int RRDTreeModel::columnCount(const QModelIndex &) const { return 1; }
+
+QVariant RRDTreeModel::data(const QModelIndex &index, int role) const {
+  if (!index.isValid())
+    return QVariant();
+  const uint32_t id = nodeId(index);
+  switch (role) {
+  case Qt::DisplayRole:
+    return QString::fromUtf8(tree_.name(id).c_str());
+  case Qt::ToolTipRole:
+    if (tree_.leaf(id))
+      return QString::fromUtf8(tree_.rrd(id).c_str());
+    break;
+  }
+  return QVariant();
+}
+
+QVariant RRDTreeModel::headerData(int section, Qt::Orientation orientation,
+                                  int role) const {
+  if (section == 0 && orientation == Qt::Horizontal && role == Qt::DisplayRole)
+    return i18n("Sensor Data");
+  return QVariant();
+}
+
+Qt::ItemFlags RRDTreeModel::flags(const QModelIndex &index) const {
+  if (!index.isValid())
+    return Qt::NoItemFlags;
+  if (tree_.leaf(nodeId(index)))
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable;
+  return Qt::ItemIsEnabled;
+}
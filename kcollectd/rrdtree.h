@@ -0,0 +1,154 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RRDTREE_H
+#define RRDTREE_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <QAbstractItemModel>
+
+class search_index;
+
+/**
+ * interned strings, every distinct string is stored once
+ */
+class string_pool {
+public:
+  uint32_t intern(std::string_view s);
+  const std::string &operator[](uint32_t id) const { return strings[id]; }
+  size_t size() const { return strings.size(); }
+  void clear();
+
+private:
+  std::deque<std::string> strings; // stable addresses for the views
+  std::unordered_map<std::string_view, uint32_t> ids;
+};
+
+/**
+ * the tree of hosts, plugins, rrd-files and datasources
+ *
+ * all nodes live in one array, the children of a node are consecutive.
+ * Names of plugin-directories are grouped on common dash-separated
+ * prefixes (cpu-0, cpu-1 become cpu with 0 and 1).  Paths are not
+ * stored, but built from the interned names of host, directory and
+ * file.
+ */
+class rrd_tree {
+public:
+  static const uint32_t none = 0xffffffff;
+  static const std::string delimiter; // joins names in paths and labels
+
+  struct node {
+    uint32_t name;   // text shown
+    uint32_t parent;
+    uint32_t first;  // first child
+    uint32_t count;  // number of children
+    uint32_t row;    // index among its siblings
+    uint32_t host;   // interned name of the host-directory
+    uint32_t dir;    // interned plugin-directory, none above
+    uint32_t file;   // interned file-name, none above
+    uint32_t ds;     // interned datasource of leafs, none otherwise
+  };
+
+  rrd_tree() : roots_(0) {}
+
+  void build(const std::string &basedir, search_index &index);
+  void clear();
+
+  size_t size() const { return nodes.size(); }
+  size_t roots() const { return roots_; }
+  const node &operator[](uint32_t id) const { return nodes[id]; }
+  const std::string &name(uint32_t id) const { return pool[nodes[id].name]; }
+  bool leaf(uint32_t id) const { return nodes[id].ds != none; }
+
+  const std::string &host(uint32_t id) const { return pool[nodes[id].host]; }
+  std::string rrd(uint32_t id) const;
+  const std::string &ds(uint32_t id) const { return pool[nodes[id].ds]; }
+  uint32_t type(uint32_t id) const;
+  std::string label(uint32_t id) const;
+  std::string title(uint32_t id) const {
+    return host(id) + delimiter + label(id);
+  }
+
+  // the strings interned by the nodes
+  size_t strings() const { return pool.size(); }
+  const std::string &interned(uint32_t s) const { return pool[s]; }
+  std::string path(uint32_t id) const;
+  uint32_t find(const std::string &path) const;
+  void leaves(uint32_t id, std::vector<uint32_t> &list) const;
+
+private:
+  struct entry {
+    std::string_view text; // name, without the prefix of its group
+    uint32_t dir;          // interned directory, none for groups
+    std::vector<entry> members;
+  };
+
+  uint32_t allocate(uint32_t parent, size_t count);
+  uint32_t find(uint32_t first, uint32_t count, std::string_view path) const;
+  void group(uint32_t parent, const std::vector<entry> &items,
+             search_index &index);
+  void files(uint32_t id, search_index &index);
+
+  std::string basedir;
+  string_pool pool;
+  std::vector<node> nodes;
+  size_t roots_;
+};
+
+/**
+ * the rrd_tree as model for a QTreeView
+ */
+class RRDTreeModel : public QAbstractItemModel {
+  Q_OBJECT
+
+public:
+  explicit RRDTreeModel(QObject *parent = 0) : QAbstractItemModel(parent) {}
+
+  rrd_tree &tree() { return tree_; }
+  const rrd_tree &tree() const { return tree_; }
+  void build(const std::string &basedir, search_index &index);
+  uint32_t nodeId(const QModelIndex &index) const {
+    return index.isValid() ? uint32_t(index.internalId()) : rrd_tree::none;
+  }
+  QModelIndex nodeIndex(uint32_t id) const;
+
+  virtual QModelIndex index(int row, int column,
+                            const QModelIndex &parent) const override;
+  virtual QModelIndex parent(const QModelIndex &child) const override;
+  virtual int rowCount(const QModelIndex &parent) const override;
+  virtual int columnCount(const QModelIndex &parent) const override;
+  virtual QVariant data(const QModelIndex &index, int role) const override;
+  virtual QVariant headerData(int section, Qt::Orientation orientation,
+                              int role) const override;
+  virtual Qt::ItemFlags flags(const QModelIndex &index) const override;
+
+private:
+  rrd_tree tree_;
+};
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "pattern.h"
+#include "search_index.h"
+
+static std::string lower(const std::string &s) {
+  std::string l(s);
+  for (char &c : l)
+    if (c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+  return l;
+}
+
+void search_index::clear() {
+  nodes.clear();
+  keys.clear();
+  postings.clear();
+  last_pattern.clear();
+  result.clear();
+}
+
+void search_index::add(const std::string &path, uint32_t node) {
+  const int id = nodes.size();
+  nodes.push_back(node);
+  keys.push_back(lower(path));
+
+  // ids only grow, so the posting-lists stay sorted
+  const std::string &key = keys.back();
+  for (size_t i = 0; i + 3 <= key.size(); ++i) {
+    std::vector<int> &list = postings[trigram(key.data() + i)];
+    if (list.empty() || list.back() != id)
+      list.push_back(id);
+  }
+  last_pattern.clear();
+}
+
+bool search_index::matches(int id, const std::string &pattern,
+                           bool glob) const {
+  if (glob)
+    return glob_match(keys[id].c_str(), pattern.c_str());
+  return keys[id].find(pattern) != std::string::npos;
+}
+
+/**
+ * ids of all entries matching @a pattern, in the order they were added
+ */
+const std::vector<int> &search_index::query(const std::string &text) {
+  const std::string pattern = lower(text);
+  const bool glob = pattern.find_first_of("*?") != std::string::npos;
+  // globs match anywhere, like substrings
+  const std::string match = glob ? "*" + pattern + "*" : pattern;
+
+  if (pattern.empty()) {
+    result.clear();
+  } else if (!last_pattern.empty() &&
+             (pattern.compare(0, last_pattern.size(), last_pattern) == 0 ||
+              (!glob && !last_glob &&
+               pattern.find(last_pattern) != std::string::npos))) {
+    // narrowing the last query
+    std::vector<int>::iterator out = result.begin();
+    for (int id : result)
+      if (matches(id, match, glob))
+        *out++ = id;
+    result.erase(out, result.end());
+  } else {
+    // posting-lists of the trigrams of the literal parts
+    std::vector<const std::vector<int> *> lists;
+    bool missing = false;
+    size_t begin = 0;
+    while (begin < pattern.size() && !missing) {
+      size_t end = pattern.find_first_of("*?", begin);
+      if (end == std::string::npos)
+        end = pattern.size();
+      for (size_t i = begin; i + 3 <= end; ++i) {
+        auto p = postings.find(trigram(pattern.data() + i));
+        if (p == postings.end()) {
+          missing = true;
+          break;
+        }
+        lists.push_back(&p->second);
+      }
+      begin = end + 1;
+    }
+
+    result.clear();
+    if (missing) {
+      // a trigram that is nowhere
+    } else if (lists.empty()) {
+      for (size_t id = 0; id < keys.size(); ++id)
+        if (matches(id, match, glob))
+          result.push_back(id);
+    } else {
+      // intersect, starting with the shortest list
+      std::sort(lists.begin(), lists.end(),
+                [](const std::vector<int> *a, const std::vector<int> *b) {
+                  return a->size() < b->size() ||
+                         (a->size() == b->size() && a < b);
+                });
+      lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+      std::vector<size_t> pos(lists.size(), 0);
+      for (int id : *lists.front()) {
+        bool all = true;
+        for (size_t l = 1; l < lists.size() && all; ++l) {
+          const std::vector<int> &list = *lists[l];
+          size_t &p = pos[l];
+          p = std::lower_bound(list.begin() + p, list.end(), id) -
+              list.begin();
+          all = p < list.size() && list[p] == id;
+        }
+        if (all && matches(id, match, glob))
+          result.push_back(id);
+      }
+    }
+  }
+
+  last_pattern = pattern;
+  last_glob = glob;
+  return result;
+}
@@ -0,0 +1,68 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * trigram-index over the paths of all datasources
+ *
+ * a query is a substring or a glob-pattern (with * and ?) matched
+ * anywhere in the path, case-insensitive.  Candidates are the entries
+ * containing all trigrams of the literal parts of the query, which are
+ * then verified.  Queries without a trigram scan all entries.  A query
+ * extending the previous one only filters the previous result.
+ */
+class search_index {
+public:
+  search_index() : last_glob(false) {}
+
+  void clear();
+  void add(const std::string &path, uint32_t node);
+  size_t size() const { return nodes.size(); }
+  // the node of the datasource in the rrd_tree
+  uint32_t operator[](int id) const { return nodes[id]; }
+
+  const std::vector<int> &query(const std::string &pattern);
+
+private:
+  static uint32_t trigram(const char *s) {
+    return uint32_t(uint8_t(s[0])) << 16 | uint32_t(uint8_t(s[1])) << 8 |
+           uint8_t(s[2]);
+  }
+  bool matches(int id, const std::string &pattern, bool glob) const;
+
+  std::vector<uint32_t> nodes;
+  std::vector<std::string> keys; // lowercase paths
+  std::unordered_map<uint32_t, std::vector<int>> postings;
+
+  // the last query and its result
+  std::string last_pattern;
+  bool last_glob;
+  std::vector<int> result;
+};
+
+#endif
@@ -0,0 +1,266 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "series_cache.h"
+#include "trace.h"
+
+namespace {
+
+const char magic[8] = {'k', 'c', 's', 'e', 'r', 'i', 'e', 's'};
+const uint32_t version = 1;
+
+/**
+ * start of every file, followed by the key padded to 8 bytes and the
+ * values
+ */
+struct file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t key_size;
+  uint64_t ino;      // of the rrd-file
+  int64_t mtime;     // of the rrd-file, in ns
+  int64_t fetched;   // time the values were fetched at
+  int64_t start, end;
+  uint64_t step;
+  uint64_t count;
+};
+
+inline size_t padded(size_t n) { return (n + 7) & ~size_t(7); }
+
+inline int64_t mtime_ns(const struct stat &st) {
+  return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+std::string make_key(const std::string &rrd, const std::string &ds,
+                     const char *cf, time_t span) {
+  std::string key = rrd;
+  key += '\0';
+  key += ds;
+  key += '\0';
+  key += cf;
+  key += '\0';
+  key += std::to_string(span);
+  return key;
+}
+
+// files ending in this are written and not complete yet
+const char tmp_suffix[] = ".tmp";
+
+bool is_tmp(const char *name) {
+  const size_t n = strlen(name), s = sizeof(tmp_suffix) - 1;
+  return n >= s && strcmp(name + n - s, tmp_suffix) == 0;
+}
+
+} // namespace
+
+series_cache &series_cache::instance() {
+  static series_cache cache;
+  return cache;
+}
+
+/**
+ * keep the files in @a dir, at most @a limit bytes of them
+ *
+ * the directory has to exist.
+ */
+void series_cache::open(const std::string &dir, uint64_t limit) {
+  dir_ = dir;
+  limit_ = dir.empty() ? 0 : limit;
+  bytes = 0;
+  if (enabled())
+    evict();
+}
+
+/**
+ * file of @a key, named by its FNV-1a hash
+ */
+std::string series_cache::path(const std::string &key) const {
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c : key)
+    h = (h ^ c) * 1099511628211ull;
+  char name[17];
+  snprintf(name, sizeof(name), "%016llx", (unsigned long long)h);
+  return dir_ + '/' + name;
+}
+
+/**
+ * the series last stored of @a rrd, @a ds and @a cf at @a span
+ *
+ * @a fresh tells if the rrd-file was not written since the values were
+ * fetched, they are the ones it holds then.  Returns false if nothing
+ * was stored.
+ */
+bool series_cache::load(const std::string &rrd, const std::string &ds,
+                        const char *cf, time_t span, series &s, bool &fresh) {
+  if (!enabled())
+    return false;
+  trace_span trace("series_cache::load", TRACE_DETAIL(rrd + " " + ds));
+
+  const std::string key = make_key(rrd, ds, cf, span);
+  const std::string file = path(key);
+  const int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(file_header))
+    map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  bool ok = false;
+  if (map != MAP_FAILED) {
+    const char *p = static_cast<const char *>(map);
+    file_header h;
+    memcpy(&h, p, sizeof(h));
+    const size_t values = sizeof(h) + padded(h.key_size);
+    ok = memcmp(h.magic, magic, sizeof(magic)) == 0 && h.version == version &&
+         h.key_size == key.size() &&
+         values + h.count * sizeof(double) == size_t(st.st_size) &&
+         memcmp(p + sizeof(h), key.data(), key.size()) == 0;
+    if (ok) {
+      const double *v = reinterpret_cast<const double *>(p + values);
+      s.data.assign(v, v + h.count);
+      s.start = h.start;
+      s.end = h.end;
+      s.step = h.step;
+
+      struct stat rst;
+      fresh = stat(rrd.c_str(), &rst) == 0 && uint64_t(rst.st_ino) == h.ino &&
+              mtime_ns(rst) == h.mtime && rst.st_mtime < h.fetched &&
+              h.step && h.count == uint64_t(h.end - h.start) / h.step;
+    }
+    munmap(map, st.st_size);
+  }
+  // used now, for the order of eviction
+  if (ok)
+    futimens(fd, 0);
+  ::close(fd);
+  return ok;
+}
+
+/**
+ * keep the series @a data of @a rrd, @a ds and @a cf at @a span,
+ * fetched at @a fetched
+ *
+ * written to a temporary file first, so a file is either complete or
+ * missing.
+ */
+void series_cache::store(const std::string &rrd, const std::string &ds,
+                         const char *cf, time_t span, time_t start, time_t end,
+                         unsigned long step, const std::vector<double> &data,
+                         time_t fetched) {
+  if (!enabled() || data.empty())
+    return;
+  trace_span trace("series_cache::store", TRACE_DETAIL(rrd + " " + ds));
+
+  struct stat rst;
+  if (stat(rrd.c_str(), &rst) != 0)
+    return;
+
+  const std::string key = make_key(rrd, ds, cf, span);
+  file_header h;
+  memcpy(h.magic, magic, sizeof(magic));
+  h.version = version;
+  h.key_size = key.size();
+  h.ino = rst.st_ino;
+  h.mtime = mtime_ns(rst);
+  h.fetched = fetched;
+  h.start = start;
+  h.end = end;
+  h.step = step;
+  h.count = data.size();
+
+  std::string head(reinterpret_cast<const char *>(&h), sizeof(h));
+  head += key;
+  head.resize(sizeof(h) + padded(key.size()), '\0');
+
+  const std::string file = path(key);
+  const std::string tmp = file + tmp_suffix;
+  const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                        0600);
+  if (fd < 0)
+    return;
+  const size_t size = data.size() * sizeof(double);
+  const bool ok = write(fd, head.data(), head.size()) == ssize_t(head.size()) &&
+                  write(fd, data.data(), size) == ssize_t(size);
+  if (::close(fd) != 0 || !ok) {
+    unlink(tmp.c_str());
+    return;
+  }
+
+  struct stat old;
+  const uint64_t replaced = stat(file.c_str(), &old) == 0 ? old.st_size : 0;
+  if (rename(tmp.c_str(), file.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return;
+  }
+  bytes += head.size() + size - std::min(replaced, bytes);
+  if (bytes > limit_)
+    evict();
+}
+
+/**
+ * remove the files used least recently until they fit into the limit
+ */
+void series_cache::evict() {
+  trace_span trace("series_cache::evict");
+
+  struct entry {
+    struct timespec used;
+    uint64_t size;
+    std::string name;
+  };
+  std::vector<entry> files;
+  bytes = 0;
+  DIR *d = opendir(dir_.c_str());
+  if (!d)
+    return;
+  while (struct dirent *e = readdir(d)) {
+    struct stat st;
+    if (e->d_name[0] == '.' || is_tmp(e->d_name) ||
+        fstatat(dirfd(d), e->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    files.push_back({st.st_mtim, uint64_t(st.st_size), e->d_name});
+    bytes += st.st_size;
+  }
+
+  if (bytes > limit_) {
+    std::sort(files.begin(), files.end(), [](const entry &a, const entry &b) {
+      return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec
+                                            : a.used.tv_nsec < b.used.tv_nsec;
+    });
+    for (const entry &f : files) {
+      if (bytes <= limit_)
+        break;
+      if (unlinkat(dirfd(d), f.name.c_str(), 0) == 0)
+        bytes -= f.size;
+    }
+  }
+  closedir(d);
+}
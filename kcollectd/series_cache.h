@@ -0,0 +1,66 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERIES_CACHE_H
+#define SERIES_CACHE_H
+
+#include <time.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "series_store.h"
+
+/**
+ * series fetched before, kept on disk to be shown at the next start
+ *
+ * one file per rrd-file, datasource, consolidation-function and span,
+ * holding the window, step, inode and mtime of the rrd-file and the
+ * values as they are in memory, so they are read by mapping the file.
+ * The files used least recently are removed when they exceed the limit.
+ */
+class series_cache {
+public:
+  static series_cache &instance();
+
+  // directory of the files and their limit in bytes, 0 disables it
+  void open(const std::string &dir, uint64_t limit);
+  bool enabled() const { return limit_ != 0; }
+  uint64_t size() const { return bytes; }
+
+  bool load(const std::string &rrd, const std::string &ds, const char *cf,
+            time_t span, series &s, bool &fresh);
+  void store(const std::string &rrd, const std::string &ds, const char *cf,
+             time_t span, time_t start, time_t end, unsigned long step,
+             const std::vector<double> &data, time_t fetched);
+
+private:
+  series_cache() : limit_(0), bytes(0) {}
+  std::string path(const std::string &key) const;
+  void evict();
+
+  std::string dir_;
+  uint64_t limit_;
+  uint64_t bytes; // size of all files
+};
+
+#endif
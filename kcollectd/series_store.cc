@@ -0,0 +1,250 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "rrd_interface.h"
+#include "series_store.h"
+
+const std::vector<double> series_handle::none;
+
+/**
+ * hold @a data computed here (not fetched), it is not shared
+ */
+void series_handle::assign(std::vector<double> &&data) {
+  std::shared_ptr<series> s = std::make_shared<series>();
+  s->data.swap(data);
+  s->start = s->end = 0;
+  s->step = 0;
+  ptr = s;
+}
+
+/**
+ * hold the values compressed, if that takes less memory
+ *
+ * series shared with others are kept, packing them would free
+ * nothing.  Returns false if the values are kept as they are.
+ */
+bool series_handle::pack() {
+  if (!ptr || ptr->data.empty() || ptr.use_count() > 1)
+    return false;
+  std::shared_ptr<const packed_series> p =
+      std::make_shared<packed_series>(ptr->data);
+  if (p->memory() >= ptr->data.capacity() * sizeof(double))
+    return false;
+  packed_ = p;
+  ptr.reset();
+  return true;
+}
+
+/**
+ * decode the values packed, block by block into the series
+ */
+void series_handle::unpack() {
+  if (!packed_)
+    return;
+  std::vector<double> data;
+  packed_->unpack(data);
+  packed_.reset();
+  assign(std::move(data));
+}
+
+size_t series_handle::memory() const {
+  if (packed_)
+    return packed_->memory();
+  if (!ptr)
+    return 0;
+  return ptr->data.capacity() * sizeof(double) /
+         std::max(1L, long(ptr.use_count()));
+}
+
+series_reader::series_reader(const series_handle &h)
+    : plain(0), packed(h.packed_values()), block(size_t(-1)) {
+  if (packed) {
+    size_ = packed->size();
+  } else {
+    plain = h.values().data();
+    size_ = h.size();
+  }
+}
+
+void series_reader::decode(size_t k) {
+  buffer.resize(packed_series::block_size);
+  packed->decode_block(k, buffer.data());
+  block = k;
+}
+
+series_store &series_store::instance() {
+  static series_store store;
+  return store;
+}
+
+/**
+ * the series of @a e, if someone holds it and it is not stale
+ *
+ * a series up to @a end is stale if @a end is after the update of
+ * @a rrd it was fetched at, and @a rrd was updated since.  The last
+ * updates asked for are kept in @a lasts.
+ */
+series_ptr series_store::find(entry &e, const std::string &rrd, time_t end,
+                              std::unordered_map<std::string, time_t> &lasts) {
+  series_ptr s = e.s.lock();
+  if (!s || !e.last || end <= e.last)
+    return s;
+  auto i = lasts.find(rrd);
+  if (i == lasts.end())
+    i = lasts.emplace(rrd, get_last_update(rrd)).first;
+  return i->second > e.last ? series_ptr() : s;
+}
+
+/**
+ * the series of @a rrd, @a ds and @a cf from @a start to @a end
+ *
+ * fetched only if nobody holds it, otherwise shared.  start, end and
+ * step of the series are the ones rrd_fetch returned.
+ */
+series_ptr series_store::fetch(const std::string &rrd, const std::string &ds,
+                               const char *cf, time_t start, time_t end,
+                               unsigned long step) {
+  std::unordered_map<std::string, time_t> lasts;
+  entry &e = entries[key(rrd, ds, cf, start, end, step)];
+  if (series_ptr s = find(e, rrd, end, lasts)) {
+    ++hits_;
+    return s;
+  }
+
+  ++misses_;
+  std::shared_ptr<series> s = std::make_shared<series>();
+  s->start = start;
+  s->end = end;
+  s->step = step;
+  const auto i = lasts.find(rrd);
+  e.last = i != lasts.end() ? i->second : get_last_update(rrd);
+  get_rrd_data(rrd, ds, &s->start, &s->end, &s->step, cf, &s->data);
+  e.s = s;
+
+  if (entries.size() >= purge_at)
+    purge();
+  return s;
+}
+
+/**
+ * the series of all @a requests from @a start to @a end, into @a held
+ *
+ * the ones nobody holds are fetched together, so the datasources of a
+ * file are read at once.  They are found by fetch while @a held keeps
+ * them.
+ */
+void series_store::fetch(const std::vector<series_request> &requests,
+                         time_t start, time_t end, unsigned long step,
+                         std::vector<series_ptr> &held) {
+  std::vector<rrd_request> batch;
+  std::vector<std::shared_ptr<series>> fetched;
+  std::unordered_map<std::string, time_t> lasts;
+  for (const series_request &r : requests) {
+    entry &e = entries[key(r.rrd, r.ds, r.cf, start, end, step)];
+    if (series_ptr s = find(e, r.rrd, end, lasts)) {
+      ++hits_;
+      held.push_back(s);
+      continue;
+    }
+    ++misses_;
+    std::shared_ptr<series> s = std::make_shared<series>();
+    auto i = lasts.find(r.rrd);
+    if (i == lasts.end())
+      i = lasts.emplace(r.rrd, get_last_update(r.rrd)).first;
+    e.s = s;
+    e.last = i->second;
+    fetched.push_back(s);
+    batch.push_back({r.rrd, r.ds, r.cf, start, end, step, &s->data});
+  }
+  if (batch.empty())
+    return;
+
+  get_rrd_data(batch);
+  for (size_t k = 0; k < batch.size(); ++k) {
+    fetched[k]->start = batch[k].start;
+    fetched[k]->end = batch[k].end;
+    fetched[k]->step = batch[k].step;
+    held.push_back(fetched[k]);
+  }
+  if (entries.size() >= purge_at)
+    purge();
+}
+
+/**
+ * share @a s, fetched elsewhere at the update @a last of @a rrd, as the
+ * series of @a rrd, @a ds and @a cf from @a start to @a end
+ *
+ * it is found by fetch as long as someone holds it, and with @a last
+ * 0 even after @a rrd was updated.
+ */
+void series_store::put(const std::string &rrd, const std::string &ds,
+                       const char *cf, time_t start, time_t end,
+                       unsigned long step, series_ptr s, time_t last) {
+  entries[key(rrd, ds, cf, start, end, step)] = {s, last};
+  if (entries.size() >= purge_at)
+    purge();
+}
+
+std::string series_store::key(const std::string &rrd, const std::string &ds,
+                              const char *cf, time_t start, time_t end,
+                              unsigned long step) {
+  std::string key = rrd;
+  key += '\0';
+  key += ds;
+  key += '\0';
+  key += cf;
+  key += '\0';
+  key.append(reinterpret_cast<const char *>(&start), sizeof(start));
+  key.append(reinterpret_cast<const char *>(&end), sizeof(end));
+  key.append(reinterpret_cast<const char *>(&step), sizeof(step));
+  return key;
+}
+
+/**
+ * drop the entries of series nobody holds any more
+ */
+void series_store::purge() {
+  for (auto i = entries.begin(); i != entries.end();)
+    i = i->second.s.expired() ? entries.erase(i) : std::next(i);
+  purge_at = std::max(size_t(64), 2 * entries.size());
+}
+
+/**
+ * number of series held
+ */
+size_t series_store::size() const {
+  size_t n = 0;
+  for (const auto &e : entries)
+    n += !e.second.s.expired();
+  return n;
+}
+
+/**
+ * bytes of all series held
+ */
+size_t series_store::memory() const {
+  size_t bytes = 0;
+  for (const auto &e : entries)
+    if (series_ptr s = e.second.s.lock())
+      bytes += s->data.capacity() * sizeof(double);
+  return bytes;
+}
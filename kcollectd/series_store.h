@@ -0,0 +1,172 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERIES_STORE_H
+#define SERIES_STORE_H
+
+#include <time.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "packed_series.h"
+
+/**
+ * values of one consolidation-function of a datasource, as fetched
+ */
+struct series {
+  std::vector<double> data;
+  time_t start, end;
+  unsigned long step;
+};
+
+typedef std::shared_ptr<const series> series_ptr;
+
+/**
+ * a series asked for from series_store::fetch, all at once
+ */
+struct series_request {
+  std::string rrd, ds;
+  const char *cf;
+};
+
+/**
+ * read-only handle of a series, shared with everyone using the same
+ * series
+ *
+ * reads like a const std::vector<double>, an empty handle like an
+ * empty vector.  A packed handle reads like an empty one, until it is
+ * unpacked.
+ */
+class series_handle {
+public:
+  series_handle() {}
+  series_handle(series_ptr s) : ptr(std::move(s)) {}
+
+  void assign(std::vector<double> &&data);
+  void reset() {
+    ptr.reset();
+    packed_.reset();
+  }
+
+  // compressed, not shared any more
+  bool pack();
+  void unpack();
+  bool packed() const { return bool(packed_); }
+  const packed_series *packed_values() const { return packed_.get(); }
+
+  const std::vector<double> &values() const {
+    return ptr ? ptr->data : none;
+  }
+  operator const std::vector<double> &() const { return values(); }
+  size_t size() const { return values().size(); }
+  bool empty() const { return values().empty(); }
+  double operator[](size_t i) const { return values()[i]; }
+
+  // bytes, shared series count for each holder in part
+  size_t memory() const;
+
+private:
+  series_ptr ptr;
+  std::shared_ptr<const packed_series> packed_;
+  static const std::vector<double> none;
+};
+
+/**
+ * reads the values of a series_handle, a packed one a block at a time
+ *
+ * the block of the value read last is kept decoded, so reading in
+ * order decodes each block once.  The handle has to outlive the
+ * reader.
+ */
+class series_reader {
+public:
+  explicit series_reader(const series_handle &h);
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  double operator[](size_t i) {
+    if (plain)
+      return plain[i];
+    if (i / packed_series::block_size != block)
+      decode(i / packed_series::block_size);
+    return buffer[i % packed_series::block_size];
+  }
+
+private:
+  void decode(size_t k);
+
+  const double *plain;
+  const packed_series *packed;
+  size_t size_;
+  size_t block; // decoded into buffer
+  std::vector<double> buffer;
+};
+
+/**
+ * all fetched series, each fetched once while it is used
+ *
+ * series are keyed by rrd-file, datasource, consolidation-function and
+ * the window and resolution asked for.  The store only holds weak
+ * references, a series is freed when the last handle is gone.  A
+ * series whose window reaches past the last update of its file when
+ * fetched is fetched again once the file was updated.
+ */
+class series_store {
+public:
+  static series_store &instance();
+
+  series_ptr fetch(const std::string &rrd, const std::string &ds,
+                   const char *cf, time_t start, time_t end,
+                   unsigned long step);
+  void fetch(const std::vector<series_request> &requests, time_t start,
+             time_t end, unsigned long step, std::vector<series_ptr> &held);
+  void put(const std::string &rrd, const std::string &ds, const char *cf,
+           time_t start, time_t end, unsigned long step, series_ptr s,
+           time_t last);
+
+  size_t size() const;
+  size_t memory() const;
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+
+private:
+  series_store() : hits_(0), misses_(0), purge_at(64) {}
+  static std::string key(const std::string &rrd, const std::string &ds,
+                         const char *cf, time_t start, time_t end,
+                         unsigned long step);
+  void purge();
+
+  struct entry {
+    std::weak_ptr<const series> s;
+    time_t last; // update of the file when fetched, 0 for never stale
+  };
+  series_ptr find(entry &e, const std::string &rrd, time_t end,
+                  std::unordered_map<std::string, time_t> &lasts);
+
+  std::unordered_map<std::string, entry> entries;
+  size_t hits_, misses_;
+  size_t purge_at; // number of entries to drop expired ones at
+};
+
+#endif
@@ -18,126 +18,257 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <limits>
+
 #include "timeaxis.h"
 
-void time_iterator::set(time_t start, time_t st, it_type ty) {
-  step = st;
-  if (!step)
-    return;
+static const time_t day = 24 * 3600;
 
-  type = ty;
+/**
+ * division rounding towards negative infinity
+ */
+static inline long long floor_div(long long a, long long b) {
+  return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
 
-  switch (type) {
-  case seconds: {
-    tzset();
-    localtime_r(&start, &now_tm);
-    now_t =
-        ((start + now_tm.tm_gmtoff + step) / step) * step - now_tm.tm_gmtoff;
-    break;
-  }
-  case weeks:
-    tzset();
-    localtime_r(&start, &now_tm);
-    step *= 3600 * 24 * 7;
-    now_tm.tm_sec = now_tm.tm_min = now_tm.tm_hour = 0;
-    now_tm.tm_mday -= now_tm.tm_wday - (now_tm.tm_wday == 0 ? 1 : 8);
-    now_t = mktime(&now_tm);
-    break;
-  case month:
-    tzset();
-    localtime_r(&start, &now_tm);
-    now_tm.tm_sec = now_tm.tm_min = now_tm.tm_hour = 0;
-    if (now_tm.tm_mon == 11) {
-      now_tm.tm_mon = 0;
-      ++now_tm.tm_year;
-    } else {
-      ++now_tm.tm_mon;
+/**
+ * number of days since 1970-01-01 for a date of the proleptic
+ * gregorian calendar (algorithm by H. Hinnant)
+ */
+long tz_window::days_from_civil(long y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const long era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = static_cast<unsigned>(y - era * 400);
+  const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + static_cast<long>(doe) - 719468;
+}
+
+/**
+ * date for a number of days since 1970-01-01, inverse of
+ * days_from_civil
+ */
+void tz_window::civil_from_days(long z, long &y, unsigned &m, unsigned &d) {
+  z += 719468;
+  const long era = (z >= 0 ? z : z - 146096) / 146097;
+  const unsigned doe = static_cast<unsigned>(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  y = static_cast<long>(yoe) + era * 400;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  d = doy - (153 * mp + 2) / 5 + 1;
+  m = mp < 10 ? mp + 3 : mp - 9;
+  y += m <= 2;
+}
+
+/**
+ * resolve the offsets of the local timezone between @a begin and @a end
+ */
+void tz_window::set(time_t begin, time_t end) {
+  const time_t probe = 7 * day;
+
+  tzset();
+  segments.clear();
+
+  struct tm tm;
+  localtime_r(&begin, &tm);
+  segments.push_back({std::numeric_limits<time_t>::min(), tm.tm_gmtoff,
+                      tm.tm_isdst, tm.tm_zone});
+
+  time_t last = begin;
+  while (last < end) {
+    time_t t = std::min(end, last + probe);
+    localtime_r(&t, &tm);
+    if (tm.tm_gmtoff != segments.back().gmtoff ||
+        tm.tm_isdst != segments.back().isdst) {
+      // bisect for the first second of the new offset
+      time_t lo = last, hi = t;
+      while (hi - lo > 1) {
+        const time_t mid = lo + (hi - lo) / 2;
+        localtime_r(&mid, &tm);
+        if (tm.tm_gmtoff == segments.back().gmtoff &&
+            tm.tm_isdst == segments.back().isdst)
+          lo = mid;
+        else
+          hi = mid;
+      }
+      localtime_r(&hi, &tm);
+      segments.push_back({hi, tm.tm_gmtoff, tm.tm_isdst, tm.tm_zone});
     }
-    now_tm.tm_mday = 1;
-    now_t = mktime(&now_tm);
-    break;
-  case years:
-    tzset();
-    localtime_r(&start, &now_tm);
-    now_tm.tm_sec = now_tm.tm_min = now_tm.tm_hour = 0;
-    now_tm.tm_mon = 0;
-    now_tm.tm_mday = 1;
-    ++now_tm.tm_year;
-    now_tm.tm_isdst = 0;
-    now_t = mktime(&now_tm);
-    break;
+    last = t;
   }
 }
 
-time_iterator &time_iterator::operator++() {
-  switch (type) {
-  case seconds:
-  case weeks:
-    now_t += step;
-    break;
-  case month:
-    // max step is 12!
-    now_tm.tm_mon += step;
-    if (now_tm.tm_mon >= 12) {
-      now_tm.tm_mon -= 12;
-      ++now_tm.tm_year;
-    }
-    now_t = mktime(&now_tm);
-    break;
-  case years:
-    now_tm.tm_year += step;
-    now_t = mktime(&now_tm);
-    break;
+const tz_window::segment &tz_window::segment_at(time_t t) const {
+  static const segment utc = {std::numeric_limits<time_t>::min(), 0, 0,
+                              "UTC"};
+  if (segments.empty())
+    return utc;
+
+  std::vector<segment>::const_iterator i = std::upper_bound(
+      segments.begin(), segments.end(), t,
+      [](time_t t, const segment &s) { return t < s.start; });
+  return *(i - 1);
+}
+
+/**
+ * first second after @a t with a different offset
+ */
+time_t tz_window::next_change(time_t t) const {
+  for (const segment &s : segments)
+    if (s.start > t)
+      return s.start;
+  return std::numeric_limits<time_t>::max();
+}
+
+/**
+ * like localtime_r, but without consulting the timezone-database
+ */
+void tz_window::localtime(time_t t, struct tm &tm) const {
+  const segment &s = segment_at(t);
+  const long long local = static_cast<long long>(t) + s.gmtoff;
+  const long days = floor_div(local, day);
+  const long secs = local - static_cast<long long>(days) * day;
+
+  long y;
+  unsigned m, d;
+  civil_from_days(days, y, m, d);
+  tm.tm_year = y - 1900;
+  tm.tm_mon = m - 1;
+  tm.tm_mday = d;
+  tm.tm_hour = secs / 3600;
+  tm.tm_min = secs / 60 % 60;
+  tm.tm_sec = secs % 60;
+  tm.tm_wday = (days % 7 + 11) % 7;
+  tm.tm_yday = days - days_from_civil(y, 1, 1);
+  tm.tm_isdst = s.isdst;
+  tm.tm_gmtoff = s.gmtoff;
+  tm.tm_zone = s.zone;
+}
+
+/**
+ * converts seconds of local wall-clock time since the epoch to UTC
+ *
+ * an ambiguous local time maps to its first occurrence, a local time
+ * skipped by a DST-change maps to the moment of the change.
+ */
+time_t tz_window::mktime(time_t local) const {
+  if (segments.empty())
+    return local;
+
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const time_t t = local - segments[i].gmtoff;
+    if (t >= segments[i].start &&
+        (i + 1 == segments.size() || t < segments[i + 1].start))
+      return t;
+  }
+  for (size_t i = 1; i < segments.size(); ++i) {
+    if (local - segments[i - 1].gmtoff >= segments[i].start &&
+        local - segments[i].gmtoff < segments[i].start)
+      return segments[i].start;
   }
-  return *this;
+  return local - segments.front().gmtoff;
+}
+
+void time_ticks::set(time_t st, it_type ty) {
+  step = st;
+  type = ty;
+  ticks.clear();
 }
 
-time_iterator &time_iterator::operator--() {
+void time_ticks::push(const tz_window &tz, time_t t) {
+  time_tick tick;
+  tick.time = t;
+  tz.localtime(t, tick.tm);
+  ticks.push_back(tick);
+}
+
+/**
+ * generate all ticks between @a from and @a to (inclusive)
+ */
+void time_ticks::generate(const tz_window &tz, time_t from, time_t to) {
+  ticks.clear();
+  if (!step || from > to)
+    return;
+
   switch (type) {
-  case seconds:
-  case weeks:
-    now_t -= step;
+  case seconds: {
+    // aligned to local time, separately for every offset in the window
+    for (time_t lo = from; lo <= to;) {
+      const long off = tz.gmtoff(lo);
+      const time_t change = tz.next_change(lo);
+      const time_t hi = std::min(to, change - 1);
+      for (time_t t = floor_div(lo + off + step - 1, step) * step - off;
+           t <= hi; t += step)
+        push(tz, t);
+      if (change > to)
+        break;
+      lo = change;
+    }
     break;
-  case month:
-    // max step is 12!
-    now_tm.tm_mon -= step;
-    if (now_tm.tm_mon < 1) {
-      now_tm.tm_mon += 12;
-      --now_tm.tm_year;
+  }
+  case weeks: {
+    // mondays at local midnight
+    const long first = floor_div(from + tz.gmtoff(from), day);
+    long monday = first - (first % 7 + 10) % 7;
+    for (;; monday += 7 * step) {
+      const time_t t = tz.mktime(monday * day);
+      if (t > to)
+        break;
+      if (t >= from)
+        push(tz, t);
     }
-    now_t = mktime(&now_tm);
     break;
-  case years:
-    now_tm.tm_year -= step;
-    now_t = mktime(&now_tm);
+  }
+  case month:
+  case years: {
+    // first of month (or january) at local midnight
+    long y;
+    unsigned m, d;
+    tz_window::civil_from_days(floor_div(from + tz.gmtoff(from), day), y, m,
+                               d);
+    // months since year 0
+    const long mstep = type == years ? 12 * step : step;
+    long mon = floor_div(y * 12 + (m - 1), mstep) * mstep;
+    for (;; mon += mstep) {
+      const long year = floor_div(mon, 12);
+      const unsigned first = mon - year * 12 + 1;
+      const time_t t =
+          tz.mktime(tz_window::days_from_civil(year, first, 1) * day);
+      if (t > to)
+        break;
+      if (t >= from)
+        push(tz, t);
+    }
     break;
   }
-  return *this;
+  }
 }
 
-time_t time_iterator::interval() {
+/**
+ * (approximate) distance between two ticks
+ */
+time_t time_ticks::interval() const {
   switch (type) {
   case seconds:
-  case weeks:
     return step;
+  case weeks:
+    return step * 7 * day;
   case month:
-    return step * 3600 * 24 * 30;
+    return step * 30 * day;
   case years:
-    return step * 3600 * 24 * 365;
+    return step * 365 * day;
   }
   return 0;
 }
 
-const struct tm *time_iterator::tm() {
-  switch (type) {
-  case seconds:
-  case weeks:
-    tzset();
-    localtime_r(&now_t, &now_tm);
-    break;
-  case month:
-  case years:
-    break;
-  }
-  return &now_tm;
+/**
+ * middle between tick @a i and the following one
+ */
+time_t time_ticks::center(const_iterator i) const {
+  const_iterator next = i + 1;
+  if (next != end())
+    return i->time + (next->time - i->time) / 2;
+  return i->time + interval() / 2;
 }
@@ -25,42 +25,80 @@
 #include <sys/time.h>
 #include <time.h>
 
-#include <iostream>
+#include <vector>
 
-class time_iterator {
+/**
+ * the local timezone within a time-window
+ *
+ * the offsets to UTC and their transitions (DST) are resolved once with
+ * a few calls to localtime_r, afterwards conversions between UTC and
+ * local time are plain arithmetic.  Transitions are searched in steps
+ * of a week, so two transitions less than a week apart may be missed.
+ */
+class tz_window {
 public:
-  enum it_type { seconds, weeks, month, years };
+  tz_window() {}
+  tz_window(time_t begin, time_t end) { set(begin, end); }
+  void set(time_t begin, time_t end);
 
-  time_iterator();
-  time_iterator(time_t start, time_t step, it_type type = seconds);
-  void set(time_t start, time_t step, it_type type = seconds);
+  void localtime(time_t t, struct tm &tm) const;
+  time_t mktime(time_t local) const;
+  long gmtoff(time_t t) const { return segment_at(t).gmtoff; }
+  time_t next_change(time_t t) const;
 
-  time_iterator &operator++();
-  time_iterator &operator--();
-  time_t &operator*();
-  time_t *operator->();
+  // days since the epoch and back
+  static long days_from_civil(long y, unsigned m, unsigned d);
+  static void civil_from_days(long z, long &y, unsigned &m, unsigned &d);
 
-  bool valid();
-  time_t interval();
-  const struct tm *tm();
+private:
+  struct segment {
+    time_t start; // first second of this offset
+    long gmtoff;
+    int isdst;
+    const char *zone;
+  };
+  const segment &segment_at(time_t t) const;
 
-protected:
-  it_type type;
-  time_t now_t;
-  struct tm now_tm;
-  time_t step;
+  std::vector<segment> segments;
+};
+
+/**
+ * a tick on the time-axis with its local broken-down time
+ */
+struct time_tick {
+  time_t time;
+  struct tm tm;
 };
 
-inline time_iterator::time_iterator(time_t start, time_t step, it_type type) {
-  set(start, step, type);
-}
+/**
+ * all ticks of one kind (minor, major, labels) of a time-axis
+ *
+ * the ticks are aligned to local time, ticks of weeks, months and years
+ * are at local midnight even across DST-changes.
+ */
+class time_ticks {
+public:
+  enum it_type { seconds, weeks, month, years };
+  typedef std::vector<time_tick>::const_iterator const_iterator;
 
-inline time_iterator::time_iterator() { set(0, 0); }
+  time_ticks() : type(seconds), step(0) {}
+  void set(time_t step, it_type type = seconds);
+  void generate(const tz_window &tz, time_t from, time_t to);
 
-inline time_t &time_iterator::operator*() { return now_t; }
+  bool valid() const { return step != 0; }
+  time_t interval() const;
+  time_t center(const_iterator i) const;
 
-inline time_t *time_iterator::operator->() { return &now_t; }
+  const_iterator begin() const { return ticks.begin(); }
+  const_iterator end() const { return ticks.end(); }
+  size_t size() const { return ticks.size(); }
 
-inline bool time_iterator::valid() { return step != 0; }
+private:
+  void push(const tz_window &tz, time_t t);
+
+  it_type type;
+  time_t step;
+  std::vector<time_tick> ticks;
+};
 
 #endif
@@ -0,0 +1,98 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+
+#include "timing.h"
+
+void stage_stats::add(double ms) {
+  samples_[pos_] = ms;
+  pos_ = (pos_ + 1) % history;
+  total_ += ms;
+  ++count_;
+}
+
+double stage_stats::last() const {
+  if (!count_)
+    return 0.0;
+  return samples_[(pos_ + history - 1) % history];
+}
+
+double stage_stats::average() const {
+  if (!count_)
+    return 0.0;
+  return total_ / count_;
+}
+
+/**
+ * 99th percentile of the last samples
+ */
+double stage_stats::p99() const {
+  const int n = std::min<size_t>(count_, history);
+  if (!n)
+    return 0.0;
+  double sorted[history];
+  std::copy(samples_, samples_ + n, sorted);
+  const int k = (n * 99 + 99) / 100 - 1;
+  std::nth_element(sorted, sorted + k, sorted + n);
+  return sorted[k];
+}
+
+/**
+ * adds the accumulated times of all stages run since the last commit
+ */
+void frame_timing::commit() {
+  for (int i = 0; i < num_stages; ++i) {
+    if (touched[i])
+      stages[i].add(pending[i]);
+    pending[i] = 0.0;
+    touched[i] = false;
+  }
+}
+
+const char *frame_timing::name(stage s) {
+  static const char *const names[num_stages] = {
+      "frame",  "fetch",    "rrd_fetch", "minmax", "xgrid",
+      "labels", "polygons", "painter",   "layout",
+  };
+  return names[s];
+}
+
+/**
+ * writes a table of all stages to @a os
+ */
+void frame_timing::summary(std::ostream &os) const {
+  std::ios::fmtflags flags = os.flags();
+  os << std::left << std::setw(10) << "stage" << std::right << std::setw(8)
+     << "count" << std::setw(10) << "last/ms" << std::setw(10) << "avg/ms"
+     << std::setw(10) << "p99/ms" << "\n";
+  os << std::fixed << std::setprecision(3);
+  for (int i = 0; i < num_stages; ++i) {
+    const stage_stats &s = stages[i];
+    os << std::left << std::setw(10) << name(stage(i)) << std::right
+       << std::setw(8) << s.count() << std::setw(10) << s.last()
+       << std::setw(10) << s.average() << std::setw(10) << s.p99() << "\n";
+  }
+  os << "bytes fetched: " << bytes_fetched_
+     << ", points drawn: " << points_drawn_ << std::endl;
+  os.flags(flags);
+}
@@ -0,0 +1,141 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <chrono>
+#include <cstddef>
+#include <iosfwd>
+
+/**
+ * running statistics of the durations of one stage
+ *
+ * keeps the last @a history samples for the percentile.
+ */
+class stage_stats {
+public:
+  stage_stats() : count_(0), pos_(0), total_(0.0), samples_() {}
+
+  void add(double ms);
+  size_t count() const { return count_; }
+  double last() const;
+  double average() const;
+  double p99() const;
+
+private:
+  static const int history = 256;
+  size_t count_;
+  int pos_;
+  double total_;
+  double samples_[history];
+};
+
+/**
+ * timing of fetching, layout and drawing of a Graph
+ *
+ * times are accumulated per stage until commit() adds them as one
+ * sample, so a stage run once per subgraph still counts once per frame.
+ */
+class frame_timing {
+public:
+  enum stage {
+    frame,      // drawAll as a whole
+    fetch,      // fetchAllData as a whole
+    rrd_fetch,  // time spent in rrd_fetch_r
+    minmax,     // ds_minmax and range adjustment
+    xgrid,      // findXGrid
+    labels,     // formatting and drawing of axis-labels
+    polygons,   // building the polygons
+    painter,    // QPainter drawing the graphs
+    layout,     // layout
+    num_stages
+  };
+
+  frame_timing() : pending(), touched(), bytes_fetched_(0), points_drawn_(0) {}
+
+  void add(stage s, double ms) {
+    pending[s] += ms;
+    touched[s] = true;
+  }
+  void commit();
+  const stage_stats &operator[](stage s) const { return stages[s]; }
+  static const char *name(stage s);
+
+  size_t bytes_fetched() const { return bytes_fetched_; }
+  void bytes_fetched(size_t b) { bytes_fetched_ = b; }
+  size_t points_drawn() const { return points_drawn_; }
+  void points_drawn(size_t p) { points_drawn_ = p; }
+
+  void summary(std::ostream &os) const;
+
+private:
+  stage_stats stages[num_stages];
+  double pending[num_stages];
+  bool touched[num_stages];
+  size_t bytes_fetched_, points_drawn_;
+};
+
+/**
+ * measures the time of a stage and adds it to a frame_timing
+ *
+ * the timer may be stopped and started several times to accumulate
+ * interleaved work, the sum is added on destruction.
+ */
+class stage_timer {
+  typedef std::chrono::steady_clock clock;
+
+public:
+  stage_timer(frame_timing &t, frame_timing::stage s, bool running = true)
+      : timing(t), stage(s), running(running), total(0) {
+    if (running)
+      begin = clock::now();
+  }
+  ~stage_timer() {
+    stop();
+    timing.add(stage, std::chrono::duration<double, std::milli>(total).count());
+  }
+
+  void start() {
+    if (!running) {
+      begin = clock::now();
+      running = true;
+    }
+  }
+  void stop() {
+    if (running) {
+      total += clock::now() - begin;
+      running = false;
+    }
+  }
+
+private:
+  stage_timer(const stage_timer &) = delete;
+  stage_timer &operator=(const stage_timer &) = delete;
+
+  frame_timing &timing;
+  frame_timing::stage stage;
+  bool running;
+  clock::time_point begin;
+  clock::duration total;
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+
+std::atomic<bool> tracer::enabled_(false);
+
+namespace {
+
+struct trace_event {
+  const char *name;
+  long tid;
+  double ts, dur; // microseconds
+  std::string detail;
+};
+
+struct trace_state {
+  std::mutex mutex;
+  std::string filename;
+  tracer::clock::time_point epoch;
+  std::vector<trace_event> events;
+};
+
+trace_state &state() {
+  static trace_state s;
+  return s;
+}
+
+long thread_id() {
+  static thread_local long tid = syscall(SYS_gettid);
+  return tid;
+}
+
+/**
+ * writes @a s as a JSON-string
+ */
+void write_json_string(FILE *out, const std::string &s) {
+  fputc('"', out);
+  for (unsigned char c : s) {
+    switch (c) {
+    case '"':
+      fputs("\\\"", out);
+      break;
+    case '\\':
+      fputs("\\\\", out);
+      break;
+    case '\n':
+      fputs("\\n", out);
+      break;
+    default:
+      if (c < 0x20)
+        fprintf(out, "\\u%04x", c);
+      else
+        fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+} // namespace
+
+/**
+ * starts recording spans, they will be written to @a filename
+ */
+bool tracer::start(const std::string &filename) {
+  if (filename.empty())
+    return false;
+
+  trace_state &s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  s.filename = filename;
+  s.epoch = clock::now();
+  s.events.clear();
+  s.events.reserve(1 << 16);
+  enabled_ = true;
+  return true;
+}
+
+/**
+ * stops recording and writes the trace-file
+ */
+bool tracer::stop() {
+  if (!enabled_)
+    return true;
+
+  trace_state &s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  enabled_ = false;
+
+  FILE *out = fopen(s.filename.c_str(), "w");
+  if (!out)
+    return false;
+
+  const int pid = getpid();
+  fprintf(out, "{\"traceEvents\":[\n");
+  fprintf(out,
+          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+          "\"args\":{\"name\":\"kcollectd\"}}",
+          pid, pid);
+  for (const trace_event &e : s.events) {
+    fprintf(out,
+            ",\n{\"name\":\"%s\",\"cat\":\"kcollectd\",\"ph\":\"X\","
+            "\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f",
+            e.name, pid, e.tid, e.ts, e.dur);
+    if (!e.detail.empty()) {
+      fputs(",\"args\":{\"detail\":", out);
+      write_json_string(out, e.detail);
+      fputc('}', out);
+    }
+    fputc('}', out);
+  }
+  fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  s.events.clear();
+  return fclose(out) == 0;
+}
+
+/**
+ * adds a complete span
+ */
+void tracer::complete(const char *name, clock::time_point begin,
+                      clock::time_point end, const std::string &detail) {
+  trace_state &s = state();
+  typedef std::chrono::duration<double, std::micro> micro;
+  const long tid = thread_id();
+
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if (!enabled_)
+    return;
+  s.events.push_back({name, tid, micro(begin - s.epoch).count(),
+                      micro(end - begin).count(), detail});
+}
@@ -0,0 +1,89 @@
+/* -*- c++ -*- */
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/**
+ * recorder for spans in Chrome trace-event format
+ *
+ * spans are collected in memory and written as JSON on stop(), the
+ * file can be opened in Perfetto or chrome://tracing.  As long as
+ * tracing is not started, a trace_span costs a test of one flag.
+ */
+class tracer {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+  static bool start(const std::string &filename);
+  static bool stop();
+
+  static void complete(const char *name, clock::time_point begin,
+                       clock::time_point end, const std::string &detail);
+
+private:
+  static std::atomic<bool> enabled_;
+};
+
+/**
+ * evaluates the detail of a span only while tracing
+ */
+#define TRACE_DETAIL(expr) (tracer::enabled() ? std::string(expr) : std::string())
+
+/**
+ * records the lifetime of the object as a span named @a name
+ *
+ * @a name must be a string literal.
+ */
+class trace_span {
+public:
+  explicit trace_span(const char *name)
+      : name_(tracer::enabled() ? name : 0) {
+    if (name_)
+      begin = tracer::clock::now();
+  }
+  trace_span(const char *name, const std::string &detail)
+      : name_(tracer::enabled() ? name : 0) {
+    if (name_) {
+      detail_ = detail;
+      begin = tracer::clock::now();
+    }
+  }
+  ~trace_span() {
+    if (name_)
+      tracer::complete(name_, begin, tracer::clock::now(), detail_);
+  }
+
+private:
+  trace_span(const trace_span &) = delete;
+  trace_span &operator=(const trace_span &) = delete;
+
+  const char *name_;
+  std::string detail_;
+  tracer::clock::time_point begin;
+};
+
+#endif
@@ -0,0 +1,441 @@
+/*
+ * This file is part of the source of kcollectd, a viewer for
+ * rrd-databases created by collectd
+ *
+ * Copyright (C) 2008 M G Berberich
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * kcollectd-mkrrdtree: generates a synthetic, collectd-shaped tree of
+ * rrd-files for scale-testing kcollectd.
+ *
+ * The layout follows what collectd's rrdtool-plugin writes:
+ *
+ *   <basedir>/<host>/<plugin>[-<plugin-instance>]/<type>[-<type-instance>].rrd
+ *
+ * Plugin directories carry dashes ("cpu-0", "df-var-log", ...) so
+ * that the prefix-grouping in the sensor tree is exercised.  The result
+ * can be opened with "kcollectd --basedir <basedir>".
+ */
+
+#include <getopt.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include <rrd.h>
+
+namespace {
+
+struct options {
+  std::string basedir;
+  int hosts = 4;
+  int instances = 4;
+  int files = 0; // 0: all type-instances of the template
+  int ds = 0;    // 0: as given by the template
+  std::string rra = "collectd";
+  unsigned long step = 10;
+  time_t history = 3600;
+  unsigned long fill = 0; // 0: one update per step
+  unsigned int seed = 1;
+  bool verbose = false;
+};
+
+enum ds_type { gauge, derive };
+
+/**
+ * template for a plugin-directory: a collectd plugin, its instances
+ * and the types (rrd-files) it writes
+ */
+struct plugin_template {
+  const char *plugin;
+  // instance names, "%d" is replaced by a running number, an empty
+  // list means a plugin without instances
+  std::vector<std::string> instances;
+  const char *type;
+  std::vector<std::string> type_instances;
+  std::vector<std::string> ds;
+  ds_type dstype;
+};
+
+const std::vector<plugin_template> &plugin_templates() {
+  static const std::vector<plugin_template> templates = {
+      {"cpu",
+       {"%d"},
+       "cpu",
+       {"idle", "user", "system", "nice", "wait", "interrupt", "softirq",
+        "steal"},
+       {"value"},
+       derive},
+      {"interface",
+       {"eth%d", "lo", "bond%d", "vlan-%d"},
+       "if_octets",
+       {""},
+       {"rx", "tx"},
+       derive},
+      {"interface",
+       {"eth%d", "lo", "bond%d", "vlan-%d"},
+       "if_packets",
+       {""},
+       {"rx", "tx"},
+       derive},
+      {"df",
+       {"root", "var", "var-log", "srv-data-%d"},
+       "df_complex",
+       {"free", "used", "reserved"},
+       {"value"},
+       gauge},
+      {"disk",
+       {"sd%c", "dm-%d"},
+       "disk_octets",
+       {""},
+       {"read", "write"},
+       derive},
+      {"disk",
+       {"sd%c", "dm-%d"},
+       "disk_ops",
+       {""},
+       {"read", "write"},
+       derive},
+      {"memory",
+       {},
+       "memory",
+       {"used", "free", "cached", "buffered"},
+       {"value"},
+       gauge},
+      {"load", {}, "load", {""}, {"shortterm", "midterm", "longterm"}, gauge},
+      {"processes",
+       {},
+       "ps_state",
+       {"running", "sleeping", "zombies", "stopped", "blocked"},
+       {"value"},
+       gauge},
+      {"thermal", {"thermal_zone%d"}, "temperature", {""}, {"value"}, gauge},
+  };
+  return templates;
+}
+
+/**
+ * expands an instance-pattern for instance number @a n
+ */
+std::string expand(const std::string &pattern, int n) {
+  std::string::size_type p = pattern.find('%');
+  if (p == std::string::npos || p + 1 >= pattern.size())
+    return pattern;
+
+  std::string value;
+  if (pattern[p + 1] == 'c')
+    value = std::string(1, 'a' + n % 26);
+  else
+    value = std::to_string(n);
+  return pattern.substr(0, p) + value + pattern.substr(p + 2);
+}
+
+/**
+ * all plugin-directory names of a template for @a count instances
+ */
+std::vector<std::string> plugin_dirs(const plugin_template &t, int count) {
+  std::vector<std::string> result;
+  if (t.instances.empty()) {
+    result.push_back(t.plugin);
+    return result;
+  }
+  for (const std::string &pattern : t.instances) {
+    const bool numbered = pattern.find('%') != std::string::npos;
+    const int n = numbered ? count : 1;
+    for (int i = 0; i < n; ++i)
+      result.push_back(std::string(t.plugin) + "-" + expand(pattern, i));
+  }
+  return result;
+}
+
+/**
+ * rra-definitions for the chosen layout
+ *
+ * "collectd" mimics the defaults of collectd's rrdtool-plugin (1200
+ * rows, timespans from an hour to a year, AVERAGE, MIN and MAX),
+ * "minimal" is a single AVERAGE-rra at full resolution.
+ */
+bool rra_defs(const std::string &layout, unsigned long step, time_t history,
+              std::vector<std::string> &defs) {
+  defs.clear();
+  if (layout == "minimal") {
+    const unsigned long rows = std::max<unsigned long>(history / step, 1200);
+    defs.push_back("RRA:AVERAGE:0.1:1:" + std::to_string(rows));
+    return true;
+  }
+  if (layout != "collectd")
+    return false;
+
+  const unsigned long rrarows = 1200;
+  const unsigned long timespans[] = {3600, 86400, 604800, 2678400, 31622400};
+  const char *cfs[] = {"AVERAGE", "MIN", "MAX"};
+  for (const char *cf : cfs) {
+    unsigned long last_cdp_len = 0;
+    for (unsigned long span : timespans) {
+      const unsigned long cdp_len =
+          std::ceil(double(span) / double(rrarows * step));
+      const unsigned long cdp_num =
+          std::ceil(double(span) / double(cdp_len * step));
+      if (cdp_len == last_cdp_len)
+        continue;
+      last_cdp_len = cdp_len;
+      std::ostringstream os;
+      os << "RRA:" << cf << ":0.1:" << cdp_len << ":" << cdp_num;
+      defs.push_back(os.str());
+    }
+  }
+  return true;
+}
+
+/**
+ * creates one rrd-file and fills it with a random walk
+ */
+bool make_rrd(const options &opt, const std::string &file,
+              const std::vector<std::string> &dsnames, ds_type type,
+              const std::vector<std::string> &rras, std::mt19937 &rng) {
+  const time_t now = time(0);
+  const time_t first = now - opt.history - opt.step;
+  const unsigned long fill = opt.fill ? opt.fill : opt.step;
+  const unsigned long heartbeat = 2 * std::max(opt.step, fill);
+
+  std::vector<std::string> defs;
+  for (const std::string &name : dsnames) {
+    std::ostringstream os;
+    os << "DS:" << name << ":" << (type == gauge ? "GAUGE" : "DERIVE") << ":"
+       << heartbeat << ":" << (type == gauge ? "U" : "0") << ":U";
+    defs.push_back(os.str());
+  }
+  defs.insert(defs.end(), rras.begin(), rras.end());
+
+  std::vector<const char *> argv;
+  for (const std::string &d : defs)
+    argv.push_back(d.c_str());
+
+  rrd_clear_error();
+  if (rrd_create_r(file.c_str(), opt.step, first, argv.size(), argv.data())) {
+    std::cerr << file << ": " << rrd_get_error() << std::endl;
+    return false;
+  }
+
+  if (opt.history <= 0)
+    return true;
+
+  // random walk, derives get a monotonically increasing counter
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  std::vector<double> value(dsnames.size());
+  for (double &v : value)
+    v = 50.0 + 40.0 * dist(rng);
+
+  const size_t batch = 1024;
+  std::vector<std::string> updates;
+  updates.reserve(batch);
+  for (time_t t = first + fill; t <= now; t += fill) {
+    std::ostringstream os;
+    os << t;
+    for (double &v : value) {
+      if (type == gauge)
+        v = std::min(100.0, std::max(0.0, v + 2.0 * dist(rng)));
+      else
+        v += fill * (1000.0 + 900.0 * dist(rng));
+      if (type == gauge)
+        os << ":" << v;
+      else
+        os << ":" << static_cast<long long>(v);
+    }
+    updates.push_back(os.str());
+
+    if (updates.size() == batch || t + time_t(fill) > now) {
+      argv.clear();
+      for (const std::string &u : updates)
+        argv.push_back(u.c_str());
+      rrd_clear_error();
+      if (rrd_update_r(file.c_str(), 0, argv.size(), argv.data())) {
+        std::cerr << file << ": " << rrd_get_error() << std::endl;
+        return false;
+      }
+      updates.clear();
+    }
+  }
+  return true;
+}
+
+void usage(const char *name) {
+  std::cerr
+      << "usage: " << name << " [options] <basedir>\n"
+      << "\n"
+      << "generates a collectd-shaped tree of rrd-files\n"
+      << "\n"
+      << "  -H, --hosts N        number of hosts (default 4)\n"
+      << "  -i, --instances N    instances per numbered plugin (default 4)\n"
+      << "  -f, --files N        max. rrd-files per plugin-directory\n"
+      << "                       (default: all of the template)\n"
+      << "  -d, --ds N           datasources per rrd-file\n"
+      << "                       (default: as collectd would write)\n"
+      << "  -r, --rra LAYOUT     rra-layout: collectd or minimal\n"
+      << "                       (default collectd)\n"
+      << "  -s, --step SECONDS   step of the rrds (default 10)\n"
+      << "  -t, --history SECS   history to fill with data (default 3600)\n"
+      << "  -F, --fill SECONDS   interval between generated updates\n"
+      << "                       (default: step)\n"
+      << "  -S, --seed N         seed for the random data (default 1)\n"
+      << "  -v, --verbose        print every file created\n"
+      << "  -h, --help           this help\n";
+}
+
+bool parse_options(int argc, char **argv, options &opt) {
+  static const struct option long_options[] = {
+      {"hosts", required_argument, 0, 'H'},
+      {"instances", required_argument, 0, 'i'},
+      {"files", required_argument, 0, 'f'},
+      {"ds", required_argument, 0, 'd'},
+      {"rra", required_argument, 0, 'r'},
+      {"step", required_argument, 0, 's'},
+      {"history", required_argument, 0, 't'},
+      {"fill", required_argument, 0, 'F'},
+      {"seed", required_argument, 0, 'S'},
+      {"verbose", no_argument, 0, 'v'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, "H:i:f:d:r:s:t:F:S:vh", long_options,
+                          0)) != -1) {
+    switch (c) {
+    case 'H':
+      opt.hosts = atoi(optarg);
+      break;
+    case 'i':
+      opt.instances = atoi(optarg);
+      break;
+    case 'f':
+      opt.files = atoi(optarg);
+      break;
+    case 'd':
+      opt.ds = atoi(optarg);
+      break;
+    case 'r':
+      opt.rra = optarg;
+      break;
+    case 's':
+      opt.step = strtoul(optarg, 0, 10);
+      break;
+    case 't':
+      opt.history = strtol(optarg, 0, 10);
+      break;
+    case 'F':
+      opt.fill = strtoul(optarg, 0, 10);
+      break;
+    case 'S':
+      opt.seed = strtoul(optarg, 0, 10);
+      break;
+    case 'v':
+      opt.verbose = true;
+      break;
+    default:
+      return false;
+    }
+  }
+  if (optind + 1 != argc)
+    return false;
+  opt.basedir = argv[optind];
+  return opt.hosts > 0 && opt.instances > 0 && opt.step > 0 &&
+         opt.files >= 0 && opt.ds >= 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  namespace fs = boost::filesystem;
+
+  options opt;
+  if (!parse_options(argc, argv, opt)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> rras;
+  if (!rra_defs(opt.rra, opt.step, opt.history, rras)) {
+    std::cerr << "unknown rra-layout ‘" << opt.rra << "’" << std::endl;
+    return 1;
+  }
+
+  std::mt19937 rng(opt.seed);
+  unsigned long files = 0, datasources = 0;
+
+  for (int h = 0; h < opt.hosts; ++h) {
+    char hostname[64];
+    snprintf(hostname, sizeof(hostname), "host%04d.example.org", h);
+
+    for (const plugin_template &t : plugin_templates()) {
+      for (const std::string &dir : plugin_dirs(t, opt.instances)) {
+        const fs::path path = fs::path(opt.basedir) / hostname / dir;
+        try {
+          fs::create_directories(path);
+        } catch (const fs::filesystem_error &e) {
+          std::cerr << e.what() << std::endl;
+          return 1;
+        }
+
+        // datasources, possibly resized to the requested count
+        std::vector<std::string> dsnames = t.ds;
+        if (opt.ds) {
+          dsnames.resize(opt.ds);
+          for (int i = t.ds.size(); i < opt.ds; ++i)
+            dsnames[i] = "ds" + std::to_string(i);
+        }
+
+        // rrd-files, possibly cut or extended to the requested count
+        std::vector<std::string> types;
+        for (const std::string &ti : t.type_instances)
+          types.push_back(ti.empty() ? std::string(t.type)
+                                     : std::string(t.type) + "-" + ti);
+        if (opt.files) {
+          for (int i = types.size(); i < opt.files; ++i)
+            types.push_back(std::string(t.type) + "-extra" +
+                            std::to_string(i));
+          types.resize(opt.files);
+        }
+
+        for (const std::string &type : types) {
+          const fs::path file = path / (type + ".rrd");
+          if (!make_rrd(opt, file.string(), dsnames, t.dstype, rras, rng))
+            return 1;
+          if (opt.verbose)
+            std::cout << file.string() << std::endl;
+          ++files;
+          datasources += dsnames.size();
+        }
+      }
+    }
+  }
+
+  std::cout << "created " << files << " rrd-files with " << datasources
+            << " datasources for " << opt.hosts << " hosts in "
+            << opt.basedir << std::endl;
+  return 0;
+}